@@ -0,0 +1,170 @@
+/* Duplicate-and-play benchmark
+ *
+ * Times DuplicateSoundBuffer and the first Play of the duplicate, the way
+ * games play overlapping instances of a cached sample, with a configured 3D
+ * hardware buffer as the original. Duplicates that are released without being
+ * played are timed too. Runs on OpenAL's null output.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#define COBJMACROS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <windows.h>
+#include <dsound.h>
+
+#define NUM_ROUNDS 2000
+/* Duplicates alive at once, as with overlapping instances. */
+#define NUM_LIVE 16
+
+static LARGE_INTEGER Freq;
+
+static double elapsed_us(const LARGE_INTEGER *start, const LARGE_INTEGER *end)
+{
+    return (double)(end->QuadPart - start->QuadPart) * 1000000.0 / (double)Freq.QuadPart;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static void report(const char *name, double *times, int count)
+{
+    double total = 0.0;
+    int i;
+
+    for(i = 0;i < count;++i)
+        total += times[i];
+    qsort(times, count, sizeof(*times), cmp_double);
+    printf("%-22s mean %7.1f us, median %7.1f us, 99th %7.1f us\n", name, total/count,
+           times[count/2], times[count*99/100]);
+}
+
+static IDirectSoundBuffer *create_original(IDirectSound8 *ds)
+{
+    IDirectSoundBuffer *dsb = NULL;
+    IDirectSound3DBuffer *dsb3d = NULL;
+    WAVEFORMATEX wfx;
+    DSBUFFERDESC desc;
+    SHORT *data;
+    DWORD size, i;
+
+    memset(&wfx, 0, sizeof(wfx));
+    wfx.wFormatTag = WAVE_FORMAT_PCM;
+    wfx.nChannels = 1;
+    wfx.nSamplesPerSec = 22050;
+    wfx.wBitsPerSample = 16;
+    wfx.nBlockAlign = 2;
+    wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.dwSize = sizeof(desc);
+    desc.dwFlags = DSBCAPS_STATIC | DSBCAPS_LOCHARDWARE | DSBCAPS_CTRL3D |
+                   DSBCAPS_CTRLFREQUENCY | DSBCAPS_CTRLVOLUME | DSBCAPS_GLOBALFOCUS;
+    desc.dwBufferBytes = size = wfx.nAvgBytesPerSec / 4;
+    desc.lpwfxFormat = &wfx;
+    if(FAILED(IDirectSound8_CreateSoundBuffer(ds, &desc, &dsb, NULL)))
+        return NULL;
+
+    IDirectSoundBuffer_Lock(dsb, 0, size, (void**)&data, &size, NULL, NULL, 0);
+    for(i = 0;i < size/2;++i)
+        data[i] = (SHORT)(sin(i * 440.0 * 6.2831853 / 22050.0) * 12000.0);
+    IDirectSoundBuffer_Unlock(dsb, data, size, NULL, 0);
+
+    IDirectSoundBuffer_SetVolume(dsb, -600);
+    IDirectSoundBuffer_SetFrequency(dsb, 24000);
+    if(SUCCEEDED(IDirectSoundBuffer_QueryInterface(dsb, &IID_IDirectSound3DBuffer, (void**)&dsb3d)))
+    {
+        IDirectSound3DBuffer_SetPosition(dsb3d, 4.0f, 1.0f, -3.0f, DS3D_IMMEDIATE);
+        IDirectSound3DBuffer_SetMinDistance(dsb3d, 2.0f, DS3D_IMMEDIATE);
+        IDirectSound3DBuffer_SetConeAngles(dsb3d, 90, 180, DS3D_IMMEDIATE);
+        IDirectSound3DBuffer_Release(dsb3d);
+    }
+    return dsb;
+}
+
+int main(void)
+{
+    static double dup_us[NUM_ROUNDS], play_us[NUM_ROUNDS], total_us[NUM_ROUNDS];
+    static double idle_us[NUM_ROUNDS];
+    IDirectSoundBuffer *live[NUM_LIVE] = { NULL };
+    IDirectSoundBuffer *orig, *dup;
+    IDirectSound8 *ds = NULL;
+    LARGE_INTEGER t0, t1, t2;
+    int i, n;
+
+    SetEnvironmentVariableA("ALSOFT_DRIVERS", "null");
+    QueryPerformanceFrequency(&Freq);
+
+    if(FAILED(DirectSoundCreate8(NULL, &ds, NULL)))
+    {
+        fprintf(stderr, "DirectSoundCreate8 failed\n");
+        return 1;
+    }
+    IDirectSound8_SetCooperativeLevel(ds, GetDesktopWindow(), DSSCL_PRIORITY);
+    if(!(orig=create_original(ds)))
+    {
+        fprintf(stderr, "Couldn't create the original buffer\n");
+        return 1;
+    }
+
+    for(i = n = 0;i < NUM_ROUNDS;++i)
+    {
+        /* Make room for the next instance, like a game's voice list. */
+        if(live[i%NUM_LIVE])
+            IDirectSoundBuffer_Release(live[i%NUM_LIVE]);
+        live[i%NUM_LIVE] = NULL;
+
+        QueryPerformanceCounter(&t0);
+        if(FAILED(IDirectSound8_DuplicateSoundBuffer(ds, orig, &dup)))
+            continue;
+        QueryPerformanceCounter(&t1);
+        IDirectSoundBuffer_Play(dup, 0, 0, 0);
+        QueryPerformanceCounter(&t2);
+        dup_us[n] = elapsed_us(&t0, &t1);
+        play_us[n] = elapsed_us(&t1, &t2);
+        total_us[n] = elapsed_us(&t0, &t2);
+        live[i%NUM_LIVE] = dup;
+
+        /* A duplicate made but never played. */
+        QueryPerformanceCounter(&t0);
+        if(SUCCEEDED(IDirectSound8_DuplicateSoundBuffer(ds, orig, &dup)))
+        {
+            QueryPerformanceCounter(&t1);
+            IDirectSoundBuffer_Release(dup);
+            idle_us[n] = elapsed_us(&t0, &t1);
+        }
+        else
+            idle_us[n] = 0.0;
+        ++n;
+    }
+    if(n == 0)
+    {
+        fprintf(stderr, "DuplicateSoundBuffer failed\n");
+        return 1;
+    }
+
+    printf("%d rounds, %d duplicates playing at once\n", n, NUM_LIVE);
+    report("DuplicateSoundBuffer", dup_us, n);
+    report("first Play", play_us, n);
+    report("duplicate and play", total_us, n);
+    report("unplayed, and released", idle_us, n);
+
+    for(i = 0;i < NUM_LIVE;++i)
+    {
+        if(live[i])
+            IDirectSoundBuffer_Release(live[i]);
+    }
+    IDirectSoundBuffer_Release(orig);
+    IDirectSound8_Release(ds);
+    return 0;
+}
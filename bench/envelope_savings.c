@@ -0,0 +1,209 @@
+/* Envelope culling benchmark
+ *
+ * Plays synthetic one-shot sounds at several gains through the same envelope
+ * checks the update thread makes, and reports how many source-seconds voices
+ * spend without a source at each cull threshold, how often they hand one back
+ * and forth, and whether any audible stretch played without one. Also times
+ * computing the envelope, which Unlock does for static buffers. Doesn't need
+ * Windows or OpenAL.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "envelope.h"
+
+#define RATE 44100
+/* Updates per second, as FAKE_REFRESH_COUNT. */
+#define REFRESH 50
+#define STEP (RATE/REFRESH)
+#define PI 3.14159265358979323846
+
+struct Sound {
+    const char *name;
+    float seconds;
+    float (*level)(float t);
+    BOOL tonal;
+};
+
+/* Loud at once, then a long exponential tail. */
+static float explosion(float t)
+{ return expf(-t / 0.6f); }
+/* A short click. */
+static float footstep(float t)
+{ return (t < 0.3f) ? expf(-t / 0.03f) : 0.0f; }
+/* A quiet lead-in, syllables with pauses between phrases, and a trailing gap. */
+static float speech(float t)
+{
+    float phrase;
+    if(t < 0.5f || t > 3.2f) return 0.0f;
+    phrase = fmodf(t - 0.5f, 0.9f);
+    if(phrase > 0.6f) return 0.0f;
+    return 0.3f + 0.5f*fabsf(sinf((float)PI * phrase / 0.15f));
+}
+/* A slowly decaying tone. */
+static float bell(float t)
+{ return expf(-t / 1.5f); }
+/* Steady, 20dB down. */
+static float ambience(float t)
+{ (void)t; return 0.1f; }
+
+static const struct Sound Sounds[] = {
+    { "explosion", 4.0f, explosion, FALSE },
+    { "footstep", 0.3f, footstep, FALSE },
+    { "speech", 4.0f, speech, FALSE },
+    { "bell", 6.0f, bell, TRUE },
+    { "ambience", 5.0f, ambience, FALSE },
+};
+#define NUM_SOUNDS (sizeof(Sounds)/sizeof(Sounds[0]))
+
+/* Voice gains at the listener: 0, -10, -20 and -30dB. */
+static const float Gains[] = { 1.0f, 0.316f, 0.1f, 0.0316f };
+#define NUM_GAINS (sizeof(Gains)/sizeof(Gains[0]))
+
+static const LONG Thresholds[] = { -8000, -6000, -4000 };
+#define NUM_THRESHOLDS (sizeof(Thresholds)/sizeof(Thresholds[0]))
+
+struct Voice {
+    short *samples;
+    DWORD size;
+    struct Envelope env;
+};
+
+static unsigned int Seed = 1;
+
+static float noise(void)
+{
+    Seed = Seed*1103515245 + 12345;
+    return (float)((Seed>>16) & 0x7fff) / 16384.0f - 1.0f;
+}
+
+static void make_voice(struct Voice *voice, const struct Sound *sound)
+{
+    DWORD frames = (DWORD)(sound->seconds * RATE), i;
+
+    voice->size = frames * sizeof(short);
+    voice->samples = malloc(voice->size);
+    for(i = 0;i < frames;++i)
+    {
+        float t = (float)i / RATE;
+        float s = sound->tonal ? sinf(2.0f*(float)PI*880.0f*t) : noise();
+        voice->samples[i] = (short)(s * sound->level(t) * 32767.0f);
+    }
+    Envelope_Init(&voice->env, voice->size, sizeof(short));
+    Envelope_Update(&voice->env, (const BYTE*)voice->samples, 16, 0, voice->size);
+}
+
+struct Result {
+    DWORD updates;
+    DWORD released;
+    DWORD switches;
+    DWORD missed;
+};
+
+/* Plays the voice an update at a time. It gives up its source when it's quiet
+ * until the lookahead, as DSBuffer_CheckEnvelope does, and gets it back once
+ * it isn't, as DSPrimary_updatevirtual does. A missed update is one where it
+ * had no source for an audible block.
+ */
+static void play(const struct Voice *voice, float gain, LONG threshold, struct Result *res)
+{
+    const DWORD lookahead = STEP * ENVELOPE_LOOKAHEAD * sizeof(short);
+    float limit = Envelope_Limit(threshold, gain);
+    BOOL has_source;
+    DWORD pos;
+
+    has_source = !Envelope_IsQuiet(&voice->env, 0, lookahead, limit);
+    for(pos = 0;pos < voice->size;pos += STEP*sizeof(short))
+    {
+        BOOL quiet = Envelope_IsQuiet(&voice->env, pos, lookahead, limit);
+        if(has_source == quiet)
+        {
+            has_source = !quiet;
+            res->switches++;
+        }
+        if(!has_source)
+        {
+            DWORD end = pos + STEP*sizeof(short) - 1;
+            res->released++;
+            if(!Envelope_IsQuiet(&voice->env, pos, 0, limit) ||
+               (end < voice->size && !Envelope_IsQuiet(&voice->env, end, 0, limit)))
+                res->missed++;
+        }
+        res->updates++;
+    }
+}
+
+static void time_updates(struct Voice *voices)
+{
+    double seconds = 0.0, cpu;
+    clock_t start;
+    int round;
+    size_t i;
+
+    start = clock();
+    for(round = 0;round < 50;++round)
+    {
+        for(i = 0;i < NUM_SOUNDS;++i)
+        {
+            Envelope_Update(&voices[i].env, (const BYTE*)voices[i].samples, 16, 0,
+                            voices[i].size);
+            seconds += (double)voices[i].size / sizeof(short) / RATE;
+        }
+    }
+    cpu = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("Envelope update: %.1f us per second of 16-bit mono\n\n", cpu * 1000000.0 / seconds);
+}
+
+int main(void)
+{
+    struct Voice voices[NUM_SOUNDS];
+    size_t i, g, t;
+
+    for(i = 0;i < NUM_SOUNDS;++i)
+        make_voice(&voices[i], &Sounds[i]);
+
+    time_updates(voices);
+    printf("Columns are gains of 0, -10, -20 and -30dB, as time without a source/switches.\n\n");
+
+    for(t = 0;t < NUM_THRESHOLDS;++t)
+    {
+        struct Result total = { 0, 0, 0, 0 };
+
+        printf("Threshold %ld mB:\n", (long)Thresholds[t]);
+        for(i = 0;i < NUM_SOUNDS;++i)
+        {
+            printf("  %-10s", Sounds[i].name);
+            for(g = 0;g < NUM_GAINS;++g)
+            {
+                struct Result res = { 0, 0, 0, 0 };
+                play(&voices[i], Gains[g], Thresholds[t], &res);
+                printf(" %5.1f%%/%-2lu", res.released * 100.0 / res.updates,
+                       (unsigned long)res.switches);
+                total.updates += res.updates;
+                total.released += res.released;
+                total.switches += res.switches;
+                total.missed += res.missed;
+            }
+            printf("\n");
+        }
+        printf("  %.1f of %.1f source-seconds saved (%.1f%%), %lu switches, %lu missed updates\n\n",
+               (double)total.released / REFRESH, (double)total.updates / REFRESH,
+               total.released * 100.0 / total.updates, (unsigned long)total.switches,
+               (unsigned long)total.missed);
+    }
+
+    for(i = 0;i < NUM_SOUNDS;++i)
+    {
+        Envelope_Clear(&voices[i].env);
+        free(voices[i].samples);
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* Resampler policy benchmark
+ *
+ * Plays a set of looping 3D voices at assorted rates and distances, with a
+ * moving listener, through OpenAL's null output, and reports the CPU time the
+ * process spent under each DSOAL_RESAMPLER_POLICY. DSOAL reads the policy when
+ * it's loaded, so each one runs in a child process.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#define COBJMACROS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <windows.h>
+#include <dsound.h>
+
+#define NUM_VOICES 64
+#define RUN_SECONDS 10
+#define UPDATE_MS 10
+
+static const DWORD Rates[] = { 11025, 22050, 44100, 48000 };
+
+static DWORD64 get_cpu_us(void)
+{
+    FILETIME created, exited, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 10;
+}
+
+static IDirectSoundBuffer *create_voice(IDirectSound8 *ds, DWORD idx)
+{
+    IDirectSoundBuffer *dsb = NULL;
+    IDirectSound3DBuffer *dsb3d = NULL;
+    WAVEFORMATEX wfx;
+    DSBUFFERDESC desc;
+    SHORT *data;
+    DWORD size, i;
+    HRESULT hr;
+
+    memset(&wfx, 0, sizeof(wfx));
+    wfx.wFormatTag = WAVE_FORMAT_PCM;
+    wfx.nChannels = 1;
+    wfx.nSamplesPerSec = 22050;
+    wfx.wBitsPerSample = 16;
+    wfx.nBlockAlign = 2;
+    wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.dwSize = sizeof(desc);
+    desc.dwFlags = DSBCAPS_CTRL3D | DSBCAPS_CTRLFREQUENCY | DSBCAPS_CTRLVOLUME |
+                   DSBCAPS_GLOBALFOCUS;
+    desc.dwBufferBytes = size = wfx.nAvgBytesPerSec;
+    desc.lpwfxFormat = &wfx;
+    hr = IDirectSound8_CreateSoundBuffer(ds, &desc, &dsb, NULL);
+    if(FAILED(hr))
+    {
+        fprintf(stderr, "CreateSoundBuffer failed: 0x%08lx\n", hr);
+        return NULL;
+    }
+
+    IDirectSoundBuffer_Lock(dsb, 0, size, (void**)&data, &size, NULL, NULL, 0);
+    for(i = 0;i < size/2;++i)
+        data[i] = (SHORT)(sin(i * (220.0+idx*15.0) * 6.2831853 / 22050.0) * 12000.0);
+    IDirectSoundBuffer_Unlock(dsb, data, size, NULL, 0);
+
+    IDirectSoundBuffer_SetFrequency(dsb, Rates[idx % (sizeof(Rates)/sizeof(Rates[0]))]);
+    if(SUCCEEDED(IDirectSoundBuffer_QueryInterface(dsb, &IID_IDirectSound3DBuffer, (void**)&dsb3d)))
+    {
+        /* Spread from next to the listener to far enough to be quiet. */
+        float dist = 1.0f + (float)idx * 200.0f / NUM_VOICES;
+        IDirectSound3DBuffer_SetPosition(dsb3d, dist*cosf((float)idx), 0.0f,
+                                         dist*sinf((float)idx), DS3D_DEFERRED);
+        if(idx%3 == 0)
+            IDirectSound3DBuffer_SetVelocity(dsb3d, 1.0f, 0.0f, 0.0f, DS3D_DEFERRED);
+        IDirectSound3DBuffer_Release(dsb3d);
+    }
+    return dsb;
+}
+
+static int run_policy(void)
+{
+    IDirectSoundBuffer *voices[NUM_VOICES] = { NULL };
+    IDirectSound3DListener *listener = NULL;
+    IDirectSoundBuffer *primary = NULL;
+    IDirectSound8 *ds = NULL;
+    DSBUFFERDESC desc;
+    DWORD64 start, cpu;
+    DWORD i, t;
+
+    if(FAILED(DirectSoundCreate8(NULL, &ds, NULL)))
+    {
+        fprintf(stderr, "DirectSoundCreate8 failed\n");
+        return 1;
+    }
+    IDirectSound8_SetCooperativeLevel(ds, GetDesktopWindow(), DSSCL_PRIORITY);
+
+    memset(&desc, 0, sizeof(desc));
+    desc.dwSize = sizeof(desc);
+    desc.dwFlags = DSBCAPS_PRIMARYBUFFER | DSBCAPS_CTRL3D;
+    if(FAILED(IDirectSound8_CreateSoundBuffer(ds, &desc, &primary, NULL)) ||
+       FAILED(IDirectSoundBuffer_QueryInterface(primary, &IID_IDirectSound3DListener,
+                                                (void**)&listener)))
+    {
+        fprintf(stderr, "Couldn't get the listener\n");
+        return 1;
+    }
+
+    for(i = 0;i < NUM_VOICES;++i)
+    {
+        if(!(voices[i]=create_voice(ds, i)))
+            return 1;
+    }
+    IDirectSound3DListener_CommitDeferredSettings(listener);
+    for(i = 0;i < NUM_VOICES;++i)
+        IDirectSoundBuffer_Play(voices[i], 0, 0, DSBPLAY_LOOPING);
+
+    start = get_cpu_us();
+    for(t = 0;t < RUN_SECONDS*1000/UPDATE_MS;++t)
+    {
+        float a = (float)t * 0.01f;
+
+        /* The listener walks in a circle, which changes every voice's level
+         * and doppler shift.
+         */
+        IDirectSound3DListener_SetPosition(listener, 20.0f*cosf(a), 0.0f, 20.0f*sinf(a),
+                                           DS3D_DEFERRED);
+        IDirectSound3DListener_SetVelocity(listener, -2.0f*sinf(a), 0.0f, 2.0f*cosf(a),
+                                           DS3D_DEFERRED);
+        IDirectSound3DListener_CommitDeferredSettings(listener);
+        Sleep(UPDATE_MS);
+    }
+    cpu = get_cpu_us() - start;
+
+    printf("%.1f ms CPU over %d s (%.2f%% of one core)\n", cpu/1000.0, RUN_SECONDS,
+           cpu / (RUN_SECONDS*10000.0));
+
+    for(i = 0;i < NUM_VOICES;++i)
+        IDirectSoundBuffer_Release(voices[i]);
+    IDirectSound3DListener_Release(listener);
+    IDirectSoundBuffer_Release(primary);
+    IDirectSound8_Release(ds);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = { "default", "quality", "performance" };
+    char self[MAX_PATH], cmdline[MAX_PATH+16];
+    int policy;
+
+    if(argc > 1 && strcmp(argv[1], "--run") == 0)
+        return run_policy();
+
+    GetModuleFileNameA(NULL, self, sizeof(self));
+    snprintf(cmdline, sizeof(cmdline), "\"%s\" --run", self);
+    SetEnvironmentVariableA("ALSOFT_DRIVERS", "null");
+    for(policy = 0;policy < 3;++policy)
+    {
+        STARTUPINFOA si;
+        PROCESS_INFORMATION pi;
+        char value[4];
+
+        snprintf(value, sizeof(value), "%d", policy);
+        SetEnvironmentVariableA("DSOAL_RESAMPLER_POLICY", value);
+
+        printf("Policy %d (%s): ", policy, names[policy]);
+        fflush(stdout);
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+        if(!CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi))
+        {
+            printf("couldn't start (%lu)\n", GetLastError());
+            return 1;
+        }
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+    }
+    return 0;
+}
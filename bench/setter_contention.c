@@ -0,0 +1,225 @@
+/* Setter contention benchmark
+ *
+ * Game threads call buffer setters and GetCurrentPosition as fast as they can,
+ * each on its own buffer, while DSOAL's update thread feeds streaming buffers
+ * and checks their position notifications. Reports how long the calls took
+ * for increasing numbers of threads, to show stalls behind the update thread
+ * or each other. Runs on OpenAL's null output.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#define COBJMACROS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <windows.h>
+#include <dsound.h>
+
+#define MAX_THREADS 8
+#define NUM_STREAMS 8
+#define NUM_NOTIFIES 16
+#define RUN_MS 3000
+/* Call times are kept as a histogram of powers of two microseconds. */
+#define NUM_BUCKETS 24
+
+struct Worker {
+    IDirectSoundBuffer *dsb;
+    IDirectSound3DBuffer *dsb3d;
+    volatile LONG *stop;
+    DWORD64 calls;
+    DWORD64 stalls;
+    double max_us;
+    DWORD64 buckets[NUM_BUCKETS];
+};
+
+static LARGE_INTEGER Freq;
+
+static IDirectSoundBuffer *create_buffer(IDirectSound8 *ds, DWORD flags, DWORD bytes)
+{
+    IDirectSoundBuffer *dsb = NULL;
+    WAVEFORMATEX wfx;
+    DSBUFFERDESC desc;
+    void *data;
+    DWORD size;
+
+    memset(&wfx, 0, sizeof(wfx));
+    wfx.wFormatTag = WAVE_FORMAT_PCM;
+    wfx.nChannels = (flags&DSBCAPS_CTRL3D) ? 1 : 2;
+    wfx.nSamplesPerSec = 44100;
+    wfx.wBitsPerSample = 16;
+    wfx.nBlockAlign = wfx.nChannels * 2;
+    wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.dwSize = sizeof(desc);
+    desc.dwFlags = flags | DSBCAPS_GLOBALFOCUS;
+    desc.dwBufferBytes = bytes - bytes%wfx.nBlockAlign;
+    desc.lpwfxFormat = &wfx;
+    if(FAILED(IDirectSound8_CreateSoundBuffer(ds, &desc, &dsb, NULL)))
+        return NULL;
+
+    if(SUCCEEDED(IDirectSoundBuffer_Lock(dsb, 0, 0, &data, &size, NULL, NULL, DSBLOCK_ENTIREBUFFER)))
+    {
+        memset(data, 0, size);
+        IDirectSoundBuffer_Unlock(dsb, data, size, NULL, 0);
+    }
+    return dsb;
+}
+
+static DWORD WINAPI worker_thread(void *arg)
+{
+    struct Worker *w = arg;
+    LARGE_INTEGER t0, t1;
+    DWORD play, write;
+    DWORD n = 0;
+
+    while(!*w->stop)
+    {
+        double us;
+        int b = 0;
+
+        QueryPerformanceCounter(&t0);
+        switch(n++ & 3)
+        {
+        case 0: IDirectSoundBuffer_SetVolume(w->dsb, -(LONG)(n%1000)); break;
+        case 1: IDirectSound3DBuffer_SetPosition(w->dsb3d, (float)(n%100), 0.0f, 1.0f,
+                                                 DS3D_IMMEDIATE); break;
+        case 2: IDirectSoundBuffer_SetFrequency(w->dsb, 22050 + n%1000); break;
+        case 3: IDirectSoundBuffer_GetCurrentPosition(w->dsb, &play, &write); break;
+        }
+        QueryPerformanceCounter(&t1);
+
+        us = (double)(t1.QuadPart - t0.QuadPart) * 1000000.0 / (double)Freq.QuadPart;
+        while(b < NUM_BUCKETS-1 && us >= (double)(1u<<b))
+            ++b;
+        w->buckets[b]++;
+        w->calls++;
+        if(us >= 1000.0) w->stalls++;
+        if(us > w->max_us) w->max_us = us;
+    }
+    return 0;
+}
+
+/* Upper bound of the bucket holding the given fraction of all calls. */
+static double percentile(const DWORD64 *buckets, DWORD64 total, double frac)
+{
+    DWORD64 want = (DWORD64)(total * frac), seen = 0;
+    int b;
+
+    for(b = 0;b < NUM_BUCKETS;++b)
+    {
+        seen += buckets[b];
+        if(seen > want) break;
+    }
+    return (double)(1u << (b < NUM_BUCKETS ? b : NUM_BUCKETS-1));
+}
+
+static void run(IDirectSound8 *ds, int nthreads)
+{
+    struct Worker workers[MAX_THREADS];
+    HANDLE threads[MAX_THREADS];
+    DWORD64 buckets[NUM_BUCKETS] = { 0 };
+    DWORD64 calls = 0, stalls = 0;
+    volatile LONG stop = 0;
+    double max_us = 0.0;
+    int i, b;
+
+    for(i = 0;i < nthreads;++i)
+    {
+        struct Worker *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->stop = &stop;
+        w->dsb = create_buffer(ds, DSBCAPS_STATIC | DSBCAPS_CTRL3D | DSBCAPS_CTRLVOLUME |
+                                   DSBCAPS_CTRLFREQUENCY, 44100*2);
+        if(!w->dsb || FAILED(IDirectSoundBuffer_QueryInterface(w->dsb, &IID_IDirectSound3DBuffer,
+                                                               (void**)&w->dsb3d)))
+        {
+            fprintf(stderr, "Couldn't create a 3D buffer\n");
+            exit(1);
+        }
+        IDirectSoundBuffer_Play(w->dsb, 0, 0, DSBPLAY_LOOPING);
+    }
+
+    for(i = 0;i < nthreads;++i)
+        threads[i] = CreateThread(NULL, 0, worker_thread, &workers[i], 0, NULL);
+    Sleep(RUN_MS);
+    InterlockedExchange((LONG*)&stop, 1);
+    WaitForMultipleObjects(nthreads, threads, TRUE, INFINITE);
+
+    for(i = 0;i < nthreads;++i)
+    {
+        struct Worker *w = &workers[i];
+        CloseHandle(threads[i]);
+        for(b = 0;b < NUM_BUCKETS;++b)
+            buckets[b] += w->buckets[b];
+        calls += w->calls;
+        stalls += w->stalls;
+        if(w->max_us > max_us) max_us = w->max_us;
+        IDirectSound3DBuffer_Release(w->dsb3d);
+        IDirectSoundBuffer_Release(w->dsb);
+    }
+
+    printf("%d thread%s: %9.0f calls/s, median < %4.0f us, 99.9th < %6.0f us, max %8.1f us, "
+           "%lu over 1 ms\n", nthreads, (nthreads == 1) ? " " : "s",
+           calls * 1000.0 / RUN_MS, percentile(buckets, calls, 0.5),
+           percentile(buckets, calls, 0.999), max_us, (unsigned long)stalls);
+}
+
+int main(void)
+{
+    IDirectSoundBuffer *streams[NUM_STREAMS] = { NULL };
+    IDirectSound8 *ds = NULL;
+    int i, nthreads;
+
+    SetEnvironmentVariableA("ALSOFT_DRIVERS", "null");
+    QueryPerformanceFrequency(&Freq);
+
+    if(FAILED(DirectSoundCreate8(NULL, &ds, NULL)))
+    {
+        fprintf(stderr, "DirectSoundCreate8 failed\n");
+        return 1;
+    }
+    IDirectSound8_SetCooperativeLevel(ds, GetDesktopWindow(), DSSCL_PRIORITY);
+
+    /* Streaming buffers with notifications keep the update thread busy. */
+    for(i = 0;i < NUM_STREAMS;++i)
+    {
+        DSBPOSITIONNOTIFY notifies[NUM_NOTIFIES];
+        IDirectSoundNotify *notify;
+        DWORD bytes = 44100*4 / 2;
+        int j;
+
+        streams[i] = create_buffer(ds, DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_GETCURRENTPOSITION2,
+                                   bytes);
+        if(!streams[i])
+        {
+            fprintf(stderr, "Couldn't create a streaming buffer\n");
+            return 1;
+        }
+        if(SUCCEEDED(IDirectSoundBuffer_QueryInterface(streams[i], &IID_IDirectSoundNotify,
+                                                       (void**)&notify)))
+        {
+            for(j = 0;j < NUM_NOTIFIES;++j)
+            {
+                notifies[j].dwOffset = bytes / NUM_NOTIFIES * j;
+                notifies[j].hEventNotify = CreateEventA(NULL, FALSE, FALSE, NULL);
+            }
+            IDirectSoundNotify_SetNotificationPositions(notify, NUM_NOTIFIES, notifies);
+            IDirectSoundNotify_Release(notify);
+        }
+        IDirectSoundBuffer_Play(streams[i], 0, 0, DSBPLAY_LOOPING);
+    }
+
+    for(nthreads = 1;nthreads <= MAX_THREADS;nthreads *= 2)
+        run(ds, nthreads);
+
+    for(i = 0;i < NUM_STREAMS;++i)
+        IDirectSoundBuffer_Release(streams[i]);
+    IDirectSound8_Release(ds);
+    return 0;
+}
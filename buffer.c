@@ -22,6 +22,7 @@
 
 #define CONST_VTABLE
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "windows.h"
@@ -77,33 +78,6 @@ static inline DSBuffer *impl_from_IKsPropertySet(IKsPropertySet *iface)
 }
 
 
-/* Should be called with critsect held and context set.. */
-static void DSBuffer_addnotify(DSBuffer *buf)
-{
-    DSPrimary *prim = buf->primary;
-    DSBuffer **list;
-    DWORD i;
-
-    list = prim->notifies;
-    for(i = 0; i < prim->nnotifies; ++i)
-    {
-        if(buf == list[i])
-        {
-            ERR("Buffer %p already in notification list\n", buf);
-            return;
-        }
-    }
-    if(prim->nnotifies == prim->sizenotifies)
-    {
-        list = HeapReAlloc(GetProcessHeap(), 0, list, (prim->nnotifies + 1) * sizeof(*list));
-        if(!list) return;
-        prim->sizenotifies++;
-    }
-    list[prim->nnotifies++] = buf;
-    prim->notifies = list;
-}
-
-
 static const char *get_fmtstr_PCM(const DSPrimary *prim, const WAVEFORMATEX *format, WAVEFORMATEXTENSIBLE *out)
 {
     out->Format = *format;
@@ -275,6 +249,20 @@ static const char *get_fmtstr_EXT(const DSPrimary *prim, const WAVEFORMATEX *for
 }
 
 static void DSData_Release(DSData *This);
+static void DSBuffer_MarkDirty(DSBuffer *buf);
+static void DSBuffer_DropRiders(DSBuffer *buf);
+
+/* Amount of sample memory held for the data. Static data normally has a second
+ * copy in OpenAL, unless OpenAL uses our memory (map_buffer or static buffers).
+ */
+static DWORD DSData_ResidentSize(const DSData *data)
+{
+    if((data->dsbflags&DSBCAPS_STATIC) && !data->data_static &&
+       !HAS_EXTENSION(data->primary->share, SOFTX_MAP_BUFFER))
+        return data->buf_size * 2;
+    return data->buf_size + data->mirror_size;
+}
+
 static HRESULT DSData_Create(DSData **ppv, const DSBUFFERDESC *desc, DSPrimary *prim)
 {
     HRESULT hr = DSERR_INVALIDPARAM;
@@ -353,7 +341,12 @@ static HRESULT DSData_Create(DSData **ppv, const DSBUFFERDESC *desc, DSPrimary *
      * will need the EAX-RAM extension. Currently, we just tell the app it
      * gets what it wanted. */
     if(!HAS_EXTENSION(prim->share, SOFTX_MAP_BUFFER))
-        pBuffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*pBuffer)+buf_size);
+    {
+        DWORD mirror_size = (desc->dwFlags&DSBCAPS_STATIC) ? 0 : STREAM_MIRROR_SIZE;
+        pBuffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                            sizeof(*pBuffer)+buf_size+mirror_size);
+        if(pBuffer) pBuffer->mirror_size = mirror_size;
+    }
     else
         pBuffer = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*pBuffer));
     if(!pBuffer) return E_OUTOFMEMORY;
@@ -405,6 +398,24 @@ static HRESULT DSData_Create(DSData **ppv, const DSBUFFERDESC *desc, DSPrimary *
 
         alGenBuffers(1, &pBuffer->bid);
         checkALError();
+
+        if((pBuffer->dsbflags&DSBCAPS_STATIC))
+        {
+            /* Let OpenAL read our copy of the samples directly if it can,
+             * instead of making its own. Otherwise, static data needs a full
+             * upload before it can be updated.
+             */
+            if(HAS_EXTENSION(prim->share, EXT_STATIC_BUFFER) && alBufferDataStatic)
+            {
+                alGetError();
+                alBufferDataStatic(pBuffer->bid, pBuffer->buf_format, pBuffer->data,
+                                   pBuffer->buf_size, pBuffer->format.Format.nSamplesPerSec);
+                if(alGetError() == AL_NO_ERROR)
+                    pBuffer->data_static = TRUE;
+            }
+            if(!pBuffer->data_static)
+                pBuffer->dirty_end = pBuffer->buf_size;
+        }
     }
     else
     {
@@ -419,6 +430,13 @@ static HRESULT DSData_Create(DSData **ppv, const DSBUFFERDESC *desc, DSPrimary *
         if(!pBuffer->data) goto fail;
     }
 
+    /* Without an envelope, voices of it always keep their source. */
+    if((pBuffer->dsbflags&DSBCAPS_STATIC))
+        Envelope_Init(&pBuffer->envelope, pBuffer->buf_size, pBuffer->format.Format.nBlockAlign);
+
+    prim->share->resident_bytes += DSData_ResidentSize(pBuffer);
+    TRACE("Resident sample memory: %luKB\n", (DWORD)(prim->share->resident_bytes/1024));
+
     *ppv = pBuffer;
     return S_OK;
 
@@ -427,6 +445,81 @@ fail:
     return hr;
 }
 
+/* Gives the pending written range to OpenAL. Called with the device lock held
+ * and the context set.
+ */
+static void DSData_FlushDirty(DSData *data)
+{
+    DeviceShare *share = data->primary->share;
+    DWORD len = data->dirty_end - data->dirty_start;
+
+    if(data->dirty_end <= data->dirty_start)
+        return;
+
+    if(HAS_EXTENSION(share, SOFTX_MAP_BUFFER))
+        alFlushMappedBufferSOFT(data->bid, data->dirty_start, len);
+    else if(len < (DWORD)data->buf_size && HAS_EXTENSION(share, SOFT_BUFFER_SUB_DATA) &&
+            alBufferSubDataSOFT)
+        alBufferSubDataSOFT(data->bid, data->buf_format, data->data + data->dirty_start,
+                            data->dirty_start, len);
+    else
+    {
+        alBufferData(data->bid, data->buf_format, data->data, data->buf_size,
+                     data->format.Format.nSamplesPerSec);
+        len = data->buf_size;
+    }
+    checkALError();
+
+    share->uploaded_bytes += len;
+    data->dirty_start = data->dirty_end = 0;
+}
+
+/* Adds a written range to be given to OpenAL, merging it with the pending
+ * range if they touch. Otherwise, the pending range is flushed first.
+ */
+static void DSData_MarkDirty(DSData *data, DWORD ofs, DWORD len)
+{
+    DWORD align = data->format.Format.nBlockAlign;
+    DWORD end = ofs + len;
+
+    if(!len) return;
+    /* Sub-data updates need to be on whole sample frames. */
+    ofs -= ofs%align;
+    end = minI(end + (align - end%align)%align, data->buf_size);
+
+    if(data->dirty_end > data->dirty_start)
+    {
+        if(ofs <= data->dirty_end && end >= data->dirty_start)
+        {
+            if(ofs < data->dirty_start) data->dirty_start = ofs;
+            if(end > data->dirty_end) data->dirty_end = end;
+            return;
+        }
+        DSData_FlushDirty(data);
+    }
+    data->dirty_start = ofs;
+    data->dirty_end = end;
+}
+
+/* Refreshes the mirrored start of the data after the given range changed. */
+static void DSData_UpdateMirror(DSData *data, DWORD ofs, DWORD len)
+{
+    DWORD mirror_len = minI(data->mirror_size, data->buf_size);
+    if(ofs >= mirror_len)
+        return;
+    len = minI(len, mirror_len - ofs);
+    memcpy(data->data + data->buf_size + ofs, data->data + ofs, len);
+}
+
+/* Recomputes the envelope blocks overlapping the given range. */
+static void DSData_UpdateEnvelope(DSData *data, DWORD ofs, DWORD len)
+{
+    if(!data->envelope.peaks || !len)
+        return;
+    Envelope_Update(&data->envelope, data->data, data->format.Format.wBitsPerSample, ofs, len);
+    TRACE("Envelope of %p updated for %lu bytes at %lu\n", data, len, ofs);
+}
+
 static void DSData_AddRef(DSData *data)
 {
     InterlockedIncrement(&data->ref);
@@ -441,15 +534,148 @@ static void DSData_Release(DSData *This)
     if(This->bid)
     {
         DSPrimary *prim = This->primary;
+        ALenum err;
+
         if(HAS_EXTENSION(prim->share, SOFTX_MAP_BUFFER))
             alUnmapBufferSOFT(This->bid);
+        alGetError();
         alDeleteBuffers(1, &This->bid);
-        checkALError();
+        if((err=alGetError()) != AL_NO_ERROR)
+        {
+            ERR("Failed to delete buffer %u (0x%x)\n", This->bid, err);
+            /* OpenAL may still read from static data, so it can't be freed. */
+            if(This->data_static)
+            {
+                ERR("Leaking static buffer data %p\n", This);
+                return;
+            }
+        }
     }
+    if(This->data)
+        This->primary->share->resident_bytes -= DSData_ResidentSize(This);
+    Envelope_Clear(&This->envelope);
     HeapFree(GetProcessHeap(), 0, This);
 }
 
 
+/* Recalculates how much to queue on a streaming buffer, from the rate it's
+ * actually played at, the timer jitter, and past underruns. The segment size is
+ * only changed when resize is set, as the queue must be empty for that.
+ */
+void DSBuffer_UpdateStream(DSBuffer *buf, BOOL resize)
+{
+    const WAVEFORMATEX *format = &buf->buffer->format.Format;
+    DeviceShare *share = buf->share;
+    DWORD rate, latency;
+    ULONGLONG bytes;
+
+    rate = (buf->current.frequency ? buf->current.frequency : format->nSamplesPerSec) *
+           format->nBlockAlign;
+    if(resize || buf->segsize == 0)
+    {
+        /* Segments are limited to the size of the feeder's scratch memory. */
+        buf->segsize = (rate+buf->primary->refresh-1) / buf->primary->refresh;
+        buf->segsize = clampI(buf->segsize, format->nBlockAlign, 2048);
+        buf->segsize += format->nBlockAlign - 1;
+        buf->segsize -= buf->segsize%format->nBlockAlign;
+    }
+
+    /* Cover two late timer ticks, plus a tick for each recent underrun. */
+    latency = (share->tick_period+share->tick_jitter)*2 +
+              share->tick_period*minI(buf->underruns, 4);
+    latency = clampU(latency, StreamMinLatency, StreamMaxLatency);
+
+    bytes = (ULONGLONG)rate * latency / 1000;
+    buf->queue_size = clampI((LONG)((bytes+buf->segsize-1) / buf->segsize), 2, QBUFFERS);
+}
+
+/* Called from the OpenAL mixer to pull more samples for a streaming buffer.
+ * Samples are read directly from the buffer's storage at the current read
+ * offset, wrapping for looping buffers. Returning less than requested ends the
+ * stream, which stops the source once the remaining samples are played.
+ */
+static ALsizei AL_APIENTRY DSBuffer_streamcallback(ALvoid *userptr, ALvoid *sampledata, ALsizei numbytes)
+{
+    DSBuffer *buf = userptr;
+    DSData *data = buf->buffer;
+    BYTE *dst = sampledata;
+    LONG start = buf->cb_offset;
+    LONG ofs = start;
+    ALsizei total = 0;
+
+    while(total < numbytes)
+    {
+        ALsizei todo;
+
+        if(ofs >= data->buf_size)
+        {
+            if(!buf->islooping) break;
+            ofs = 0;
+        }
+
+        todo = minI(numbytes - total, data->buf_size - ofs);
+        memcpy(dst + total, data->data + ofs, todo);
+        total += todo;
+        ofs += todo;
+    }
+    if(buf->islooping && ofs >= data->buf_size)
+        ofs = 0;
+
+    /* If the offset was changed while we were reading, the new position wins. */
+    InterlockedCompareExchange(&buf->cb_offset, ofs, start);
+    return total;
+}
+
+/* Gets how far a callback-streamed buffer has played. The callback reads ahead
+ * of the mixer, so this comes from the source's offset into the stream rather
+ * than the read offset. Once the stream is stopped or taken off the source,
+ * it's where the stream carries on from. Called with the buffer lock held and
+ * the context set.
+ */
+DWORD DSBuffer_CallbackPos(const DSBuffer *buf)
+{
+    const DSData *data = buf->buffer;
+    ALint state = AL_INITIAL, frames = 0;
+    LONGLONG pos;
+
+    if(buf->source)
+    {
+        alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
+        alGetSourcei(buf->source, AL_SAMPLE_OFFSET, &frames);
+        checkALError();
+    }
+    if(state == AL_PLAYING || state == AL_PAUSED)
+        pos = buf->cb_base + (LONGLONG)frames*data->format.Format.nBlockAlign;
+    else
+        pos = buf->cb_offset;
+
+    if(pos >= data->buf_size)
+        pos = buf->islooping ? pos%data->buf_size : data->buf_size;
+    else if(pos < 0)
+        pos = 0;
+    return (DWORD)pos;
+}
+
+/* Updates the play state of a callback-streamed buffer, which is only known to
+ * have stopped once its source has. Called with the device lock held and the
+ * context set.
+ */
+static void DSBuffer_checkcallback(DSBuffer *buf)
+{
+    ALint state = AL_PLAYING;
+
+    if(!buf->isplaying || !buf->source)
+        return;
+    alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
+    checkALError();
+    if(state == AL_STOPPED)
+    {
+        alSourcei(buf->source, AL_BUFFER, 0);
+        buf->isplaying = FALSE;
+    }
+}
+
+
 HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *orig)
 {
     DSBuffer *This = NULL;
@@ -465,6 +691,8 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *ori
             This = prim->BufferGroups[i].Buffers + idx;
             memset(This, 0, sizeof(*This));
             prim->BufferGroups[i].FreeBuffers &= ~(U64(1) << idx);
+            This->group_idx = i;
+            This->group_bit = U64(1) << idx;
             break;
         }
     }
@@ -479,6 +707,22 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *ori
             grp[i].FreeBuffers = ~U64(0);
             grp[i].Buffers = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
                                        64*sizeof(grp[0].Buffers[0]));
+            if(grp[i].Buffers)
+            {
+                DSBuffer **list;
+                if(prim->dirtybufs)
+                    list = HeapReAlloc(GetProcessHeap(), 0, prim->dirtybufs,
+                                       (i+1)*64*sizeof(*list));
+                else
+                    list = HeapAlloc(GetProcessHeap(), 0, (i+1)*64*sizeof(*list));
+                if(!list)
+                {
+                    HeapFree(GetProcessHeap(), 0, grp[i].Buffers);
+                    grp[i].Buffers = NULL;
+                }
+                else
+                    prim->dirtybufs = list;
+            }
             if(!grp[i].Buffers)
             {
                 HeapFree(GetProcessHeap(), 0, grp);
@@ -493,6 +737,8 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *ori
                 This = prim->BufferGroups[i].Buffers + 0;
                 memset(This, 0, sizeof(*This));
                 prim->BufferGroups[i].FreeBuffers &= ~(U64(1) << 0);
+                This->group_idx = i;
+                This->group_bit = U64(1) << 0;
             }
         }
     }
@@ -511,6 +757,7 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *ori
     This->share = prim->share;
     This->primary = prim;
     This->ctx = prim->ctx;
+    InitializeCriticalSection(&This->crst);
 
     This->current.vol = 0;
     This->current.pan = 0;
@@ -555,52 +802,119 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *prim, IDirectSoundBuffer *ori
     }
 
     This->deferred.ds3d = This->current.ds3d;
+    if(orig)
+    {
+        DSBuffer *org = impl_from_IDirectSoundBuffer(orig);
+
+        /* Carry over any 3D changes still waiting on a commit, so the
+         * duplicate picks them up along with the original.
+         */
+        EnterCriticalSection(&prim->share->crst);
+        if((This->buffer->dsbflags&DSBCAPS_CTRL3D) && org->dirty.flags)
+        {
+            This->deferred.ds3d = org->deferred.ds3d;
+            This->dirty.flags = org->dirty.flags;
+            DSBuffer_MarkDirty(This);
+        }
+        LeaveCriticalSection(&prim->share->crst);
+    }
 
     This->vm_voicepriority = (DWORD)-1;
+    This->vm_voicestate = DSPROPERTY_VMANAGER_STATE_SILENT;
     
     *ppv = This;
     return DS_OK;
 }
 
+/* Gets the parameters the buffer's source has from what was last sent. */
+static void DSBuffer_GetSourceParams(const DSBuffer *buf, struct SourceParams *params)
+{
+    const DSPrimary *prim = buf->primary;
+    const DSData *data = buf->buffer;
+
+    params->valid = TRUE;
+    params->is3d = (data->dsbflags&DSBCAPS_CTRL3D) != 0;
+    params->vol = buf->sent.vol;
+    params->pitch = buf->sent.frequency ?
+        (float)buf->sent.frequency/data->format.Format.nSamplesPerSec : 1.0f;
+    params->pan = buf->sent.pan;
+    params->ds3d = buf->current.ds3d;
+    params->ds3d.vPosition = buf->sent.pos;
+    params->ds3d.vVelocity = buf->sent.vel;
+    if(params->is3d)
+    {
+        params->rolloff = (buf->rolloff_epoch == prim->rolloff_epoch) ?
+            prim->current.ds3d.flRolloffFactor : -1.0f;
+        params->doppler = buf->src_doppler;
+    }
+    else
+    {
+        params->rolloff = 0.0f;
+        params->doppler = 0.0f;
+    }
+    params->eax_default = buf->src_eax_default;
+    params->resampler = buf->src_resampler;
+    params->data = data;
+}
+
+/* Returns the buffer's source to the pool. Should be called with the device
+ * lock held, after detaching the source's buffer.
+ */
+static void DSBuffer_ReturnSource(DSBuffer *buf)
+{
+    SourceCollection *sources = &buf->share->sources;
+    DWORD idx;
+
+    DSPrimary_cancelplay(buf->primary, buf);
+    if(buf->loc_status == DSBSTATUS_LOCHARDWARE)
+        idx = sources->availhw_num++;
+    else
+        idx = sources->maxhw_alloc + sources->availsw_num++;
+    sources->ids[idx] = buf->source;
+    DSBuffer_GetSourceParams(buf, &sources->params[idx]);
+    /* What was sent to it since it was taken isn't tracked. */
+    if(buf->src_unsent)
+        sources->params[idx].valid = FALSE;
+    buf->src_unsent = FALSE;
+    buf->source = 0;
+    buf->buffer->nsources--;
+}
+
 void DSBuffer_Destroy(DSBuffer *This)
 {
     DSPrimary *prim = This->primary;
-    DWORD i;
+    struct DSBufferGroup *group;
 
     if(!prim) return;
     TRACE("Destroying %p\n", This);
 
     EnterCriticalSection(&prim->share->crst);
-    /* Remove from list, if in list */
-    for(i = 0;i < prim->nnotifies;++i)
+    EnterCriticalSection(&This->crst);
+    /* Remove from lists, if in lists */
+    DSPrimary_removenotify(prim, This);
+    if(This->dirty_idx)
     {
-        if(This == prim->notifies[i])
-        {
-            prim->notifies[i] = prim->notifies[--prim->nnotifies];
-            break;
-        }
+        DSBuffer *last = prim->dirtybufs[--prim->ndirtybufs];
+        prim->dirtybufs[This->dirty_idx-1] = last;
+        last->dirty_idx = This->dirty_idx;
+        This->dirty_idx = 0;
     }
+    DSPrimary_dropeax(prim, This);
+    DSPrimary_removevirtual(prim, This);
+    DSBuffer_DropRiders(This);
+    EAXMirror_Clear(&This->eax);
 
     setALContext(This->ctx);
     if(This->source)
     {
-        DeviceShare *share = This->share;
-
         alSourceRewind(This->source);
         alSourcei(This->source, AL_BUFFER, 0);
         checkALError();
 
-        if(This->loc_status == DSBSTATUS_LOCHARDWARE)
-            share->sources.ids[share->sources.availhw_num++] = This->source;
-        else
-        {
-            DWORD base = share->sources.maxhw_alloc;
-            share->sources.ids[base + share->sources.availsw_num++] = This->source;
-        }
-        This->source = 0;
+        DSBuffer_ReturnSource(This);
     }
     if(This->stream_bids[0])
-        alDeleteBuffers(QBUFFERS, This->stream_bids);
+        alDeleteBuffers(This->iscallback ? 1 : QBUFFERS, This->stream_bids);
 
     if(This->buffer)
         DSData_Release(This->buffer);
@@ -609,201 +923,1039 @@ void DSBuffer_Destroy(DSBuffer *This)
 
     HeapFree(GetProcessHeap(), 0, This->notify);
 
+    group = DSBuffer_Group(This);
+    group->PlayingBuffers &= ~This->group_bit;
+    group->StreamBuffers &= ~This->group_bit;
+    group->SourceBuffers &= ~This->group_bit;
+    group->HwBuffers &= ~This->group_bit;
+    group->FreeBuffers |= This->group_bit;
+    LeaveCriticalSection(&This->crst);
+    DeleteCriticalSection(&This->crst);
+    LeaveCriticalSection(&prim->share->crst);
+}
+
+HRESULT DSBuffer_GetInterface(DSBuffer *buf, REFIID riid, void **ppv)
+{
+    *ppv = NULL;
+    if(IsEqualIID(riid, &IID_IDirectSoundBuffer))
+        *ppv = &buf->IDirectSoundBuffer8_iface;
+    else if(IsEqualIID(riid, &IID_IDirectSoundBuffer8))
+    {
+        if(buf->primary->parent->is_8)
+            *ppv = &buf->IDirectSoundBuffer8_iface;
+    }
+    else if(IsEqualIID(riid, &IID_IDirectSound3DBuffer))
+    {
+        if((buf->buffer->dsbflags&DSBCAPS_CTRL3D))
+            *ppv = &buf->IDirectSound3DBuffer_iface;
+    }
+    else if(IsEqualIID(riid, &IID_IDirectSoundNotify))
+    {
+        if((buf->buffer->dsbflags&DSBCAPS_CTRLPOSITIONNOTIFY))
+            *ppv = &buf->IDirectSoundNotify_iface;
+    }
+    else if(IsEqualIID(riid, &IID_IKsPropertySet))
+        *ppv = &buf->IKsPropertySet_iface;
+    else if(IsEqualIID(riid, &IID_IUnknown))
+        *ppv = &buf->IDirectSoundBuffer8_iface;
+    else
+        FIXME("Unhandled GUID: %s\n", debugstr_guid(riid));
+
+    if(*ppv)
+    {
+        IUnknown_AddRef((IUnknown*)*ppv);
+        return S_OK;
+    }
+
+    return E_NOINTERFACE;
+}
+
+/* Number of the most recently returned sources checked for a close match. */
+#define SOURCE_MATCH_DEPTH 16
+
+/* Takes a pooled source for the buffer, preferring one last used for the same
+ * data, or else with the same 2D/3D mode, so fewer parameters need to be sent.
+ */
+static ALuint DSBuffer_TakeSource(DSBuffer *buf, DWORD loc_status, struct SourceParams *params)
+{
+    SourceCollection *sources = &buf->share->sources;
+    BOOL is3d = (buf->buffer->dsbflags&DSBCAPS_CTRL3D) != 0;
+    DWORD *avail, top, best, i;
+    int best_score = -1;
+
+    if(loc_status == DSBSTATUS_LOCHARDWARE)
+    {
+        avail = &sources->availhw_num;
+        top = *avail - 1;
+    }
+    else
+    {
+        avail = &sources->availsw_num;
+        top = sources->maxhw_alloc + *avail - 1;
+    }
+
+    best = top;
+    for(i = 0;i < *avail && i < SOURCE_MATCH_DEPTH;++i)
+    {
+        const struct SourceParams *cand = &sources->params[top-i];
+        int score = 0;
+
+        if(cand->valid && cand->is3d == is3d)
+            score = (cand->data == buf->buffer) ? 2 : 1;
+        if(score > best_score)
+        {
+            best = top-i;
+            best_score = score;
+            if(score == 2) break;
+        }
+    }
+    if(best != top)
+    {
+        ALuint id = sources->ids[best];
+        struct SourceParams tmp = sources->params[best];
+        sources->ids[best] = sources->ids[top];
+        sources->params[best] = sources->params[top];
+        sources->ids[top] = id;
+        sources->params[top] = tmp;
+    }
+
+    --*avail;
+    *params = sources->params[top];
+    return sources->ids[top];
+}
+
+static inline BOOL vector_equal(const D3DVECTOR *a, const D3DVECTOR *b)
+{
+    return a->x == b->x && a->y == b->y && a->z == b->z;
+}
+
+/* Takes a source for the buffer in the given location (or either, if 0),
+ * giving back the one it has if that's elsewhere. Returns S_FALSE if the one
+ * it has suits, else gets the parameters the new source was last given.
+ * Should be called with the device and buffer locks held.
+ */
+static HRESULT DSBuffer_TakeLoc(DSBuffer *buf, DWORD loc_status, struct SourceParams *have)
+{
+    DeviceShare *share = buf->share;
+    DSData *data = buf->buffer;
+
+    if((loc_status && buf->loc_status == loc_status) || (!loc_status && buf->loc_status))
+        return S_FALSE;
+
+    /* If we have a source, we're changing location, so return the source we
+     * have to get a new one.
+     */
+    if(buf->source)
+    {
+        alSourceRewind(buf->source);
+        alSourcei(buf->source, AL_BUFFER, 0);
+        checkALError();
+
+        DSBuffer_Group(buf)->SourceBuffers &= ~buf->group_bit;
+        DSBuffer_Group(buf)->HwBuffers &= ~buf->group_bit;
+        DSBuffer_ReturnSource(buf);
+    }
+    buf->loc_status = 0;
+
+    if(!loc_status)
+    {
+        if(share->sources.availhw_num)
+            loc_status = DSBSTATUS_LOCHARDWARE;
+        else if(share->sources.availsw_num)
+            loc_status = DSBSTATUS_LOCSOFTWARE;
+    }
+
+    if((loc_status == DSBSTATUS_LOCHARDWARE && !share->sources.availhw_num) ||
+       (loc_status == DSBSTATUS_LOCSOFTWARE && !share->sources.availsw_num) ||
+       !loc_status)
+    {
+        ERR("Out of %s sources\n",
+            (loc_status == DSBSTATUS_LOCHARDWARE) ? "hardware" :
+            (loc_status == DSBSTATUS_LOCSOFTWARE) ? "software" : "any"
+        );
+        return DSERR_ALLOCATED;
+    }
+
+    buf->source = DSBuffer_TakeSource(buf, loc_status, have);
+    data->nsources++;
+    if(loc_status == DSBSTATUS_LOCHARDWARE)
+        DSBuffer_Group(buf)->HwBuffers |= buf->group_bit;
+    DSBuffer_Group(buf)->SourceBuffers |= buf->group_bit;
+    buf->loc_status = loc_status;
+    buf->isdeferredswbuffer = FALSE;
+    /* 3D buffers leave the doppler factor as it was. */
+    buf->src_doppler = have->valid ? have->doppler : -1.0f;
+    buf->src_resampler = have->valid ? have->resampler : -1;
+    return DS_OK;
+}
+
+/* Sends the buffer's parameters to its source, skipping those it already has
+ * from what it was last given. Should be called with the buffer lock held and
+ * the context set.
+ */
+static void DSBuffer_SendSource(DSBuffer *buf, const struct SourceParams *have)
+{
+    DeviceShare *share = buf->share;
+    struct SourceParams want;
+    BOOL all, send;
+
+    buf->sent.vol = buf->current.vol;
+    buf->sent.pan = buf->current.pan;
+    buf->sent.frequency = buf->current.frequency;
+    buf->sent.pos = buf->current.ds3d.vPosition;
+    buf->sent.vel = buf->current.ds3d.vVelocity;
+    buf->rolloff_epoch = buf->primary->rolloff_epoch;
+    buf->src_eax_default = TRUE;
+    DSBuffer_GetSourceParams(buf, &want);
+
+    /* Only send what differs from the source's last parameters. */
+    all = !have->valid || have->is3d != want.is3d;
+    send = all || have->vol != want.vol;
+    if(DSShare_CountUpdate(share, send))
+        alSourcef(buf->source, AL_GAIN, mB_to_gain((float)want.vol));
+    send = all || have->pitch != want.pitch;
+    if(DSShare_CountUpdate(share, send))
+        alSourcef(buf->source, AL_PITCH, want.pitch);
+    checkALError();
+
+    /* TODO: Don't set EAX parameters or connect to effect slots for software
+     * buffers. Need to check if EAX buffer properties are still tracked, or if
+     * they're lost/reset when leaving hardware.
+     *
+     * Alternatively, we can just allow it and say software processing supports
+     * EAX too. Depends if apps may get upset over that.
+     */
+
+    if(want.is3d)
+    {
+        const ALuint source = buf->source;
+        const DS3DBUFFER *params = &want.ds3d;
+
+        send = all || !vector_equal(&have->ds3d.vPosition, &params->vPosition);
+        if(DSShare_CountUpdate(share, send))
+            alSource3f(source, AL_POSITION, params->vPosition.x, params->vPosition.y,
+                                           -params->vPosition.z);
+        send = all || !vector_equal(&have->ds3d.vVelocity, &params->vVelocity);
+        if(DSShare_CountUpdate(share, send))
+            alSource3f(source, AL_VELOCITY, params->vVelocity.x, params->vVelocity.y,
+                                           -params->vVelocity.z);
+        send = all || have->ds3d.dwInsideConeAngle != params->dwInsideConeAngle;
+        if(DSShare_CountUpdate(share, send))
+            alSourcei(source, AL_CONE_INNER_ANGLE, params->dwInsideConeAngle);
+        send = all || have->ds3d.dwOutsideConeAngle != params->dwOutsideConeAngle;
+        if(DSShare_CountUpdate(share, send))
+            alSourcei(source, AL_CONE_OUTER_ANGLE, params->dwOutsideConeAngle);
+        send = all || !vector_equal(&have->ds3d.vConeOrientation, &params->vConeOrientation);
+        if(DSShare_CountUpdate(share, send))
+            alSource3f(source, AL_DIRECTION, params->vConeOrientation.x,
+                                             params->vConeOrientation.y,
+                                            -params->vConeOrientation.z);
+        send = all || have->ds3d.lConeOutsideVolume != params->lConeOutsideVolume;
+        if(DSShare_CountUpdate(share, send))
+            alSourcef(source, AL_CONE_OUTER_GAIN,
+                      mB_to_gain((float)params->lConeOutsideVolume));
+        send = all || have->ds3d.flMinDistance != params->flMinDistance;
+        if(DSShare_CountUpdate(share, send))
+            alSourcef(source, AL_REFERENCE_DISTANCE, params->flMinDistance);
+        send = all || have->ds3d.flMaxDistance != params->flMaxDistance;
+        if(DSShare_CountUpdate(share, send))
+            alSourcef(source, AL_MAX_DISTANCE, params->flMaxDistance);
+        send = all || have->ds3d.dwMode != params->dwMode;
+        if(DSShare_CountUpdate(share, send))
+        {
+            if(HAS_EXTENSION(share, SOFT_SOURCE_SPATIALIZE))
+                alSourcei(source, AL_SOURCE_SPATIALIZE_SOFT,
+                    (params->dwMode==DS3DMODE_DISABLE) ? AL_FALSE : AL_TRUE
+                );
+            alSourcei(source, AL_SOURCE_RELATIVE,
+                (params->dwMode!=DS3DMODE_NORMAL) ? AL_TRUE : AL_FALSE
+            );
+        }
+        send = all || have->rolloff != want.rolloff;
+        if(DSShare_CountUpdate(share, send))
+            alSourcef(source, AL_ROLLOFF_FACTOR, want.rolloff);
+
+        if(HAS_EXTENSION(share, EXT_EAX))
+        {
+            send = all || !have->eax_default;
+            if(DSShare_CountUpdate(share, send))
+            {
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLPARAMETERS, source,
+                    &share->default_srcprops, sizeof(share->default_srcprops));
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLSENDPARAMETERS, source,
+                    &share->default_srcsend, sizeof(share->default_srcsend));
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ACTIVEFXSLOTID, source,
+                    &share->default_srcslots, sizeof(share->default_srcslots));
+            }
+            EAXMirror_Apply(&buf->eax, source);
+            buf->src_eax_default = (buf->eax.count == 0);
+        }
+        checkALError();
+    }
+    else
+    {
+        const ALuint source = buf->source;
+
+        send = all || have->pan != want.pan;
+        if(DSShare_CountUpdate(share, send))
+        {
+            const ALfloat x = (ALfloat)(want.pan-DSBPAN_LEFT)/(DSBPAN_RIGHT-DSBPAN_LEFT) -
+                              0.5f;
+            alSource3f(source, AL_POSITION, x, 0.0f, -sqrtf(1.0f - x*x));
+        }
+        /* The rest is the same for all 2D buffers. */
+        if(DSShare_CountUpdate(share, all))
+        {
+            alSource3f(source, AL_VELOCITY, 0.0f, 0.0f, 0.0f);
+            alSource3f(source, AL_DIRECTION, 0.0f, 0.0f, 0.0f);
+            alSourcef(source, AL_CONE_OUTER_GAIN, 1.0f);
+            alSourcef(source, AL_REFERENCE_DISTANCE, 1.0f);
+            alSourcef(source, AL_MAX_DISTANCE, 1000.0f);
+            alSourcef(source, AL_ROLLOFF_FACTOR, 0.0f);
+            alSourcef(source, AL_DOPPLER_FACTOR, 0.0f);
+            alSourcei(source, AL_CONE_INNER_ANGLE, 360);
+            alSourcei(source, AL_CONE_OUTER_ANGLE, 360);
+            alSourcei(source, AL_SOURCE_RELATIVE, AL_TRUE);
+            if(HAS_EXTENSION(share, SOFT_SOURCE_SPATIALIZE))
+            {
+                /* Set to auto so panning works for mono, and multi-channel
+                 * works as expected.
+                 */
+                alSourcei(source, AL_SOURCE_SPATIALIZE_SOFT, AL_AUTO_SOFT);
+            }
+        }
+        if(HAS_EXTENSION(share, EXT_EAX))
+        {
+            send = all || !have->eax_default;
+            if(DSShare_CountUpdate(share, send))
+            {
+                static const GUID NullSlots[EAX_MAX_ACTIVE_FXSLOTS] = { { 0 } };
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLPARAMETERS, source,
+                    &share->default_srcprops, sizeof(share->default_srcprops));
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLSENDPARAMETERS, source,
+                    &share->default_srcsend, sizeof(share->default_srcsend));
+                EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ACTIVEFXSLOTID, source,
+                    (void*)NullSlots, sizeof(NullSlots));
+            }
+        }
+        checkALError();
+    }
+
+    buf->src_unsent = FALSE;
+    /* The source may have been left with another voice's resampler. */
+    DSBuffer_UpdateResampler(buf);
+}
+
+/* Should be called with the device and buffer locks held. */
+static HRESULT DSBuffer_SetLoc(DSBuffer *buf, DWORD loc_status)
+{
+    struct SourceParams have;
+    HRESULT hr;
+
+    hr = DSBuffer_TakeLoc(buf, loc_status, &have);
+    if(hr == S_FALSE)
+    {
+        /* A duplicate's source may still be waiting for its parameters. */
+        if(buf->src_unsent)
+            DSBuffer_SendSource(buf, &buf->src_have);
+        return DS_OK;
+    }
+    if(SUCCEEDED(hr))
+        DSBuffer_SendSource(buf, &have);
+    return hr;
+}
+
+
+/* Estimates the buffer's gain at the listener from its volume and, for 3D
+ * buffers, the inverse distance clamped rolloff and sound cone OpenAL will
+ * apply.
+ */
+float DSBuffer_EstimateGain(const DSBuffer *buf)
+{
+    const DS3DBUFFER *params = &buf->current.ds3d;
+    const DS3DLISTENER *listener = &buf->primary->current.ds3d;
+    float gain = mB_to_gain((float)buf->current.vol);
+    float dist, clamped;
+    D3DVECTOR dir;
+
+    if(!(buf->buffer->dsbflags&DSBCAPS_CTRL3D) || params->dwMode == DS3DMODE_DISABLE)
+        return gain;
+
+    dir = params->vPosition;
+    if(params->dwMode == DS3DMODE_NORMAL)
+    {
+        dir.x -= listener->vPosition.x;
+        dir.y -= listener->vPosition.y;
+        dir.z -= listener->vPosition.z;
+    }
+    dist = sqrtf(dir.x*dir.x + dir.y*dir.y + dir.z*dir.z);
+
+    clamped = (dist < params->flMaxDistance) ? dist : params->flMaxDistance;
+    if(clamped > params->flMinDistance && params->flMinDistance > 0.0f)
+        gain *= params->flMinDistance / (params->flMinDistance +
+            listener->flRolloffFactor*(clamped - params->flMinDistance));
+
+    if(params->dwOutsideConeAngle < 360 && dist > 0.0f)
+    {
+        const D3DVECTOR *ori = &params->vConeOrientation;
+        float len = sqrtf(ori->x*ori->x + ori->y*ori->y + ori->z*ori->z);
+        if(len > 0.0f)
+        {
+            /* The full cone angle the listener is at, from the source. */
+            float c = -(dir.x*ori->x + dir.y*ori->y + dir.z*ori->z) / (dist*len);
+            float angle = acosf(maxF(-1.0f, minF(c, 1.0f))) * (360.0f/3.14159265f);
+            float outer = mB_to_gain((float)params->lConeOutsideVolume);
+
+            if(angle >= (float)params->dwOutsideConeAngle)
+                gain *= outer;
+            else if(angle > (float)params->dwInsideConeAngle)
+                gain *= 1.0f + (outer-1.0f) * (angle - params->dwInsideConeAngle) /
+                    (float)(params->dwOutsideConeAngle - params->dwInsideConeAngle);
+        }
+    }
+    return gain;
+}
+
+/* How much louder than the cull threshold a culled voice needs to get to be
+ * given a source again, in millibels, so voices near the threshold don't
+ * keep trading their source back and forth.
+ */
+#define CULL_HYSTERESIS 600
+
+/* Checks if the buffer is loud enough to need a source. Only 3D buffers are
+ * culled, and a voice culled before needs to get louder to come back.
+ */
+BOOL DSBuffer_IsAudible(const DSBuffer *buf)
+{
+    LONG threshold = CullThreshold;
+
+    if(!threshold || !(buf->buffer->dsbflags&DSBCAPS_CTRL3D) ||
+       buf->current.ds3d.dwMode == DS3DMODE_DISABLE)
+        return TRUE;
+    if(buf->isculled)
+        threshold += CULL_HYSTERESIS;
+    return DSBuffer_EstimateGain(buf) >= mB_to_gain((float)threshold);
+}
+
+/* Gets a virtual voice's play position at the given time. Returns FALSE, with
+ * the position at the end, once a non-looping voice has played through.
+ */
+BOOL DSBuffer_GetVirtualPos(const DSBuffer *buf, DWORD64 now, DWORD *pos)
+{
+    const DSData *data = buf->buffer;
+    DWORD64 frames = 0, ofs;
+
+    if(now > buf->virt_start)
+        frames = (now - buf->virt_start) * buf->current.frequency / 1000000;
+    ofs = buf->virt_base + frames*data->format.Format.nBlockAlign;
+    if(ofs < (DWORD64)data->buf_size)
+        *pos = (DWORD)ofs;
+    else if(buf->isvirtlooping)
+        *pos = (DWORD)(ofs % data->buf_size);
+    else
+    {
+        *pos = data->buf_size;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* The peak level a block needs to be heard at the voice's current gain. */
+static float DSBuffer_EnvelopeLimit(const DSBuffer *buf)
+{
+    return Envelope_Limit(CullThreshold, DSBuffer_EstimateGain(buf));
+}
+
+/* Checks if a one-shot voice is too quiet to hear at its current gain, from
+ * the given position until the envelope lookahead.
+ */
+BOOL DSBuffer_IsSilent(const DSBuffer *buf, DWORD pos)
+{
+    const DSData *data = buf->buffer;
+    DWORD len;
+
+    if(!CullThreshold || !data->envelope.peaks)
+        return FALSE;
+
+    len = buf->current.frequency * ENVELOPE_LOOKAHEAD / buf->primary->refresh *
+          data->format.Format.nBlockAlign;
+    return Envelope_IsQuiet(&data->envelope, pos, len, DSBuffer_EnvelopeLimit(buf));
+}
+
+/* Gets the peak level of the voice's data around the given position, scaled
+ * to 16-bit before the voice's gain, for diagnostics. 32767 if it isn't
+ * tracked.
+ */
+WORD DSBuffer_GetEnvelope(const DSBuffer *buf, DWORD pos)
+{
+    return Envelope_Peak(&buf->buffer->envelope, pos);
+}
+
+/* Finds when a one-shot voice playing at the given position reaches the
+ * first quiet block from the given offset, for the update to check it then.
+ */
+static void DSBuffer_ScheduleEnvelope(DSBuffer *buf, DWORD pos, DWORD from, DWORD64 now)
+{
+    const DSData *data = buf->buffer;
+    DWORD start;
+
+    buf->env_deadline = 0;
+    if(!CullThreshold || !data->envelope.peaks)
+        return;
+
+    start = Envelope_NextQuiet(&data->envelope, from, DSBuffer_EnvelopeLimit(buf));
+    if(start < data->buf_size)
+    {
+        DWORD64 frames = (start > pos) ? (start-pos) / data->format.Format.nBlockAlign : 0;
+        buf->env_deadline = now + frames*1000000 / buf->current.frequency;
+    }
+}
+
+/* Gets a static buffer's play position and state from its source. */
+static DWORD DSBuffer_SourcePos(const DSBuffer *buf, ALint *state)
+{
+    ALint ofs = 0;
+
+    *state = AL_INITIAL;
+    alGetSourcei(buf->source, AL_BYTE_OFFSET, &ofs);
+    alGetSourcei(buf->source, AL_SOURCE_STATE, state);
+    if(buf->play_idx)
+    {
+        /* Starts with the next batch, from where alSourcePlay will. */
+        if(*state == AL_INITIAL) ofs = buf->lastpos % buf->buffer->buf_size;
+        else if(*state == AL_STOPPED) ofs = 0;
+        *state = AL_PLAYING;
+    }
+    return ofs;
+}
+
+static inline BOOL DSBuffer_SourceFree(const DeviceShare *share, DWORD loc_status)
+{
+    if(loc_status == DSBSTATUS_LOCHARDWARE)
+        return share->sources.availhw_num != 0;
+    if(loc_status == DSBSTATUS_LOCSOFTWARE)
+        return share->sources.availsw_num != 0;
+    return share->sources.availhw_num != 0 || share->sources.availsw_num != 0;
+}
+
+/* How near two 3D instances need to be to merge, as a fraction of their
+ * minimum distance.
+ */
+#define MERGE_DISTANCE 0.1f
+
+/* Checks if a virtual voice plays the same as another instance of its data,
+ * so it can be heard through that instance's source.
+ */
+static BOOL DSBuffer_CanMerge(const DSBuffer *carrier, const DSBuffer *buf)
+{
+    const DS3DBUFFER *a = &carrier->current.ds3d;
+    const DS3DBUFFER *b = &buf->current.ds3d;
+
+    if(carrier->current.frequency != buf->current.frequency)
+        return FALSE;
+    if(!(buf->buffer->dsbflags&DSBCAPS_CTRL3D))
+        return carrier->current.pan == buf->current.pan;
+    return a->dwMode == b->dwMode && a->flMinDistance == b->flMinDistance &&
+           a->flMaxDistance == b->flMaxDistance &&
+           !vector_changed(&a->vPosition, &b->vPosition, a->flMinDistance*MERGE_DISTANCE);
+}
+
+/* Sends a source's gain along with what the instances merged into it add. */
+static void DSBuffer_SendRiderGain(DSBuffer *carrier)
+{
+    if(!carrier->nriders)
+        carrier->rider_gain = 0.0f;
+    if(!carrier->source)
+        return;
+
+    setALContext(carrier->ctx);
+    alSourcef(carrier->source, AL_GAIN, mB_to_gain((float)carrier->sent.vol) + carrier->rider_gain);
+    checkALError();
+    popALContext();
+}
+
+/* Splits a merged voice off its carrier, to play on as a plain virtual voice.
+ * Should be called with the device lock held.
+ */
+void DSBuffer_Unride(DSBuffer *buf)
+{
+    DSBuffer *carrier = buf->carrier;
+
+    if(!carrier) return;
+    buf->carrier = NULL;
+    carrier->nriders--;
+    carrier->rider_gain -= buf->ride_gain;
+    DSBuffer_SendRiderGain(carrier);
+    TRACE("Split %p off %p\n", buf, carrier);
+}
+
+/* Splits off the voices merged into the buffer, when it stops playing the
+ * way they do. Should be called with the device lock held.
+ */
+static void DSBuffer_DropRiders(DSBuffer *buf)
+{
+    DSPrimary *prim = buf->primary;
+    DWORD i;
+
+    for(i = 0;buf->nriders && i < prim->nvirtvoices;++i)
+    {
+        if(prim->virtvoices[i]->carrier == buf)
+            DSBuffer_Unride(prim->virtvoices[i]);
+    }
+}
+
+/* Keeps a merged voice's share of its carrier's gain current, or splits it
+ * off once the two no longer play the same. Should be called with the device
+ * lock held.
+ */
+void DSBuffer_CheckRider(DSBuffer *buf)
+{
+    DSBuffer *carrier = buf->carrier;
+    float gain;
+
+    if(!DSBuffer_CanMerge(carrier, buf))
+    {
+        DSBuffer_Unride(buf);
+        return;
+    }
+
+    gain = mB_to_gain((float)buf->current.vol);
+    if(gain != buf->ride_gain)
+    {
+        carrier->rider_gain += gain - buf->ride_gain;
+        buf->ride_gain = gain;
+        DSBuffer_SendRiderGain(carrier);
+    }
+}
+
+/* Takes another buffer's lock while the context is set, which is only done if
+ * it's free since buffer locks come before the context. Buffers passed over
+ * are counted. Should be called with the device lock held.
+ */
+static BOOL DSBuffer_TryLock(DSBuffer *buf)
+{
+    if(TryEnterCriticalSection(&buf->crst))
+        return TRUE;
+    buf->share->buffers_busy++;
+    return FALSE;
+}
+
+/* Looks through the other instances of the buffer's data playing on a source
+ * for one the buffer can be heard through: one started from the same offset
+ * within the merge window, that plays the same. Should be called with the
+ * device and buffer locks held and the context set.
+ */
+static DSBuffer *DSBuffer_FindCarrier(DSBuffer *buf, BOOL looping)
+{
+    DSPrimary *prim = buf->primary;
+    DWORD64 now = get_time_us();
+    DWORD start = buf->lastpos % buf->buffer->buf_size;
+    DSBuffer *carrier = NULL;
+    DWORD i;
+
+    for(i = 0;i < prim->NumBufferGroups && !carrier;++i)
+    {
+        struct DSBufferGroup *group = &prim->BufferGroups[i];
+        DWORD64 usemask = group->PlayingBuffers & group->SourceBuffers;
+        while(usemask && !carrier)
+        {
+            int idx = CTZ64(usemask);
+            DSBuffer *cand = group->Buffers + idx;
+            ALint state = AL_PLAYING, cand_looping = AL_FALSE;
+
+            usemask &= ~(U64(1) << idx);
+            if(cand == buf || cand->buffer != buf->buffer || cand->segsize != 0 ||
+               cand->play_ofs != start || now - cand->play_time > (DWORD64)MergeWindow*1000 ||
+               !DSBuffer_TryLock(cand))
+                continue;
+
+            if(!cand->play_idx)
+                alGetSourcei(cand->source, AL_SOURCE_STATE, &state);
+            if(state == AL_PLAYING && DSBuffer_CanMerge(cand, buf))
+            {
+                alGetSourcei(cand->source, AL_LOOPING, &cand_looping);
+                if((cand_looping != AL_FALSE) == looping)
+                    carrier = cand;
+            }
+            LeaveCriticalSection(&cand->crst);
+        }
+    }
+    return carrier;
+}
+
+/* Takes the source from a buffer that isn't playing, leaving it to get one
+ * again when played. Should be called with the device and buffer locks held.
+ */
+static void DSBuffer_ReleaseIdle(DSBuffer *buf, ALint state)
+{
+    ALint ofs = 0;
+
+    DSBuffer_DropRiders(buf);
+    alGetSourcei(buf->source, AL_BYTE_OFFSET, &ofs);
+    if(state == AL_STOPPED)
+        buf->lastpos = buf->buffer->buf_size;
+    else if(state == AL_PAUSED)
+        buf->lastpos = ofs;
+    alSourceRewind(buf->source);
+    alSourcei(buf->source, AL_BUFFER, 0);
+    checkALError();
+
+    buf->isplaying = FALSE;
+    DSBuffer_Group(buf)->PlayingBuffers &= ~buf->group_bit;
+    DSBuffer_Group(buf)->SourceBuffers &= ~buf->group_bit;
+    DSBuffer_Group(buf)->HwBuffers &= ~buf->group_bit;
+    DSBuffer_ReturnSource(buf);
+    buf->loc_status = 0;
+    buf->isdeferredswbuffer = TRUE;
+    buf->share->sources_reclaimed++;
+}
+
+/* Checks if other instances of the buffer's data hold as many sources as the
+ * instance limit allows. Once they do, those that finished playing are let go
+ * of, in one look through per update. Should be called with the device and
+ * buffer locks held and the context set.
+ */
+static BOOL DSBuffer_AtLimit(DSBuffer *buf)
+{
+    DSPrimary *prim = buf->primary;
+    DSData *data = buf->buffer;
+    DWORD held = data->nsources - (buf->source ? 1 : 0);
+    DWORD i;
+
+    if(held < MaxInstances)
+        return FALSE;
+    if(data->limit_checked)
+        return TRUE;
+    data->limit_checked = TRUE;
+
     for(i = 0;i < prim->NumBufferGroups;++i)
     {
-        DWORD_PTR idx = This - prim->BufferGroups[i].Buffers;
-        if(idx < 64)
+        struct DSBufferGroup *group = &prim->BufferGroups[i];
+        DWORD64 usemask = group->SourceBuffers;
+        while(usemask)
         {
-            prim->BufferGroups[i].FreeBuffers |= U64(1) << idx;
-            This = NULL;
-            break;
+            int idx = CTZ64(usemask);
+            DSBuffer *cand = group->Buffers + idx;
+            ALint state = AL_PLAYING;
+
+            usemask &= ~(U64(1) << idx);
+            if(cand == buf || cand->buffer != data || cand->segsize != 0 ||
+               !DSBuffer_TryLock(cand))
+                continue;
+
+            if(!cand->play_idx)
+                alGetSourcei(cand->source, AL_SOURCE_STATE, &state);
+            /* Leave it until its stop notifications are sent. */
+            if(state != AL_PLAYING && !cand->notify_item.idx)
+            {
+                DSBuffer_ReleaseIdle(cand, state);
+                --held;
+            }
+            LeaveCriticalSection(&cand->crst);
+        }
+    }
+    return held >= MaxInstances;
+}
+
+/* Moves a playing buffer off its source to carry on virtually, so the source
+ * can go to a more important voice. Should be called with the device and
+ * buffer locks held.
+ */
+static BOOL DSBuffer_Virtualize(DSBuffer *buf)
+{
+    const ALuint source = buf->source;
+    ALint state, looping = AL_FALSE;
+    DWORD ofs;
+
+    if(!DSPrimary_addvirtual(buf->primary, buf))
+        return FALSE;
+
+    DSBuffer_DropRiders(buf);
+    ofs = DSBuffer_SourcePos(buf, &state);
+    alGetSourcei(source, AL_LOOPING, &looping);
+    alSourceRewind(source);
+    alSourcei(source, AL_BUFFER, 0);
+    checkALError();
+
+    DSBuffer_Group(buf)->SourceBuffers &= ~buf->group_bit;
+    DSBuffer_Group(buf)->HwBuffers &= ~buf->group_bit;
+    buf->virt_loc = buf->loc_status;
+    DSBuffer_ReturnSource(buf);
+    buf->loc_status = 0;
+    buf->isdeferredswbuffer = TRUE;
+
+    buf->isvirtlooping = (looping != AL_FALSE);
+    buf->virt_base = ofs;
+    buf->virt_start = get_time_us();
+    buf->env_deadline = 0;
+    buf->share->voices_virtualized++;
+    TRACE("Virtualized %p at %lu\n", buf, ofs);
+    return TRUE;
+}
+
+/* Frees a source in the given location (or either, if 0) for the buffer. A
+ * source held by a buffer that isn't playing is taken first. Failing that,
+ * unless only reclaiming those, the least important playing voice below this
+ * one goes virtual. Should be called with the device and buffer locks held.
+ */
+static BOOL DSBuffer_StealSource(DSBuffer *buf, DWORD loc_status, BOOL reclaim_only)
+{
+    DSPrimary *prim = buf->primary;
+    DSBuffer *victim = NULL;
+    float gain = 0.0f, victim_gain = 0.0f;
+    BOOL ret;
+    DWORD i;
+
+    if(!reclaim_only)
+        gain = DSBuffer_EstimateGain(buf);
+    for(i = 0;i < prim->NumBufferGroups;++i)
+    {
+        struct DSBufferGroup *group = &prim->BufferGroups[i];
+        DWORD64 usemask = group->SourceBuffers;
+
+        if(loc_status == DSBSTATUS_LOCHARDWARE)
+            usemask &= group->HwBuffers;
+        else if(loc_status == DSBSTATUS_LOCSOFTWARE)
+            usemask &= ~group->HwBuffers;
+        while(usemask)
+        {
+            int idx = CTZ64(usemask);
+            DSBuffer *cand = group->Buffers + idx;
+            ALint state = AL_PLAYING;
+            float cand_gain;
+
+            usemask &= ~(U64(1) << idx);
+            /* Streaming buffers are never taken from. */
+            if(cand == buf || cand->segsize != 0 || !DSBuffer_TryLock(cand))
+                continue;
+
+            if(!cand->play_idx)
+                alGetSourcei(cand->source, AL_SOURCE_STATE, &state);
+            if(state != AL_PLAYING)
+            {
+                /* Leave it until its stop notifications are sent. */
+                if(cand->notify_item.idx)
+                {
+                    LeaveCriticalSection(&cand->crst);
+                    continue;
+                }
+                DSBuffer_ReleaseIdle(cand, state);
+                LeaveCriticalSection(&cand->crst);
+                if(victim)
+                    LeaveCriticalSection(&victim->crst);
+                return TRUE;
+            }
+            if(!reclaim_only && cand->play_prio <= buf->play_prio)
+            {
+                cand_gain = DSBuffer_EstimateGain(cand);
+                if((cand->play_prio < buf->play_prio || cand_gain < gain) &&
+                   (!victim || cand->play_prio < victim->play_prio ||
+                    (cand->play_prio == victim->play_prio && cand_gain < victim_gain)))
+                {
+                    /* Keep the best so far locked, so it can't be missed
+                     * for being busy once picked.
+                     */
+                    if(victim)
+                        LeaveCriticalSection(&victim->crst);
+                    victim = cand;
+                    victim_gain = cand_gain;
+                    continue;
+                }
+            }
+            LeaveCriticalSection(&cand->crst);
         }
     }
-    LeaveCriticalSection(&prim->share->crst);
+
+    if(!victim)
+        return FALSE;
+    ret = DSBuffer_Virtualize(victim);
+    if(ret) victim->isstolen = TRUE;
+    LeaveCriticalSection(&victim->crst);
+    return ret;
 }
 
-HRESULT DSBuffer_GetInterface(DSBuffer *buf, REFIID riid, void **ppv)
+/* Moves a playing voice that's too quiet to hear off its source, to carry on
+ * virtually until it gets louder. Should be called with the device lock held,
+ * but not the context, which is set after taking the buffer lock.
+ */
+void DSBuffer_Cull(DSBuffer *buf)
 {
-    *ppv = NULL;
-    if(IsEqualIID(riid, &IID_IDirectSoundBuffer))
-        *ppv = &buf->IDirectSoundBuffer8_iface;
-    else if(IsEqualIID(riid, &IID_IDirectSoundBuffer8))
-    {
-        if(buf->primary->parent->is_8)
-            *ppv = &buf->IDirectSoundBuffer8_iface;
-    }
-    else if(IsEqualIID(riid, &IID_IDirectSound3DBuffer))
-    {
-        if((buf->buffer->dsbflags&DSBCAPS_CTRL3D))
-            *ppv = &buf->IDirectSound3DBuffer_iface;
-    }
-    else if(IsEqualIID(riid, &IID_IDirectSoundNotify))
+    ALint state = AL_PLAYING;
+
+    if(!buf->source || buf->segsize != 0 || DSBuffer_IsAudible(buf))
+        return;
+
+    EnterCriticalSection(&buf->crst);
+    setALContext(buf->ctx);
+    if(!buf->play_idx)
+        alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
+    if(state == AL_PLAYING && DSBuffer_Virtualize(buf))
     {
-        if((buf->buffer->dsbflags&DSBCAPS_CTRLPOSITIONNOTIFY))
-            *ppv = &buf->IDirectSoundNotify_iface;
+        buf->isculled = TRUE;
+        buf->share->voices_culled++;
     }
-    else if(IsEqualIID(riid, &IID_IKsPropertySet))
-        *ppv = &buf->IKsPropertySet_iface;
-    else if(IsEqualIID(riid, &IID_IUnknown))
-        *ppv = &buf->IDirectSoundBuffer8_iface;
-    else
-        FIXME("Unhandled GUID: %s\n", debugstr_guid(riid));
+    popALContext();
+    LeaveCriticalSection(&buf->crst);
+}
 
-    if(*ppv)
+/* Releases the source of a one-shot voice that reached a stretch too quiet to
+ * hear, or finds when it next might. Should be called with the device lock
+ * held, but not the context, which is set after taking the buffer lock.
+ */
+void DSBuffer_CheckEnvelope(DSBuffer *buf, DWORD64 now)
+{
+    DWORD block_size = buf->buffer->envelope.block_size;
+    ALint state;
+    DWORD pos;
+
+    EnterCriticalSection(&buf->crst);
+    setALContext(buf->ctx);
+    buf->env_deadline = 0;
+    pos = DSBuffer_SourcePos(buf, &state);
+    if(state == AL_PLAYING)
     {
-        IUnknown_AddRef((IUnknown*)*ppv);
-        return S_OK;
+        if(!DSBuffer_IsSilent(buf, pos))
+            DSBuffer_ScheduleEnvelope(buf, pos, pos - pos%block_size + block_size, now);
+        else
+        {
+            TRACE("%p is quiet at %lu, peak level %u\n", buf, pos, DSBuffer_GetEnvelope(buf, pos));
+            if(DSBuffer_Virtualize(buf))
+                buf->share->voices_silenced++;
+        }
     }
-
-    return E_NOINTERFACE;
+    popALContext();
+    LeaveCriticalSection(&buf->crst);
 }
 
-static HRESULT DSBuffer_SetLoc(DSBuffer *buf, DWORD loc_status)
+/* Places the buffer to be played, taking a source from another buffer if
+ * none are free. Returns S_FALSE if the buffer should play virtually instead,
+ * which inaudible buffers do to begin with, as do instances merged into
+ * another or over the instance limit. Should be called with the device and
+ * buffer locks held and the context set.
+ */
+static HRESULT DSBuffer_PlaceVoice(DSBuffer *buf, DWORD loc_status, DWORD flags)
 {
     DeviceShare *share = buf->share;
-    DSData *data = buf->buffer;
-
-    if((loc_status && buf->loc_status == loc_status) || (!loc_status && buf->loc_status))
-        return DS_OK;
+    /* SetLoc keeps a placement that already suits. */
+    BOOL placed = loc_status ? (buf->loc_status == loc_status) : (buf->loc_status != 0);
+    HRESULT hr;
 
-    /* If we have a source, we're changing location, so return the source we
-     * have to get a new one.
-     */
-    if(buf->source)
+    if(buf->segsize == 0 && !placed)
     {
-        alSourceRewind(buf->source);
-        alSourcei(buf->source, AL_BUFFER, 0);
-        checkALError();
-
-        if(buf->loc_status == DSBSTATUS_LOCHARDWARE)
-            share->sources.ids[share->sources.availhw_num++] = buf->source;
-        else
+        BOOL silent = !(flags&DSBPLAY_LOOPING) &&
+                      DSBuffer_IsSilent(buf, buf->lastpos % buf->buffer->buf_size);
+        /* Deferred 3D changes aren't applied yet, so culling is left to the
+         * commit that applies them.
+         */
+        BOOL culled = !silent && !buf->dirty.flags && !buf->primary->dirty.flags &&
+                      !DSBuffer_IsAudible(buf);
+        if(MergeWindow)
+            buf->carrier = DSBuffer_FindCarrier(buf, !!(flags&DSBPLAY_LOOPING));
+        if(buf->carrier || (MaxInstances && DSBuffer_AtLimit(buf)))
         {
-            DWORD base = share->sources.maxhw_alloc;
-            share->sources.ids[base + share->sources.availsw_num++] = buf->source;
+            if(buf->carrier) share->voices_merged++;
+            else share->voices_limited++;
+            buf->virt_loc = loc_status;
+            return S_FALSE;
+        }
+        if(silent || culled ||
+           (!DSBuffer_SourceFree(share, loc_status) &&
+            share->vm_managermode != DSPROPERTY_VMANAGER_MODE_REPORT &&
+            !DSBuffer_StealSource(buf, loc_status, FALSE)))
+        {
+            if(silent) share->voices_silenced++;
+            buf->isculled = culled;
+            buf->virt_loc = loc_status;
+            return S_FALSE;
         }
-        buf->source = 0;
     }
-    buf->loc_status = 0;
 
-    if(!loc_status)
+    hr = DSBuffer_SetLoc(buf, loc_status);
+    if(hr == DSERR_ALLOCATED)
+        buf->vm_voicestate = DSPROPERTY_VMANAGER_STATE_PLAYFAILED;
+    return hr;
+}
+
+/* Starts the buffer playing as a virtual voice. Should be called with the
+ * device and buffer locks held.
+ */
+static HRESULT DSBuffer_StartVirtual(DSBuffer *buf, DWORD flags)
+{
+    DSData *data = buf->buffer;
+
+    if(!DSPrimary_addvirtual(buf->primary, buf))
     {
-        if(share->sources.availhw_num)
-            loc_status = DSBSTATUS_LOCHARDWARE;
-        else if(share->sources.availsw_num)
-            loc_status = DSBSTATUS_LOCSOFTWARE;
+        buf->carrier = NULL;
+        return DSERR_OUTOFMEMORY;
     }
 
-    if((loc_status == DSBSTATUS_LOCHARDWARE && !share->sources.availhw_num) ||
-       (loc_status == DSBSTATUS_LOCSOFTWARE && !share->sources.availsw_num) ||
-       !loc_status)
+    buf->isvirtlooping = !!(flags&DSBPLAY_LOOPING);
+    buf->virt_base = buf->lastpos % data->buf_size;
+    buf->virt_start = get_time_us();
+    if(buf->carrier)
     {
-        ERR("Out of %s sources\n",
-            (loc_status == DSBSTATUS_LOCHARDWARE) ? "hardware" :
-            (loc_status == DSBSTATUS_LOCSOFTWARE) ? "software" : "any"
-        );
-        return DSERR_ALLOCATED;
+        /* Heard through the carrier's source, at the sum of their gains. */
+        buf->ride_gain = mB_to_gain((float)buf->current.vol);
+        buf->carrier->rider_gain += buf->ride_gain;
+        buf->carrier->nriders++;
+        DSBuffer_SendRiderGain(buf->carrier);
+        TRACE("Playing %p merged into %p\n", buf, buf->carrier);
     }
-
-    if(loc_status == DSBSTATUS_LOCHARDWARE)
-        buf->source = share->sources.ids[--(share->sources.availhw_num)];
     else
     {
-        DWORD base = share->sources.maxhw_alloc;
-        buf->source = share->sources.ids[base + --(share->sources.availsw_num)];
+        buf->share->voices_virtualized++;
+        TRACE("Playing %p virtually\n", buf);
     }
-    alSourcef(buf->source, AL_GAIN, mB_to_gain((float)buf->current.vol));
-    alSourcef(buf->source, AL_PITCH,
-        buf->current.frequency ? (float)buf->current.frequency/data->format.Format.nSamplesPerSec
-                               : 1.0f);
-    checkALError();
-
-    /* TODO: Don't set EAX parameters or connect to effect slots for software
-     * buffers. Need to check if EAX buffer properties are still tracked, or if
-     * they're lost/reset when leaving hardware.
-     *
-     * Alternatively, we can just allow it and say software processing supports
-     * EAX too. Depends if apps may get upset over that.
-     */
 
-    if((data->dsbflags&DSBCAPS_CTRL3D))
-    {
-        const DSPrimary *prim = buf->primary;
-        const ALuint source = buf->source;
-        const DS3DBUFFER *params = &buf->current.ds3d;
+    buf->isplaying = TRUE;
+    DSBuffer_Group(buf)->PlayingBuffers |= buf->group_bit;
+    if(buf->nnotify)
+        DSPrimary_addnotify(buf->primary, buf);
+    return DS_OK;
+}
 
-        alSource3f(source, AL_POSITION, params->vPosition.x, params->vPosition.y,
-                                       -params->vPosition.z);
-        alSource3f(source, AL_VELOCITY, params->vVelocity.x, params->vVelocity.y,
-                                       -params->vVelocity.z);
-        alSourcei(source, AL_CONE_INNER_ANGLE, params->dwInsideConeAngle);
-        alSourcei(source, AL_CONE_OUTER_ANGLE, params->dwOutsideConeAngle);
-        alSource3f(source, AL_DIRECTION, params->vConeOrientation.x,
-                                         params->vConeOrientation.y,
-                                        -params->vConeOrientation.z);
-        alSourcef(source, AL_CONE_OUTER_GAIN, mB_to_gain((float)params->lConeOutsideVolume));
-        alSourcef(source, AL_REFERENCE_DISTANCE, params->flMinDistance);
-        alSourcef(source, AL_MAX_DISTANCE, params->flMaxDistance);
-        if(HAS_EXTENSION(share, SOFT_SOURCE_SPATIALIZE))
-            alSourcei(source, AL_SOURCE_SPATIALIZE_SOFT,
-                (params->dwMode==DS3DMODE_DISABLE) ? AL_FALSE : AL_TRUE
-            );
-        alSourcei(source, AL_SOURCE_RELATIVE,
-            (params->dwMode!=DS3DMODE_NORMAL) ? AL_TRUE : AL_FALSE
-        );
+/* Gives a virtual voice a source again, to carry on from where it would be.
+ * Returns FALSE if no source could be had, or if the instance limit holds it
+ * back, which marks it limited. Should be called with the device lock held,
+ * but not the context, which is set after taking the buffer lock.
+ */
+BOOL DSBuffer_RestoreVirtual(DSBuffer *buf, BOOL reclaim)
+{
+    DSData *data = buf->buffer;
+    DWORD pos;
+    BOOL ret = FALSE;
 
-        alSourcef(source, AL_ROLLOFF_FACTOR, prim->current.ds3d.flRolloffFactor);
-        if(HAS_EXTENSION(share, EXT_EAX))
-        {
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLPARAMETERS, source,
-                &share->default_srcprops, sizeof(share->default_srcprops));
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLSENDPARAMETERS, source,
-                &share->default_srcsend, sizeof(share->default_srcsend));
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ACTIVEFXSLOTID, source,
-                &share->default_srcslots, sizeof(share->default_srcslots));
-        }
-        checkALError();
-    }
-    else
+    EnterCriticalSection(&buf->crst);
+    setALContext(buf->ctx);
+    if(MaxInstances && DSBuffer_AtLimit(buf))
     {
-        const ALuint source = buf->source;
-        const ALfloat x = (ALfloat)(buf->current.pan-DSBPAN_LEFT)/(DSBPAN_RIGHT-DSBPAN_LEFT) -
-                          0.5f;
-
-        alSource3f(source, AL_POSITION, x, 0.0f, -sqrtf(1.0f - x*x));
-        alSource3f(source, AL_VELOCITY, 0.0f, 0.0f, 0.0f);
-        alSource3f(source, AL_DIRECTION, 0.0f, 0.0f, 0.0f);
-        alSourcef(source, AL_CONE_OUTER_GAIN, 1.0f);
-        alSourcef(source, AL_REFERENCE_DISTANCE, 1.0f);
-        alSourcef(source, AL_MAX_DISTANCE, 1000.0f);
-        alSourcef(source, AL_ROLLOFF_FACTOR, 0.0f);
-        alSourcef(source, AL_DOPPLER_FACTOR, 0.0f);
-        alSourcei(source, AL_CONE_INNER_ANGLE, 360);
-        alSourcei(source, AL_CONE_OUTER_ANGLE, 360);
-        alSourcei(source, AL_SOURCE_RELATIVE, AL_TRUE);
-        if(HAS_EXTENSION(share, SOFT_SOURCE_SPATIALIZE))
-        {
-            /* Set to auto so panning works for mono, and multi-channel works
-             * as expected.
-             */
-            alSourcei(source, AL_SOURCE_SPATIALIZE_SOFT, AL_AUTO_SOFT);
-        }
-        if(HAS_EXTENSION(share, EXT_EAX))
-        {
-            static const GUID NullSlots[EAX_MAX_ACTIVE_FXSLOTS] = { { 0 } };
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLPARAMETERS, source,
-                &share->default_srcprops, sizeof(share->default_srcprops));
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ALLSENDPARAMETERS, source,
-                &share->default_srcsend, sizeof(share->default_srcsend));
-            EAXSet(&EAXPROPERTYID_EAX40_Source, EAXSOURCE_ACTIVEFXSLOTID, source, (void*)NullSlots,
-                sizeof(NullSlots));
-        }
-        checkALError();
+        buf->islimited = TRUE;
+        goto out;
     }
+    if(!DSBuffer_SourceFree(buf->share, buf->virt_loc) &&
+       !(reclaim && DSBuffer_StealSource(buf, buf->virt_loc, TRUE)))
+        goto out;
+    if(FAILED(DSBuffer_SetLoc(buf, buf->virt_loc)))
+        goto out;
 
-    buf->loc_status = loc_status;
-    if (buf->isdeferredswbuffer) buf->isdeferredswbuffer = FALSE;
-    return DS_OK;
+    DSBuffer_GetVirtualPos(buf, get_time_us(), &pos);
+    DSPrimary_removevirtual(buf->primary, buf);
+    DSData_FlushDirty(data);
+    alSourcei(buf->source, AL_LOOPING, buf->isvirtlooping ? AL_TRUE : AL_FALSE);
+    alSourcei(buf->source, AL_BUFFER, data->bid);
+    alSourcei(buf->source, AL_BYTE_OFFSET, pos % data->buf_size);
+    alSourcePlay(buf->source);
+    checkALError();
+    if(!buf->isvirtlooping)
+        DSBuffer_ScheduleEnvelope(buf, pos, pos, get_time_us());
+    buf->share->voices_restored++;
+    TRACE("Restored %p at %lu\n", buf, pos);
+    ret = TRUE;
+
+out:
+    popALContext();
+    LeaveCriticalSection(&buf->crst);
+    return ret;
 }
 
 
@@ -877,13 +2029,29 @@ HRESULT WINAPI DSBuffer_GetCurrentPosition(IDirectSoundBuffer8 *iface, DWORD *pl
     TRACE("(%p)->(%p, %p)\n", iface, playpos, curpos);
 
     data = This->buffer;
-    if(This->segsize != 0)
+    if(This->iscallback)
+    {
+        EnterCriticalSection(&This->crst);
+        setALContext(This->ctx);
+        DSBuffer_checkcallback(This);
+        pos = DSBuffer_CallbackPos(This);
+        popALContext();
+
+        /* OpenAL already has what the callback read. */
+        if(This->isplaying)
+            writecursor = This->cb_offset % data->buf_size;
+        else
+            writecursor = pos % data->buf_size;
+
+        LeaveCriticalSection(&This->crst);
+    }
+    else if(This->segsize != 0)
     {
         ALint queued = QBUFFERS;
         ALint status = AL_INITIAL;
         ALint ofs = 0;
 
-        EnterCriticalSection(&This->share->crst);
+        EnterCriticalSection(&This->crst);
 
         if(LIKELY(This->source))
         {
@@ -913,11 +2081,11 @@ HRESULT WINAPI DSBuffer_GetCurrentPosition(IDirectSoundBuffer8 *iface, DWORD *pl
             }
         }
         if(This->isplaying)
-            writecursor = (This->segsize*QBUFFERS + pos) % data->buf_size;
+            writecursor = (This->segsize*This->queue_size + pos) % data->buf_size;
         else
             writecursor = pos % data->buf_size;
 
-        LeaveCriticalSection(&This->share->crst);
+        LeaveCriticalSection(&This->crst);
     }
     else
     {
@@ -925,7 +2093,14 @@ HRESULT WINAPI DSBuffer_GetCurrentPosition(IDirectSoundBuffer8 *iface, DWORD *pl
         ALint status = AL_INITIAL;
         ALint ofs = 0;
 
-        if(LIKELY(This->source))
+        EnterCriticalSection(&This->crst);
+        if(This->virt_idx)
+        {
+            DWORD vpos;
+            status = DSBuffer_GetVirtualPos(This, get_time_us(), &vpos) ? AL_PLAYING : AL_STOPPED;
+            ofs = vpos;
+        }
+        else if(LIKELY(This->source))
         {
             setALContext(This->ctx);
             alGetSourcei(This->source, AL_BYTE_OFFSET, &ofs);
@@ -933,6 +2108,14 @@ HRESULT WINAPI DSBuffer_GetCurrentPosition(IDirectSoundBuffer8 *iface, DWORD *pl
             checkALError();
             popALContext();
         }
+        if(This->play_idx)
+        {
+            /* Starts with the next batch, from where alSourcePlay will. */
+            if(status == AL_INITIAL) ofs = This->lastpos % data->buf_size;
+            else if(status == AL_STOPPED) ofs = 0;
+            status = AL_PLAYING;
+        }
+        LeaveCriticalSection(&This->crst);
 
         if(status == AL_PLAYING)
         {
@@ -1086,6 +2269,7 @@ HRESULT WINAPI DSBuffer_GetStatus(IDirectSoundBuffer8 *iface, DWORD *status)
 {
     DSBuffer *This = impl_from_IDirectSoundBuffer8(iface);
     ALint state, looping;
+    BOOL virt;
 
     TRACE("(%p)->(%p)\n", iface, status);
 
@@ -1096,7 +2280,19 @@ HRESULT WINAPI DSBuffer_GetStatus(IDirectSoundBuffer8 *iface, DWORD *status)
     }
     *status = 0;
 
-    if(This->segsize == 0)
+    EnterCriticalSection(&This->crst);
+    virt = (This->virt_idx != 0);
+    if(virt)
+    {
+        DWORD pos;
+
+        state = DSBuffer_GetVirtualPos(This, get_time_us(), &pos) ? AL_PLAYING : AL_STOPPED;
+        looping = This->isvirtlooping;
+        /* It's being played, just not by OpenAL. */
+        if((This->buffer->dsbflags&DSBCAPS_LOCDEFER) && state == AL_PLAYING)
+            *status |= DSBSTATUS_LOCSOFTWARE;
+    }
+    else if(This->segsize == 0)
     {
         state = AL_INITIAL;
         looping = AL_FALSE;
@@ -1108,19 +2304,34 @@ HRESULT WINAPI DSBuffer_GetStatus(IDirectSoundBuffer8 *iface, DWORD *status)
             checkALError();
             popALContext();
         }
+        if(This->play_idx)
+            state = AL_PLAYING;
     }
     else
     {
-        EnterCriticalSection(&This->share->crst);
+        if(This->iscallback)
+        {
+            setALContext(This->ctx);
+            DSBuffer_checkcallback(This);
+            popALContext();
+        }
         state = This->isplaying ? AL_PLAYING : AL_PAUSED;
         looping = This->islooping;
-        LeaveCriticalSection(&This->share->crst);
     }
+    LeaveCriticalSection(&This->crst);
 
     if((This->buffer->dsbflags&DSBCAPS_LOCDEFER))
         *status |= This->loc_status;
     if(state == AL_PLAYING)
         *status |= DSBSTATUS_PLAYING | (looping ? DSBSTATUS_LOOPING : 0);
+    else if(This->vm_voicestate == DSPROPERTY_VMANAGER_STATE_BUMPED ||
+            (virt && state == AL_STOPPED && This->isstolen))
+    {
+        /* Lost its source to another voice, and ended before getting one
+         * back.
+         */
+        *status |= DSBSTATUS_TERMINATED;
+    }
 
     TRACE("%p status = 0x%08lx\n", This, *status);
     return S_OK;
@@ -1131,6 +2342,7 @@ HRESULT WINAPI DSBuffer_Initialize(IDirectSoundBuffer8 *iface, IDirectSound *ds,
     DSBuffer *This = impl_from_IDirectSoundBuffer8(iface);
     DSPrimary *prim;
     DSData *data;
+    BOOL is_dup;
     HRESULT hr;
 
     TRACE("(%p)->(%p, %p)\n", iface, ds, desc);
@@ -1142,6 +2354,7 @@ HRESULT WINAPI DSBuffer_Initialize(IDirectSoundBuffer8 *iface, IDirectSound *ds,
     if(This->init_done) goto out;
 
     prim = This->primary;
+    is_dup = (This->buffer != NULL);
     if(!This->buffer)
     {
         hr = DSERR_INVALIDPARAM;
@@ -1183,20 +2396,34 @@ HRESULT WINAPI DSBuffer_Initialize(IDirectSoundBuffer8 *iface, IDirectSound *ds,
 
         data = This->buffer;
         if(data->format.Format.wBitsPerSample == 8)
-            memset(data->data, 0x80, data->buf_size);
+            memset(data->data, 0x80, data->buf_size + data->mirror_size);
         else
-            memset(data->data, 0x00, data->buf_size);
+            memset(data->data, 0x00, data->buf_size + data->mirror_size);
     }
 
     data = This->buffer;
     if(!(data->dsbflags&DSBCAPS_STATIC) && !HAS_EXTENSION(This->share, SOFTX_MAP_BUFFER))
     {
-        This->segsize = (data->format.Format.nAvgBytesPerSec+prim->refresh-1) / prim->refresh;
-        This->segsize = clampI(This->segsize, data->format.Format.nBlockAlign, 2048);
-        This->segsize += data->format.Format.nBlockAlign - 1;
-        This->segsize -= This->segsize%data->format.Format.nBlockAlign;
+        DSBuffer_UpdateStream(This, TRUE);
 
-        alGenBuffers(QBUFFERS, This->stream_bids);
+        /* With callback buffers, OpenAL reads from our storage as needed and
+         * the queue isn't used, so only one buffer is needed.
+         */
+        if(HAS_EXTENSION(This->share, SOFT_CALLBACK_BUFFER) && alBufferCallbackSOFT)
+        {
+            alGenBuffers(1, This->stream_bids);
+            alBufferCallbackSOFT(This->stream_bids[0], data->buf_format,
+                data->format.Format.nSamplesPerSec, DSBuffer_streamcallback, This);
+            if(alGetError() == AL_NO_ERROR)
+                This->iscallback = TRUE;
+            else
+            {
+                WARN("Failed to set buffer callback, using queued streaming\n");
+                alGenBuffers(QBUFFERS-1, This->stream_bids+1);
+            }
+        }
+        else
+            alGenBuffers(QBUFFERS, This->stream_bids);
         checkALError();
     }
     if(!(data->dsbflags&DSBCAPS_CTRL3D))
@@ -1214,8 +2441,17 @@ HRESULT WINAPI DSBuffer_Initialize(IDirectSoundBuffer8 *iface, IDirectSound *ds,
     // By doing this, GW quickly burns through DSOAL's supply of software sources. 
     // So we're only going to assign sources here for (virtual) hardware buffers.
     // Software buffers can get a source later if they actually need it. (Which never seems to happen.)
+    // Hardware duplicates take their source here too, so duplicating fails
+    // when there's no hardware source left for it. But they're made to play
+    // another instance right away or not at all, so a static duplicate's
+    // parameters are only sent when it's played, and only those the source
+    // doesn't already have.
     if(!(data->dsbflags&DSBCAPS_LOCDEFER)){
-        if(data->dsbflags&DSBCAPS_LOCHARDWARE){
+        if((data->dsbflags&DSBCAPS_LOCHARDWARE) && is_dup && This->segsize == 0){
+            hr = DSBuffer_TakeLoc(This, DSBSTATUS_LOCHARDWARE, &This->src_have);
+            This->src_unsent = SUCCEEDED(hr);
+        }
+        else if(data->dsbflags&DSBCAPS_LOCHARDWARE){
             hr = DSBuffer_SetLoc(This, DSBSTATUS_LOCHARDWARE);
         }
         else if (data->dsbflags&DSBCAPS_LOCSOFTWARE){
@@ -1306,12 +2542,14 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
 {
     DSBuffer *This = impl_from_IDirectSoundBuffer8(iface);
     ALint state = AL_STOPPED;
+    BOOL virt = FALSE;
     DSData *data;
     HRESULT hr;
 
     TRACE("(%p)->(%lu, %lu, %lu)\n", iface, res1, prio, flags);
     
     EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     setALContext(This->ctx);
 
     hr = DSERR_BUFFERLOST;
@@ -1320,11 +2558,32 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         WARN("Buffer %p lost\n", This);
         goto out;
     }
+
+    if(This->virt_idx)
+    {
+        DWORD pos;
+        hr = S_OK;
+        if(DSBuffer_GetVirtualPos(This, get_time_us(), &pos))
+        {
+            /* Already playing, just without a source. */
+            This->isvirtlooping = !!(flags&DSBPLAY_LOOPING);
+            goto out;
+        }
+        /* Played through, but not cleaned up yet. */
+        DSPrimary_removevirtual(This->primary, This);
+        This->lastpos = pos;
+    }
+
+    This->play_prio = (This->share->vm_managermode == DSPROPERTY_VMANAGER_MODE_USER) ?
+        This->vm_voicepriority : prio;
+    This->vm_voicestate = DSPROPERTY_VMANAGER_STATE_SILENT;
+    This->isculled = FALSE;
+    This->env_deadline = 0;
     
-    // Software buffers may need to be assigned a source now,
+    // Software buffers and duplicates may need to be assigned a source now,
     // since they weren't assigned one at initialization due to our Guild-Wars-specific hack.
     if (!(This->source) && This->isdeferredswbuffer){
-        WARN("Assigning a source for software buffer that was previously deferred as per Guild Wars hack (%p).", This);
+        TRACE("Assigning a deferred source for buffer %p\n", This);
         hr = DSERR_INVALIDPARAM;
         if((flags&(DSBPLAY_LOCSOFTWARE|DSBPLAY_LOCHARDWARE)) == (DSBPLAY_LOCSOFTWARE|DSBPLAY_LOCHARDWARE)){
             WARN("Both hardware and software specified\n");
@@ -1332,10 +2591,12 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         }
         // (we don't need to check if it's already playing since it has no source to play it)
         DWORD loc = 0;
-        if((flags&DSBPLAY_LOCHARDWARE)) loc = DSBSTATUS_LOCHARDWARE;
+        if((flags&DSBPLAY_LOCHARDWARE) || (This->buffer->dsbflags&DSBCAPS_LOCHARDWARE))
+            loc = DSBSTATUS_LOCHARDWARE;
         else loc = DSBSTATUS_LOCSOFTWARE;
-        hr = DSBuffer_SetLoc(This, loc);
+        hr = DSBuffer_PlaceVoice(This, loc, flags);
         if(FAILED(hr)) goto out;
+        virt = (hr == S_FALSE);
     }
 
     data = This->buffer;
@@ -1373,8 +2634,12 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
             }
         }
 
-        hr = DSBuffer_SetLoc(This, loc);
-        if(FAILED(hr)) goto out;
+        if(!virt)
+        {
+            hr = DSBuffer_PlaceVoice(This, loc, flags);
+            if(FAILED(hr)) goto out;
+            virt = (hr == S_FALSE);
+        }
     }
     else if(prio)
     {
@@ -1383,8 +2648,34 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         goto out;
     }
 
+    if(virt)
+    {
+        /* No source to be had, so play without one until one frees up. */
+        hr = DSBuffer_StartVirtual(This, flags);
+        goto out;
+    }
+    if(This->src_unsent)
+        DSBuffer_SendSource(This, &This->src_have);
+
+    DSBuffer_UpdateRolloff(This);
+    /* The priority it's played with may change the resampler. */
+    DSBuffer_UpdateResampler(This);
+
     if(This->segsize != 0)
     {
+        if(This->iscallback)
+        {
+            DSBuffer_checkcallback(This);
+            if(This->isplaying && This->islooping != !!(flags&DSBPLAY_LOOPING))
+            {
+                /* Count from the current position, with the new looping. */
+                ALint frames = 0;
+                DWORD pos = DSBuffer_CallbackPos(This);
+                alGetSourcei(This->source, AL_SAMPLE_OFFSET, &frames);
+                This->cb_base = (LONGLONG)pos -
+                                (LONGLONG)frames*data->format.Format.nBlockAlign;
+            }
+        }
         This->islooping = !!(flags&DSBPLAY_LOOPING);
         if(This->isplaying) state = AL_PLAYING;
     }
@@ -1393,6 +2684,7 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         alSourcei(This->source, AL_LOOPING, (flags&DSBPLAY_LOOPING) ? AL_TRUE : AL_FALSE);
         alGetSourcei(This->source, AL_SOURCE_STATE, &state);
         checkALError();
+        if(This->play_idx) state = AL_PLAYING;
     }
 
     hr = S_OK;
@@ -1401,11 +2693,24 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
 
     if(This->segsize == 0)
     {
+        DSData_FlushDirty(data);
         if(state == AL_INITIAL)
         {
             alSourcei(This->source, AL_BUFFER, data->bid);
             alSourcei(This->source, AL_BYTE_OFFSET, This->lastpos % data->buf_size);
         }
+        if(!BatchSourcePlay || !DSPrimary_queueplay(This->primary, This))
+            alSourcePlay(This->source);
+    }
+    else if(This->iscallback)
+    {
+        alSourceRewind(This->source);
+        alSourcei(This->source, AL_BUFFER, 0);
+        InterlockedExchange(&This->cb_offset, This->cb_offset % data->buf_size);
+        This->cb_base = This->cb_offset;
+        /* Looping is handled by the callback. */
+        alSourcei(This->source, AL_LOOPING, AL_FALSE);
+        alSourcei(This->source, AL_BUFFER, This->stream_bids[0]);
         alSourcePlay(This->source);
     }
     else
@@ -1414,6 +2719,7 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         alSourcei(This->source, AL_BUFFER, 0);
         This->queue_base = This->data_offset % data->buf_size;
         This->curidx = 0;
+        DSBuffer_UpdateStream(This, TRUE);
     }
     if(alGetError() != AL_NO_ERROR)
     {
@@ -1421,13 +2727,31 @@ static HRESULT WINAPI DSBuffer_Play(IDirectSoundBuffer8 *iface, DWORD res1, DWOR
         hr = DSERR_GENERIC;
         goto out;
     }
+    if(This->segsize == 0)
+    {
+        /* Where it started, for later instances to merge into. A resumed
+         * source's offset isn't known, so nothing merges into it.
+         */
+        This->play_time = get_time_us();
+        This->play_ofs = (state == AL_INITIAL) ? This->lastpos % data->buf_size :
+                         (state == AL_STOPPED) ? 0 : data->buf_size;
+    }
     This->isplaying = TRUE;
+    DSBuffer_Group(This)->PlayingBuffers |= This->group_bit;
+    if(This->segsize != 0 && !This->iscallback)
+        DSBuffer_Group(This)->StreamBuffers |= This->group_bit;
+    else if(This->segsize == 0 && !(flags&DSBPLAY_LOOPING))
+    {
+        DWORD pos = DSBuffer_SourcePos(This, &state);
+        DSBuffer_ScheduleEnvelope(This, pos, pos, get_time_us());
+    }
 
     if(This->nnotify)
-        DSBuffer_addnotify(This);
+        DSPrimary_addnotify(This->primary, This);
 
 out:
     popALContext();
+    LeaveCriticalSection(&This->crst);
     LeaveCriticalSection(&This->share->crst);
     return hr;
 }
@@ -1445,8 +2769,25 @@ static HRESULT WINAPI DSBuffer_SetCurrentPosition(IDirectSoundBuffer8 *iface, DW
     pos -= pos%data->format.Format.nBlockAlign;
 
     EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
 
-    if(This->segsize != 0)
+    if(This->iscallback)
+    {
+        InterlockedExchange(&This->cb_offset, pos);
+        This->cb_base = pos;
+        if(This->isplaying)
+        {
+            setALContext(This->ctx);
+            /* Restart the source to drop what the mixer already read. */
+            alSourceRewind(This->source);
+            alSourcei(This->source, AL_BUFFER, 0);
+            alSourcei(This->source, AL_BUFFER, This->stream_bids[0]);
+            alSourcePlay(This->source);
+            checkALError();
+            popALContext();
+        }
+    }
+    else if(This->segsize != 0)
     {
         if(This->isplaying)
         {
@@ -1460,11 +2801,20 @@ static HRESULT WINAPI DSBuffer_SetCurrentPosition(IDirectSoundBuffer8 *iface, DW
         }
         This->queue_base = This->data_offset = pos;
         This->curidx = 0;
+        DSBuffer_UpdateStream(This, TRUE);
+    }
+    else if(This->virt_idx)
+    {
+        /* Moved away from its carrier, if merged. */
+        DSBuffer_Unride(This);
+        This->virt_base = pos;
+        This->virt_start = get_time_us();
     }
     else
     {
         if(LIKELY(This->source))
         {
+            DSBuffer_DropRiders(This);
             setALContext(This->ctx);
             alSourcei(This->source, AL_BYTE_OFFSET, pos);
             checkALError();
@@ -1472,7 +2822,10 @@ static HRESULT WINAPI DSBuffer_SetCurrentPosition(IDirectSoundBuffer8 *iface, DW
         }
     }
     This->lastpos = pos;
+    if(This->notify_item.idx)
+        DSPrimary_addnotify(This->primary, This);
 
+    LeaveCriticalSection(&This->crst);
     LeaveCriticalSection(&This->share->crst);
     return DS_OK;
 }
@@ -1501,13 +2854,17 @@ static HRESULT WINAPI DSBuffer_SetVolume(IDirectSoundBuffer8 *iface, LONG vol)
         hr = DSERR_CONTROLUNAVAIL;
     else
     {
+        EnterCriticalSection(&This->crst);
         This->current.vol = vol;
-        if(LIKELY(This->source))
+        if(LIKELY(This->source) &&
+           DSShare_CountUpdate(This->share, labs(vol - This->sent.vol) > GainTolerance))
         {
             setALContext(This->ctx);
-            alSourcef(This->source, AL_GAIN, mB_to_gain((float)vol));
+            alSourcef(This->source, AL_GAIN, mB_to_gain((float)vol) + This->rider_gain);
             popALContext();
+            This->sent.vol = vol;
         }
+        LeaveCriticalSection(&This->crst);
     }
 
     return hr;
@@ -1530,8 +2887,10 @@ static HRESULT WINAPI DSBuffer_SetPan(IDirectSoundBuffer8 *iface, LONG pan)
         hr = DSERR_CONTROLUNAVAIL;
     else
     {
+        EnterCriticalSection(&This->crst);
         This->current.pan = pan;
-        if(LIKELY(This->source && !(This->buffer->dsbflags&DSBCAPS_CTRL3D)))
+        if(LIKELY(This->source && !(This->buffer->dsbflags&DSBCAPS_CTRL3D)) &&
+           DSShare_CountUpdate(This->share, pan != This->sent.pan))
         {
             ALfloat pos[3];
             pos[0] = (ALfloat)(pan-DSBPAN_LEFT)/(ALfloat)(DSBPAN_RIGHT-DSBPAN_LEFT) - 0.5f;
@@ -1546,7 +2905,9 @@ static HRESULT WINAPI DSBuffer_SetPan(IDirectSoundBuffer8 *iface, LONG pan)
             alSourcefv(This->source, AL_POSITION, pos);
             checkALError();
             popALContext();
+            This->sent.pan = pan;
         }
+        LeaveCriticalSection(&This->crst);
     }
 
     return hr;
@@ -1571,16 +2932,37 @@ static HRESULT WINAPI DSBuffer_SetFrequency(IDirectSoundBuffer8 *iface, DWORD fr
         hr = DSERR_CONTROLUNAVAIL;
     else
     {
+        EnterCriticalSection(&This->share->crst);
+        EnterCriticalSection(&This->crst);
+        if(This->virt_idx)
+        {
+            /* Carry on from the current position at the new rate. */
+            DWORD64 now = get_time_us();
+            DWORD pos;
+            DSBuffer_GetVirtualPos(This, now, &pos);
+            This->virt_base = pos;
+            This->virt_start = now;
+        }
         This->current.frequency = freq ? freq : data->format.Format.nSamplesPerSec;
-        if(LIKELY(This->source))
+        if(LIKELY(This->source) &&
+           DSShare_CountUpdate(This->share, This->current.frequency != This->sent.frequency))
         {
             setALContext(This->ctx);
             alSourcef(This->source, AL_PITCH,
                 This->current.frequency / (ALfloat)data->format.Format.nSamplesPerSec
             );
             checkALError();
+            This->sent.frequency = This->current.frequency;
+            DSBuffer_UpdateResampler(This);
             popALContext();
         }
+        /* The queue drains and notifications come at a different rate now. */
+        if(This->segsize != 0 && !This->iscallback)
+            DSBuffer_UpdateStream(This, FALSE);
+        if(This->notify_item.idx)
+            DSPrimary_addnotify(This->primary, This);
+        LeaveCriticalSection(&This->crst);
+        LeaveCriticalSection(&This->share->crst);
     }
 
     return hr;
@@ -1593,11 +2975,36 @@ static HRESULT WINAPI DSBuffer_Stop(IDirectSoundBuffer8 *iface)
     TRACE("(%p)->()\n", iface);
 
     EnterCriticalSection(&This->share->crst);
-    if(LIKELY(This->source))
+    EnterCriticalSection(&This->crst);
+    if(This->virt_idx)
+    {
+        DWORD pos;
+
+        /* Catch up on notifications while it's still playing, then stop. */
+        if(This->notify_item.idx)
+        {
+            DSPrimary_addnotify(This->primary, This);
+            DSPrimary_triggernots(This->primary);
+        }
+        DSBuffer_GetVirtualPos(This, get_time_us(), &pos);
+        DSPrimary_removevirtual(This->primary, This);
+        This->lastpos = pos;
+        This->isplaying = FALSE;
+        DSBuffer_Group(This)->PlayingBuffers &= ~This->group_bit;
+        if(This->notify_item.idx)
+        {
+            DSPrimary_addnotify(This->primary, This);
+            DSPrimary_triggernots(This->primary);
+        }
+    }
+    else if(LIKELY(This->source))
     {
         const ALuint source = This->source;
         ALint state, ofs;
 
+        /* A buffer that hasn't started yet never will. */
+        DSPrimary_cancelplay(This->primary, This);
+        DSBuffer_DropRiders(This);
         setALContext(This->ctx);
         alSourcePause(source);
         alGetSourcei(source, AL_BYTE_OFFSET, &ofs);
@@ -1605,13 +3012,35 @@ static HRESULT WINAPI DSBuffer_Stop(IDirectSoundBuffer8 *iface)
         checkALError();
 
         This->isplaying = FALSE;
-        if(This->nnotify)
+        DSBuffer_Group(This)->PlayingBuffers &= ~This->group_bit;
+        DSBuffer_Group(This)->StreamBuffers &= ~This->group_bit;
+        if(This->notify_item.idx)
+        {
+            /* Checking notifications takes other buffers' locks, which can't
+             * be done with the context set.
+             */
+            popALContext();
+            DSPrimary_addnotify(This->primary, This);
             DSPrimary_triggernots(This->primary);
+            setALContext(This->ctx);
+        }
         /* Ensure the notification's last tracked position is updated, as well
          * as the queue offsets for streaming sources.
          */
         if(This->segsize == 0)
             This->lastpos = (state == AL_STOPPED) ? This->buffer->buf_size : ofs;
+        else if(This->iscallback)
+        {
+            DSData *data = This->buffer;
+
+            /* Carry on from what was played, not what the mixer read ahead. */
+            This->lastpos = DSBuffer_CallbackPos(This);
+            alSourceRewind(This->source);
+            alSourcei(This->source, AL_BUFFER, 0);
+            checkALError();
+
+            InterlockedExchange(&This->cb_offset, This->lastpos % data->buf_size);
+        }
         else
         {
             DSData *data = This->buffer;
@@ -1638,6 +3067,7 @@ static HRESULT WINAPI DSBuffer_Stop(IDirectSoundBuffer8 *iface)
         This->islooping = FALSE;
         popALContext();
     }
+    LeaveCriticalSection(&This->crst);
     LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
@@ -1677,20 +3107,31 @@ static HRESULT WINAPI DSBuffer_Unlock(IDirectSoundBuffer8 *iface, void *ptr1, DW
     if(!len1 && !len2)
         goto out;
 
-    if(HAS_EXTENSION(This->share, SOFTX_MAP_BUFFER))
+    if(buf->mirror_size)
     {
-        setALContext(This->ctx);
-        alFlushMappedBufferSOFT(buf->bid, 0, buf->buf_size);
-        checkALError();
-        popALContext();
+        DSData_UpdateMirror(buf, ofs1, len1);
+        DSData_UpdateMirror(buf, 0, len2);
     }
-    else if(This->segsize == 0)
+    if(buf->envelope.peaks)
+    {
+        DSData_UpdateEnvelope(buf, ofs1, len1);
+        DSData_UpdateEnvelope(buf, 0, len2);
+    }
+
+    if(This->segsize == 0 && !buf->data_static)
     {
+        EnterCriticalSection(&This->share->crst);
         setALContext(This->ctx);
-        alBufferData(buf->bid, buf->buf_format, buf->data, buf->buf_size,
-                     buf->format.Format.nSamplesPerSec);
-        checkALError();
+        This->share->locked_bytes += len1 + len2;
+        DSData_MarkDirty(buf, ofs1, len1);
+        DSData_MarkDirty(buf, 0, len2);
+        /* Writes to data that may be playing have to go out now. Otherwise,
+         * they can wait to be merged with later writes until it's played.
+         */
+        if(This->isplaying || buf->ref > 1)
+            DSData_FlushDirty(buf);
         popALContext();
+        LeaveCriticalSection(&This->share->crst);
     }
 
 out:
@@ -1811,12 +3252,13 @@ static HRESULT WINAPI DSBuffer_AcquireResources(IDirectSoundBuffer8 *iface, DWOR
     }
 
     EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     setALContext(This->ctx);
 
-    // Software buffers may need to be assigned a source now,
+    // Software buffers and duplicates may need to be assigned a source now,
     // since they weren't assigned one at initialization due to our Guild-Wars-specific hack.
     if (!(This->source) && This->isdeferredswbuffer){
-        WARN("Assigning a source for software buffer that was previously deferred as per Guild Wars hack (%p).", This);
+        TRACE("Assigning a deferred source for buffer %p\n", This);
         hr = DSERR_INVALIDPARAM;
         if((flags&(DSBPLAY_LOCSOFTWARE|DSBPLAY_LOCHARDWARE)) == (DSBPLAY_LOCSOFTWARE|DSBPLAY_LOCHARDWARE)){
             WARN("Both hardware and software specified\n");
@@ -1824,7 +3266,8 @@ static HRESULT WINAPI DSBuffer_AcquireResources(IDirectSoundBuffer8 *iface, DWOR
         }
         // (we don't need to check if it's already playing since it has no source to play it)
         DWORD loc = 0;
-        if((flags&DSBPLAY_LOCHARDWARE)) loc = DSBSTATUS_LOCHARDWARE;
+        if((flags&DSBPLAY_LOCHARDWARE) || (This->buffer->dsbflags&DSBCAPS_LOCHARDWARE))
+            loc = DSBSTATUS_LOCHARDWARE;
         else loc = DSBSTATUS_LOCSOFTWARE;
         hr = DSBuffer_SetLoc(This, loc);
         if(FAILED(hr)) goto out;
@@ -1872,6 +3315,7 @@ static HRESULT WINAPI DSBuffer_AcquireResources(IDirectSoundBuffer8 *iface, DWOR
 
 out:
     popALContext();
+    LeaveCriticalSection(&This->crst);
     LeaveCriticalSection(&This->share->crst);
     return hr;
 }
@@ -1911,10 +3355,127 @@ static IDirectSoundBuffer8Vtbl DSBuffer_Vtbl = {
 };
 
 
+/* Brings the source's rolloff factor up to date, if the listener's changed
+ * since it was last set. Should be called with the device lock held.
+ */
+void DSBuffer_UpdateRolloff(DSBuffer *buf)
+{
+    const DSPrimary *prim = buf->primary;
+
+    if(buf->rolloff_epoch == prim->rolloff_epoch)
+        return;
+    if(buf->source && (buf->buffer->dsbflags&DSBCAPS_CTRL3D))
+    {
+        setALContext(buf->ctx);
+        alSourcef(buf->source, AL_ROLLOFF_FACTOR, prim->current.ds3d.flRolloffFactor);
+        checkALError();
+        popALContext();
+        buf->rolloff_epoch = prim->rolloff_epoch;
+    }
+}
+
+/* Level at the listener, in millibels, below which a voice's resampling
+ * artifacts are masked by louder voices, for each resampler policy.
+ */
+static const LONG ResamplerQuietLevel[] = { 0, -4000, -2000 };
+
+/* Picks the resampler for the buffer's source. */
+static ALint DSBuffer_PickResampler(const DSBuffer *buf)
+{
+    const DeviceShare *share = buf->share;
+    const DS3DBUFFER *params = &buf->current.ds3d;
+    const DS3DLISTENER *listener = &buf->primary->current.ds3d;
+    ALint best = share->default_resampler;
+    ALint cheap = share->linear_resampler;
+    DWORD freq = buf->current.frequency;
+    BOOL shifted = FALSE;
+
+    if((buf->buffer->dsbflags&DSBCAPS_CTRL3D) && params->dwMode != DS3DMODE_DISABLE &&
+       listener->flDopplerFactor > 0.0f)
+    {
+        /* Doppler moves the rate of moving voices off what was asked. */
+        shifted = params->vVelocity.x != 0.0f || params->vVelocity.y != 0.0f ||
+                  params->vVelocity.z != 0.0f;
+        if(params->dwMode == DS3DMODE_NORMAL)
+            shifted |= listener->vVelocity.x != 0.0f || listener->vVelocity.y != 0.0f ||
+                       listener->vVelocity.z != 0.0f;
+    }
+
+    /* At the device rate, point sampling loses nothing. */
+    if(freq == (DWORD)share->frequency && !shifted)
+        return share->point_resampler;
+    if(DSBuffer_EstimateGain(buf) < mB_to_gain((float)ResamplerQuietLevel[ResamplerPolicy]))
+        return cheap;
+    /* Upsampling doesn't alias, so linear sampling is fine for voices that
+     * aren't important.
+     */
+    if(ResamplerPolicy == RESAMPLER_POLICY_PERFORMANCE && buf->play_prio == 0 &&
+       freq <= (DWORD)share->frequency)
+        return cheap;
+    return best;
+}
+
+/* Sends the resampler the policy picks for the buffer's source, if it
+ * differs from the source's. Should be called with the buffer lock held and
+ * the context set.
+ */
+void DSBuffer_UpdateResampler(DSBuffer *buf)
+{
+    ALint resampler;
+
+    if(!ResamplerPolicy || !buf->source || !HAS_EXTENSION(buf->share, SOFT_SOURCE_RESAMPLER))
+        return;
+
+    resampler = DSBuffer_PickResampler(buf);
+    if(DSShare_CountUpdate(buf->share, resampler != buf->src_resampler))
+    {
+        alSourcei(buf->source, AL_SOURCE_RESAMPLER_SOFT, resampler);
+        checkALError();
+        buf->src_resampler = resampler;
+    }
+}
+
+/* Adds the buffer to the primary's dirty list, if it isn't already. Should be
+ * called with the device lock held.
+ */
+static void DSBuffer_MarkDirty(DSBuffer *buf)
+{
+    DSPrimary *prim = buf->primary;
+    if(!buf->dirty_idx)
+    {
+        prim->dirtybufs[prim->ndirtybufs++] = buf;
+        buf->dirty_idx = prim->ndirtybufs;
+    }
+}
+
 void DSBuffer_SetParams(DSBuffer *This, const DS3DBUFFER *params, LONG flags)
 {
     const ALuint source = This->source;
+    const DS3DBUFFER *cur = &This->current.ds3d;
     union BufferParamFlags dirty = { flags };
+    union BufferParamFlags send = { flags };
+
+    /* The source has the current parameters, except for position and
+     * velocity which may have last been sent within the tolerance. Drop
+     * updates that won't change anything.
+     */
+    if(send.bit.pos && !vector_changed(&This->sent.pos, &params->vPosition, PositionTolerance))
+        send.bit.pos = 0;
+    if(send.bit.vel && !vector_changed(&This->sent.vel, &params->vVelocity, 0.0f))
+        send.bit.vel = 0;
+    if(send.bit.cone_angles && cur->dwInsideConeAngle == params->dwInsideConeAngle &&
+       cur->dwOutsideConeAngle == params->dwOutsideConeAngle)
+        send.bit.cone_angles = 0;
+    if(send.bit.cone_orient && !vector_changed(&cur->vConeOrientation, &params->vConeOrientation, 0.0f))
+        send.bit.cone_orient = 0;
+    if(send.bit.cone_outsidevolume && cur->lConeOutsideVolume == params->lConeOutsideVolume)
+        send.bit.cone_outsidevolume = 0;
+    if(send.bit.min_distance && cur->flMinDistance == params->flMinDistance)
+        send.bit.min_distance = 0;
+    if(send.bit.max_distance && cur->flMaxDistance == params->flMaxDistance)
+        send.bit.max_distance = 0;
+    if(send.bit.mode && cur->dwMode == params->dwMode)
+        send.bit.mode = 0;
 
     /* Copy deferred parameters first. */
     if(dirty.bit.pos)
@@ -1940,28 +3501,37 @@ void DSBuffer_SetParams(DSBuffer *This, const DS3DBUFFER *params, LONG flags)
     /* Now apply what's changed to OpenAL. */
     if(UNLIKELY(!source)) return;
 
-    if(dirty.bit.pos)
+    DSShare_CountUpdates(This->share, POPCNT64((DWORD)send.flags),
+                         POPCNT64((DWORD)(dirty.flags & ~send.flags)));
+
+    if(send.bit.pos)
+    {
         alSource3f(source, AL_POSITION, params->vPosition.x, params->vPosition.y,
                                        -params->vPosition.z);
-    if(dirty.bit.vel)
+        This->sent.pos = params->vPosition;
+    }
+    if(send.bit.vel)
+    {
         alSource3f(source, AL_VELOCITY, params->vVelocity.x, params->vVelocity.y,
                                        -params->vVelocity.z);
-    if(dirty.bit.cone_angles)
+        This->sent.vel = params->vVelocity;
+    }
+    if(send.bit.cone_angles)
     {
         alSourcei(source, AL_CONE_INNER_ANGLE, params->dwInsideConeAngle);
         alSourcei(source, AL_CONE_OUTER_ANGLE, params->dwOutsideConeAngle);
     }
-    if(dirty.bit.cone_orient)
+    if(send.bit.cone_orient)
         alSource3f(source, AL_DIRECTION, params->vConeOrientation.x,
                                          params->vConeOrientation.y,
                                         -params->vConeOrientation.z);
-    if(dirty.bit.cone_outsidevolume)
+    if(send.bit.cone_outsidevolume)
         alSourcef(source, AL_CONE_OUTER_GAIN, mB_to_gain((float)params->lConeOutsideVolume));
-    if(dirty.bit.min_distance)
+    if(send.bit.min_distance)
         alSourcef(source, AL_REFERENCE_DISTANCE, params->flMinDistance);
-    if(dirty.bit.max_distance)
+    if(send.bit.max_distance)
         alSourcef(source, AL_MAX_DISTANCE, params->flMaxDistance);
-    if(dirty.bit.mode)
+    if(send.bit.mode)
     {
         if(HAS_EXTENSION(This->share, SOFT_SOURCE_SPATIALIZE))
             alSourcei(source, AL_SOURCE_SPATIALIZE_SOFT,
@@ -2016,10 +3586,10 @@ static HRESULT WINAPI DSBuffer3D_GetConeAngles(IDirectSound3DBuffer *iface, DWOR
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     *pdwInsideConeAngle = This->current.ds3d.dwInsideConeAngle;
     *pdwOutsideConeAngle = This->current.ds3d.dwOutsideConeAngle;
-    LeaveCriticalSection(&This->share->crst);
+    LeaveCriticalSection(&This->crst);
 
     return S_OK;
 }
@@ -2035,9 +3605,9 @@ static HRESULT WINAPI DSBuffer3D_GetConeOrientation(IDirectSound3DBuffer *iface,
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     *orient = This->current.ds3d.vConeOrientation;
-    LeaveCriticalSection(&This->share->crst);
+    LeaveCriticalSection(&This->crst);
 
     return S_OK;
 }
@@ -2113,9 +3683,9 @@ static HRESULT WINAPI DSBuffer3D_GetPosition(IDirectSound3DBuffer *iface, D3DVEC
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     *pos = This->current.ds3d.vPosition;
-    LeaveCriticalSection(&This->share->crst);
+    LeaveCriticalSection(&This->crst);
 
     return S_OK;
 }
@@ -2131,9 +3701,9 @@ static HRESULT WINAPI DSBuffer3D_GetVelocity(IDirectSound3DBuffer *iface, D3DVEC
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     *vel = This->current.ds3d.vVelocity;
-    LeaveCriticalSection(&This->share->crst);
+    LeaveCriticalSection(&This->crst);
 
     return S_OK;
 }
@@ -2150,7 +3720,7 @@ static HRESULT WINAPI DSBuffer3D_GetAllParameters(IDirectSound3DBuffer *iface, D
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
+    EnterCriticalSection(&This->crst);
     ds3dbuffer->vPosition = This->current.ds3d.vPosition;
     ds3dbuffer->vVelocity = This->current.ds3d.vVelocity;
     ds3dbuffer->dwInsideConeAngle = This->current.ds3d.dwInsideConeAngle;
@@ -2160,7 +3730,7 @@ static HRESULT WINAPI DSBuffer3D_GetAllParameters(IDirectSound3DBuffer *iface, D
     ds3dbuffer->flMinDistance = This->current.ds3d.flMinDistance;
     ds3dbuffer->flMaxDistance = This->current.ds3d.flMaxDistance;
     ds3dbuffer->dwMode = This->current.ds3d.dwMode;
-    LeaveCriticalSection(&This->share->crst);
+    LeaveCriticalSection(&This->crst);
 
     return DS_OK;
 }
@@ -2176,27 +3746,31 @@ static HRESULT WINAPI DSBuffer3D_SetConeAngles(IDirectSound3DBuffer *iface, DWOR
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.dwInsideConeAngle = dwInsideConeAngle;
         This->deferred.ds3d.dwOutsideConeAngle = dwOutsideConeAngle;
         This->dirty.bit.cone_angles = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.dwInsideConeAngle = dwInsideConeAngle;
+        params.dwOutsideConeAngle = dwOutsideConeAngle;
+        dirty.bit.cone_angles = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.dwInsideConeAngle = dwInsideConeAngle;
-        This->current.ds3d.dwOutsideConeAngle = dwOutsideConeAngle;
-        if(LIKELY(This->source))
-        {
-            alSourcei(This->source, AL_CONE_INNER_ANGLE, dwInsideConeAngle);
-            alSourcei(This->source, AL_CONE_OUTER_ANGLE, dwOutsideConeAngle);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2207,28 +3781,33 @@ static HRESULT WINAPI DSBuffer3D_SetConeOrientation(IDirectSound3DBuffer *iface,
 
     TRACE("(%p)->(%f, %f, %f, %lu)\n", This, x, y, z, apply);
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.vConeOrientation.x = x;
         This->deferred.ds3d.vConeOrientation.y = y;
         This->deferred.ds3d.vConeOrientation.z = z;
         This->dirty.bit.cone_orient = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.vConeOrientation.x = x;
+        params.vConeOrientation.y = y;
+        params.vConeOrientation.z = z;
+        dirty.bit.cone_orient = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.vConeOrientation.x = x;
-        This->current.ds3d.vConeOrientation.y = y;
-        This->current.ds3d.vConeOrientation.z = z;
-        if(LIKELY(This->source))
-        {
-            alSource3f(This->source, AL_DIRECTION, x, y, -z);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2244,24 +3823,29 @@ static HRESULT WINAPI DSBuffer3D_SetConeOutsideVolume(IDirectSound3DBuffer *ifac
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.lConeOutsideVolume = vol;
         This->dirty.bit.cone_outsidevolume = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.lConeOutsideVolume = vol;
+        dirty.bit.cone_outsidevolume = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.lConeOutsideVolume = vol;
-        if(LIKELY(This->source))
-        {
-            alSourcef(This->source, AL_CONE_OUTER_GAIN, mB_to_gain((float)vol));
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2277,24 +3861,29 @@ static HRESULT WINAPI DSBuffer3D_SetMaxDistance(IDirectSound3DBuffer *iface, D3D
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.flMaxDistance = maxdist;
         This->dirty.bit.max_distance = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.flMaxDistance = maxdist;
+        dirty.bit.max_distance = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.flMaxDistance = maxdist;
-        if(LIKELY(This->source))
-        {
-            alSourcef(This->source, AL_MAX_DISTANCE, maxdist);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2310,24 +3899,29 @@ static HRESULT WINAPI DSBuffer3D_SetMinDistance(IDirectSound3DBuffer *iface, D3D
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.flMinDistance = mindist;
         This->dirty.bit.min_distance = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.flMinDistance = mindist;
+        dirty.bit.min_distance = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.flMinDistance = mindist;
-        if(LIKELY(This->source))
-        {
-            alSourcef(This->source, AL_REFERENCE_DISTANCE, mindist);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2344,28 +3938,29 @@ static HRESULT WINAPI DSBuffer3D_SetMode(IDirectSound3DBuffer *iface, DWORD mode
         return DSERR_INVALIDPARAM;
     }
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.dwMode = mode;
         This->dirty.bit.mode = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.dwMode = mode;
+        dirty.bit.mode = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.dwMode = mode;
-        if(LIKELY(This->source))
-        {
-            if(HAS_EXTENSION(This->share, SOFT_SOURCE_SPATIALIZE))
-                alSourcei(This->source, AL_SOURCE_SPATIALIZE_SOFT,
-                          (mode==DS3DMODE_DISABLE) ? AL_FALSE : AL_TRUE);
-            alSourcei(This->source, AL_SOURCE_RELATIVE,
-                      (mode != DS3DMODE_NORMAL) ? AL_TRUE : AL_FALSE);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2376,28 +3971,33 @@ static HRESULT WINAPI DSBuffer3D_SetPosition(IDirectSound3DBuffer *iface, D3DVAL
 
     TRACE("(%p)->(%f, %f, %f, %lu)\n", This, x, y, z, apply);
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.vPosition.x = x;
         This->deferred.ds3d.vPosition.y = y;
         This->deferred.ds3d.vPosition.z = z;
         This->dirty.bit.pos = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.vPosition.x = x;
+        params.vPosition.y = y;
+        params.vPosition.z = z;
+        dirty.bit.pos = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.vPosition.x = x;
-        This->current.ds3d.vPosition.y = y;
-        This->current.ds3d.vPosition.z = z;
-        if(LIKELY(This->source))
-        {
-            alSource3f(This->source, AL_POSITION, x, y, -z);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2408,28 +4008,33 @@ static HRESULT WINAPI DSBuffer3D_SetVelocity(IDirectSound3DBuffer *iface, D3DVAL
 
     TRACE("(%p)->(%f, %f, %f, %lu)\n", This, x, y, z, apply);
 
-    EnterCriticalSection(&This->share->crst);
     if(apply == DS3D_DEFERRED)
     {
+        EnterCriticalSection(&This->share->crst);
         This->deferred.ds3d.vVelocity.x = x;
         This->deferred.ds3d.vVelocity.y = y;
         This->deferred.ds3d.vVelocity.z = z;
         This->dirty.bit.vel = 1;
+        DSBuffer_MarkDirty(This);
+        LeaveCriticalSection(&This->share->crst);
     }
     else
     {
+        union BufferParamFlags dirty = { 0 };
+        DS3DBUFFER params;
+
+        params.vVelocity.x = x;
+        params.vVelocity.y = y;
+        params.vVelocity.z = z;
+        dirty.bit.vel = 1;
+
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
-        This->current.ds3d.vVelocity.x = x;
-        This->current.ds3d.vVelocity.y = y;
-        This->current.ds3d.vVelocity.z = z;
-        if(LIKELY(This->source))
-        {
-            alSource3f(This->source, AL_VELOCITY, x, y, -z);
-            checkALError();
-        }
+        DSBuffer_SetParams(This, &params, dirty.flags);
+        checkALError();
         popALContext();
+        LeaveCriticalSection(&This->crst);
     }
-    LeaveCriticalSection(&This->share->crst);
 
     return S_OK;
 }
@@ -2493,6 +4098,7 @@ static HRESULT WINAPI DSBuffer3D_SetAllParameters(IDirectSound3DBuffer *iface, c
         This->dirty.bit.min_distance = 1;
         This->dirty.bit.max_distance = 1;
         This->dirty.bit.mode = 1;
+        DSBuffer_MarkDirty(This);
         LeaveCriticalSection(&This->share->crst);
     }
     else
@@ -2507,12 +4113,12 @@ static HRESULT WINAPI DSBuffer3D_SetAllParameters(IDirectSound3DBuffer *iface, c
         dirty.bit.max_distance = 1;
         dirty.bit.mode = 1;
 
-        EnterCriticalSection(&This->share->crst);
+        EnterCriticalSection(&This->crst);
         setALContext(This->ctx);
         DSBuffer_SetParams(This, ds3dbuffer, dirty.flags);
         checkALError();
         popALContext();
-        LeaveCriticalSection(&This->share->crst);
+        LeaveCriticalSection(&This->crst);
     }
 
     return S_OK;
@@ -2576,6 +4182,13 @@ static ULONG WINAPI DSBufferNot_Release(IDirectSoundNotify *iface)
     return ret;
 }
 
+static int notify_cmp(const void *a, const void *b)
+{
+    DWORD ofs1 = ((const DSBPOSITIONNOTIFY*)a)->dwOffset;
+    DWORD ofs2 = ((const DSBPOSITIONNOTIFY*)b)->dwOffset;
+    return (ofs1 > ofs2) - (ofs1 < ofs2);
+}
+
 static HRESULT WINAPI DSBufferNot_SetNotificationPositions(IDirectSoundNotify *iface, DWORD count, const DSBPOSITIONNOTIFY *notifications)
 {
     DSBuffer *This = impl_from_IDirectSoundNotify(iface);
@@ -2602,6 +4215,7 @@ static HRESULT WINAPI DSBufferNot_SetNotificationPositions(IDirectSoundNotify *i
         HeapFree(GetProcessHeap(), 0, This->notify);
         This->notify = 0;
         This->nnotify = 0;
+        This->nposnotify = 0;
         hr = S_OK;
     }
     else
@@ -2620,10 +4234,18 @@ static HRESULT WINAPI DSBufferNot_SetNotificationPositions(IDirectSoundNotify *i
         nots = HeapAlloc(GetProcessHeap(), 0, count*sizeof(*nots));
         if(!nots) goto out;
         memcpy(nots, notifications, count*sizeof(*nots));
+        /* DSBPN_OFFSETSTOP is the largest offset, so stop notifications sort
+         * to the end.
+         */
+        qsort(nots, count, sizeof(*nots), notify_cmp);
 
         HeapFree(GetProcessHeap(), 0, This->notify);
         This->notify = nots;
         This->nnotify = count;
+        This->nposnotify = count;
+        while(This->nposnotify > 0 &&
+              nots[This->nposnotify-1].dwOffset == (DWORD)DSBPN_OFFSETSTOP)
+            This->nposnotify--;
 
         hr = S_OK;
     }
@@ -2697,6 +4319,108 @@ static ULONG WINAPI DSBufferProp_Release(IKsPropertySet *iface)
     return ret;
 }
 
+/* Handles a get of OpenAL's EAX properties, answering from the values the
+ * app set when they're known. Should be called with the device lock held.
+ */
+HRESULT DSBuffer_GetEAX(DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                        void *pPropData, ULONG cbPropData, ULONG *pcbReturned)
+{
+    BOOL is_source = (set->flags&PROPSET_SOURCE) != 0;
+    HRESULT hr;
+    ALenum err;
+
+    (void)pcbReturned;
+    if(EAXMirror_Get(is_source ? &buf->eax : &buf->primary->eax, set->guid, propid,
+                     pPropData, cbPropData))
+    {
+        buf->share->eax_served++;
+        hr = DS_OK;
+    }
+    else
+    {
+        /* Return the values the app last set. */
+        DSPrimary_flusheax(buf->primary, 0);
+        err = EAXGet(set->guid, propid, buf->source, pPropData, cbPropData);
+        if(err != AL_NO_ERROR) hr = E_FAIL;
+        else hr = DS_OK;
+    }
+    return hr;
+}
+
+/* Handles a set of OpenAL's EAX properties, keeping the value for the buffer
+ * or listener. Should be called with the device lock held.
+ */
+HRESULT DSBuffer_SetEAX(DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                        void *pPropData, ULONG cbPropData)
+{
+    DSPrimary *prim = buf->primary;
+    BOOL immediate = !(propid&0x80000000ul);
+    BOOL is_source = (set->flags&PROPSET_SOURCE) != 0;
+    struct EAXMirror *mirror = is_source ? &buf->eax : &prim->eax;
+    HRESULT hr;
+    ALenum err;
+
+    /* The source won't have the defaults anymore when it's returned. */
+    if(is_source)
+        buf->src_eax_default = FALSE;
+
+    if(!EAXMirror_Set(mirror, set->guid, propid, pPropData, cbPropData))
+    {
+        buf->share->eax_unchanged++;
+        hr = DS_OK;
+    }
+    /* A buffer without a source gets its properties when it has one. */
+    else if(is_source && !buf->source)
+        hr = DS_OK;
+    /* Immediate sets wait for the next update, so repeated sets of a
+     * property in between only apply the last value.
+     */
+    else if(immediate && DSPrimary_queueeax(prim, is_source ? buf : NULL, set->guid,
+                                            propid, pPropData, cbPropData))
+        hr = DS_OK;
+    else
+    {
+        /* Anything still pending was set before this. */
+        DSPrimary_flusheax(prim, 0);
+
+        setALContext(prim->ctx);
+        if(!immediate)
+            err = EAXSet(set->guid, propid, buf->source, pPropData, cbPropData);
+        else if(is_source)
+        {
+            /* Apply just this source's EAX state, leaving other buffers'
+             * deferred changes for the next commit.
+             */
+            alDeferUpdatesSOFT();
+            err = EAXSet(set->guid, propid|0x80000000ul, buf->source, pPropData,
+                         cbPropData);
+            if(err == AL_NO_ERROR)
+                err = EAXSet(&DSPROPSETID_EAX20_BufferProperties,
+                             DSPROPERTY_EAX20BUFFER_COMMITDEFERREDSETTINGS, buf->source,
+                             NULL, 0);
+            alProcessUpdatesSOFT();
+        }
+        else
+        {
+            /* Listener, context and effect slot properties are shared, so
+             * let EAX apply them as it would any immediate set.
+             */
+            alDeferUpdatesSOFT();
+            err = EAXSet(set->guid, propid, buf->source, pPropData, cbPropData);
+            alProcessUpdatesSOFT();
+        }
+        if(err == AL_NO_ERROR) hr = DS_OK;
+        else
+        {
+            EAXMirror_Forget(mirror, set->guid, propid);
+            hr = E_FAIL;
+        }
+        checkALError();
+        popALContext();
+    }
+    return hr;
+}
+
 /* NOTE: Due to some apparent quirks in DSound, the listener properties are
          handled through secondary buffers. */
 static HRESULT WINAPI DSBufferProp_Get(IKsPropertySet *iface,
@@ -2706,8 +4430,8 @@ static HRESULT WINAPI DSBufferProp_Get(IKsPropertySet *iface,
   ULONG *pcbReturned)
 {
     DSBuffer *This = impl_from_IKsPropertySet(iface);
+    const struct PropSetInfo *set = PropSet_Find(guidPropSet);
     HRESULT hr = E_PROP_ID_UNSUPPORTED;
-    ALenum err;
 
     TRACE("(%p)->(%s, 0x%lx, %p, %lu, %p, %lu, %p)\n", iface, debug_bufferprop(guidPropSet),
           dwPropID, pInstanceData, cbInstanceData, pPropData, cbPropData, pcbReturned);
@@ -2722,28 +4446,19 @@ static HRESULT WINAPI DSBufferProp_Get(IKsPropertySet *iface,
         return E_POINTER;
     }
 
-    EnterCriticalSection(&This->share->crst);
-    if(IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Source)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_BufferProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_BufferProperties)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot0)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot1)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot2)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot3)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_ListenerProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_ListenerProperties)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Context)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_BufferProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_ListenerProperties))
-    {
-        err = EAXGet(guidPropSet, dwPropID, This->source, pPropData, cbPropData);
-        if(err != AL_NO_ERROR) hr = E_FAIL;
-        else hr = DS_OK;
-    }
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_VoiceManager))
-        hr = VoiceMan_Get(This, dwPropID, pPropData, cbPropData, pcbReturned);
-    else
+    if(!set || !set->get)
+    {
         FIXME("Unhandled propset: %s\n", debug_bufferprop(guidPropSet));
+        return hr;
+    }
+    if(!PropSet_CheckSize(set, dwPropID, cbPropData))
+    {
+        WARN("Property 0x%lx size %lu too small\n", dwPropID, cbPropData);
+        return DSERR_INVALIDPARAM;
+    }
+
+    EnterCriticalSection(&This->share->crst);
+    hr = set->get(This, set, dwPropID, pPropData, cbPropData, pcbReturned);
     LeaveCriticalSection(&This->share->crst);
 
     return hr;
@@ -2755,6 +4470,7 @@ static HRESULT WINAPI DSBufferProp_Set(IKsPropertySet *iface,
   LPVOID pPropData, ULONG cbPropData)
 {
     DSBuffer *This = impl_from_IKsPropertySet(iface);
+    const struct PropSetInfo *set = PropSet_Find(guidPropSet);
     HRESULT hr = E_PROP_ID_UNSUPPORTED;
 
     TRACE("(%p)->(%s, 0x%lx, %p, %lu, %p, %lu)\n", iface, debug_bufferprop(guidPropSet),
@@ -2766,38 +4482,19 @@ static HRESULT WINAPI DSBufferProp_Set(IKsPropertySet *iface,
         return E_POINTER;
     }
 
-    EnterCriticalSection(&This->share->crst);
-    if(IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Source)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_BufferProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_BufferProperties)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot0)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot1)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot2)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot3)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_ListenerProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_ListenerProperties)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Context)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_BufferProperties)
-        || IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_ListenerProperties))
+    if(!set || !set->set)
     {
-        DSPrimary *prim = This->primary;
-        BOOL immediate = !(dwPropID&0x80000000ul);
-        ALenum err;
-
-        setALContext(prim->ctx);
-        err = EAXSet(guidPropSet, dwPropID|0x80000000ul, This->source, pPropData, cbPropData);
-        if(err != AL_NO_ERROR) hr = E_FAIL;
-        else hr = DS_OK;
-        if(hr == DS_OK && immediate)
-            DSPrimary3D_CommitDeferredSettings(&prim->IDirectSound3DListener_iface);
-        popALContext();
+        FIXME("Unhandled propset: %s\n", debug_bufferprop(guidPropSet));
+        return hr;
     }
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_VoiceManager))
+    if(!PropSet_CheckSize(set, dwPropID, cbPropData))
     {
-        hr = VoiceMan_Set(This, dwPropID, pPropData, cbPropData);
+        WARN("Property 0x%lx size %lu too small\n", dwPropID, cbPropData);
+        return DSERR_INVALIDPARAM;
     }
-    else
-        FIXME("Unhandled propset: %s\n", debug_bufferprop(guidPropSet));
+
+    EnterCriticalSection(&This->share->crst);
+    hr = set->set(This, set, dwPropID, pPropData, cbPropData);
     LeaveCriticalSection(&This->share->crst);
 
     return hr;
@@ -2808,6 +4505,7 @@ static HRESULT WINAPI DSBufferProp_QuerySupport(IKsPropertySet *iface,
   ULONG *pTypeSupport)
 {
     DSBuffer *This = impl_from_IKsPropertySet(iface);
+    const struct PropSetInfo *set = PropSet_Find(guidPropSet);
     HRESULT hr = E_PROP_ID_UNSUPPORTED;
 
     TRACE("(%p)->(%s, 0x%lx, %p)\n", iface, debug_bufferprop(guidPropSet), dwPropID,
@@ -2818,29 +4516,10 @@ static HRESULT WINAPI DSBufferProp_QuerySupport(IKsPropertySet *iface,
     *pTypeSupport = 0;
 
     EnterCriticalSection(&This->share->crst);
-    if(IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Source))
-        hr = EAX4Source_Query(This, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_BufferProperties))
-        hr = EAX3Buffer_Query(This, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_BufferProperties))
-        hr = EAX2Buffer_Query(This, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot0)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot1)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot2)
-        || IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_FXSlot3))
-        hr = EAX4Slot_Query(This->primary, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX30_ListenerProperties))
-        hr = EAX3_Query(This->primary, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX20_ListenerProperties))
-        hr = EAX2_Query(This->primary, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &EAXPROPERTYID_EAX40_Context))
-        hr = EAX4Context_Query(This->primary, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_ListenerProperties))
-        hr = EAX1_Query(This->primary, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_EAX10_BufferProperties))
-        hr = EAX1Buffer_Query(This, dwPropID, pTypeSupport);
-    else if(IsEqualIID(guidPropSet, &DSPROPSETID_VoiceManager))
-        hr = VoiceMan_Query(This, dwPropID, pTypeSupport);
+    if(set && set->buffer_query)
+        hr = set->buffer_query(This, dwPropID, pTypeSupport);
+    else if(set && set->primary_query)
+        hr = set->primary_query(This->primary, dwPropID, pTypeSupport);
     else
         FIXME("Unhandled propset: %s (propid: %lu)\n", debug_bufferprop(guidPropSet), dwPropID);
     LeaveCriticalSection(&This->share->crst);
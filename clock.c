@@ -0,0 +1,60 @@
+/* DirectSound update clock
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Nothing here calls into Windows or OpenAL, so the update thread's timing
+ * can be tested on its own.
+ */
+
+#include "clock.h"
+
+
+/* Refines the estimated performance counter time of device clock 0 with a
+ * clock reading taken at 'now'. The mix that produced a reading happened no
+ * later than when it was read, so the smallest difference seen is the best
+ * estimate. It's allowed to creep up slowly to follow drift between the
+ * clocks. Ticks normally read the clock just before a mix, so the creep also
+ * lands one just after a mix every so often, which measures it again.
+ */
+LONGLONG Clock_UpdateOffset(LONGLONG offset, BOOL valid, DWORD64 clock, DWORD64 now)
+{
+    LONGLONG diff = (LONGLONG)now - (LONGLONG)clock;
+    if(!valid || diff < offset + CLOCK_DRIFT_US)
+        return diff;
+    return offset + CLOCK_DRIFT_US;
+}
+
+/* Returns the performance counter time, in microseconds, to wake up for the
+ * next tick, just ahead of the first mix that hasn't started by 'now'.
+ */
+DWORD64 Clock_AlignedTick(DWORD64 now, DWORD64 clock, LONGLONG offset, DWORD64 period)
+{
+    DWORD64 target = (DWORD64)((LONGLONG)clock + offset) + period - TICK_LEAD_US;
+    if(target <= now)
+        target += ((now-target)/period + 1) * period;
+    return target;
+}
+
+/* Updates a tick jitter estimate with how late a tick arrived, in
+ * milliseconds. Increases are taken immediately, and decreases decay slowly
+ * so streams keep some headroom.
+ */
+DWORD Clock_UpdateJitter(DWORD jitter, DWORD late)
+{
+    if(late > jitter)
+        return late;
+    return jitter - (jitter-late+15) / 16;
+}
@@ -0,0 +1,33 @@
+/* DirectSound update clock
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef DSOAL_CLOCK_H
+#define DSOAL_CLOCK_H
+
+#include <windows.h>
+
+/* How far ahead of the next mix a clock-aligned tick is scheduled, and how
+ * much the clock offset estimate may drift per tick, in microseconds.
+ */
+#define TICK_LEAD_US 2000
+#define CLOCK_DRIFT_US 20
+
+LONGLONG Clock_UpdateOffset(LONGLONG offset, BOOL valid, DWORD64 clock, DWORD64 now);
+DWORD64 Clock_AlignedTick(DWORD64 now, DWORD64 clock, LONGLONG offset, DWORD64 period);
+DWORD Clock_UpdateJitter(DWORD jitter, DWORD late);
+
+#endif /* DSOAL_CLOCK_H */
@@ -30,6 +30,7 @@
 #include <ksmedia.h>
 
 #include "dsound_private.h"
+#include "clock.h"
 
 #ifndef DSSPEAKER_7POINT1
 #define DSSPEAKER_7POINT1       7
@@ -40,25 +41,81 @@ static DWORD CALLBACK DSShare_thread(void *dwUser)
 {
     DeviceShare *share = (DeviceShare*)dwUser;
     BYTE *scratch_mem = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, 2048);
+    DWORD64 now, last = 0, target = 0;
+    DWORD64 period = 1000000 / share->refresh;
+    BOOL synced = FALSE;
+    DWORD wait = INFINITE;
+    DWORD ret;
     ALsizei i;
 
     SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
 
     TRACE("Shared device (%p) message loop start\n", share);
-    while(WaitForSingleObject(share->timer_evt, INFINITE) == WAIT_OBJECT_0 && !share->quit_now)
+    while(((ret=WaitForSingleObject(share->timer_evt, wait)) == WAIT_OBJECT_0 ||
+           ret == WAIT_TIMEOUT) && !share->quit_now)
     {
-        EnterCriticalSection(&share->crst);
-        setALContext(share->ctx);
+        now = get_time_us();
+        if(share->clock_aligned)
+        {
+            ALCint64SOFT values[2];
+
+            if(target)
+            {
+                DWORD64 late = (now > target) ? now-target : 0;
+                share->tick_jitter = Clock_UpdateJitter(share->tick_jitter,
+                                                        (DWORD)(late/1000));
+                /* Woke after the mix this tick was meant to precede. */
+                if(late > TICK_LEAD_US)
+                    share->tick_overruns++;
+            }
+
+            alcGetInteger64vSOFT(share->device, ALC_DEVICE_CLOCK_LATENCY_SOFT, 2, values);
+            now = get_time_us();
+            share->clock_offset = Clock_UpdateOffset(share->clock_offset, synced,
+                                                     values[0]/1000, now);
+            share->device_latency = values[1]/1000;
+            synced = TRUE;
+        }
+        else
+        {
+            if(last)
+            {
+                DWORD elapsed = (DWORD)((now-last) / 1000);
+                share->tick_jitter = Clock_UpdateJitter(share->tick_jitter,
+                    (elapsed > share->tick_period) ? elapsed-share->tick_period : 0);
+            }
+            last = now;
+        }
+        share->tick_count++;
 
+        /* The device lock is only taken per buffer, with tick_crst keeping
+         * the primaries around in between.
+         */
+        EnterCriticalSection(&share->tick_crst);
         for(i = 0;i < share->nprimaries;++i)
         {
+            EnterCriticalSection(&share->crst);
+            DSPrimary_flusheax(share->primaries[i], EAXUpdateBudget);
+            DSPrimary_updatevirtual(share->primaries[i]);
+            DSPrimary_flushplays(share->primaries[i]);
+            LeaveCriticalSection(&share->crst);
+
             DSPrimary_triggernots(share->primaries[i]);
             if(!HAS_EXTENSION(share, SOFTX_MAP_BUFFER))
                 DSPrimary_streamfeeder(share->primaries[i], scratch_mem);
         }
+        LeaveCriticalSection(&share->tick_crst);
 
-        popALContext();
-        LeaveCriticalSection(&share->crst);
+        if(share->clock_aligned)
+        {
+            ALCint64SOFT clock;
+
+            alcGetInteger64vSOFT(share->device, ALC_DEVICE_CLOCK_SOFT, 1, &clock);
+            now = get_time_us();
+            target = Clock_AlignedTick(now, clock/1000, share->clock_offset, period);
+            /* Round up, the lead covers the difference. */
+            wait = (DWORD)((target-now+999) / 1000);
+        }
     }
     TRACE("Shared device (%p) message loop quit\n", share);
 
@@ -84,10 +141,25 @@ static void DSShare_starttimer(DeviceShare *share)
 {
     DWORD triggertime;
 
-    if(share->queue_timer)
+    if(share->queue_timer || share->clock_aligned)
         return;
 
-    triggertime = 1000 / share->refresh * 2 / 3;
+    if(HAS_EXTENSION(share, SOFT_DEVICE_CLOCK) && alcGetInteger64vSOFT)
+    {
+        /* The thread schedules itself from the device clock, so it only
+         * needs a kick to start.
+         */
+        share->tick_period = maxI(1000 / share->refresh, 1);
+        share->clock_aligned = TRUE;
+        TRACE("Aligning updates to the device clock for %d refreshes per second\n",
+              share->refresh);
+        SetEvent(share->timer_evt);
+        return;
+    }
+
+    /* A period of 0 would make the timer fire only once. */
+    triggertime = maxI(1000 / share->refresh * 2 / 3, 1);
+    share->tick_period = triggertime;
     TRACE("Calling timer every %lu ms for %d refreshes per second\n",
           triggertime, share->refresh);
 
@@ -165,8 +237,31 @@ static void DSShare_Destroy(DeviceShare *share)
     share->device = NULL;
 
     DeleteCriticalSection(&share->crst);
+    DeleteCriticalSection(&share->tick_crst);
 
     HeapFree(GetProcessHeap(), 0, share->primaries);
+    TRACE("Uploaded %luKB for %luKB of unlocked buffer data\n",
+          (DWORD)(share->uploaded_bytes/1024), (DWORD)(share->locked_bytes/1024));
+    TRACE("Ran %lu updates, %lu overran, %lums jitter, %lums device latency\n",
+          (DWORD)share->tick_count, (DWORD)share->tick_overruns, share->tick_jitter,
+          (DWORD)(share->device_latency/1000));
+    TRACE("Sent %lu parameter updates, skipped %lu unchanged\n",
+          (DWORD)share->al_updates, (DWORD)share->al_skipped);
+    TRACE("Held %lu EAX updates, merged %lu, dropped %lu redundant\n",
+          (DWORD)share->eax_queued, (DWORD)share->eax_merged, (DWORD)share->eax_redundant);
+    TRACE("Answered %lu EAX queries locally, skipped %lu unchanged sets\n",
+          (DWORD)share->eax_served, (DWORD)share->eax_unchanged);
+    TRACE("Started %lu sources in %lu batches\n",
+          (DWORD)share->batched_plays, (DWORD)share->play_batches);
+    TRACE("Virtualized %lu voices (%lu inaudible, %lu in quiet stretches), restored %lu, "
+          "reclaimed %lu idle sources\n", (DWORD)share->voices_virtualized,
+          (DWORD)share->voices_culled, (DWORD)share->voices_silenced,
+          (DWORD)share->voices_restored, (DWORD)share->sources_reclaimed);
+    TRACE("Voices played %lums without a source\n", (DWORD)(share->virtual_us/1000));
+    TRACE("Merged %lu instances into another's source, limited %lu\n",
+          (DWORD)share->voices_merged, (DWORD)share->voices_limited);
+    TRACE("Passed over %lu busy buffers\n", (DWORD)share->buffers_busy);
+
     HeapFree(GetProcessHeap(), 0, share);
 
     TRACE("Closed shared device %p\n", share);
@@ -184,6 +279,11 @@ static HRESULT DSShare_Create(REFIID guid, DeviceShare **out)
         { "AL_SOFT_deferred_updates",  SOFT_DEFERRED_UPDATES },
         { "AL_SOFT_source_spatialize", SOFT_SOURCE_SPATIALIZE },
         { "AL_SOFTX_map_buffer",       SOFTX_MAP_BUFFER },
+        { "AL_SOFT_callback_buffer",   SOFT_CALLBACK_BUFFER },
+        { "AL_SOFT_buffer_sub_data",   SOFT_BUFFER_SUB_DATA },
+        { "AL_EXT_STATIC_BUFFER",      EXT_STATIC_BUFFER },
+        { "ALC_SOFT_device_clock",     SOFT_DEVICE_CLOCK },
+        { "AL_SOFT_source_resampler",  SOFT_SOURCE_RESAMPLER },
     };
     OLECHAR *guid_str = NULL;
     ALchar drv_name[64];
@@ -279,6 +379,7 @@ static HRESULT DSShare_Create(REFIID guid, DeviceShare **out)
     }
 
     InitializeCriticalSection(&share->crst);
+    InitializeCriticalSection(&share->tick_crst);
 
     hr = StringFromCLSID(guid, &guid_str);
     if(FAILED(hr))
@@ -322,6 +423,7 @@ static HRESULT DSShare_Create(REFIID guid, DeviceShare **out)
 
     setALContext(share->ctx);
     alcGetIntegerv(share->device, ALC_REFRESH, 1, &share->refresh);
+    alcGetIntegerv(share->device, ALC_FREQUENCY, 1, &share->frequency);
     checkALCError(share->device);
 
     for(i = 0;i < MAX_EXTENSIONS;i++)
@@ -334,6 +436,26 @@ static HRESULT DSShare_Create(REFIID guid, DeviceShare **out)
             BITFIELD_SET(share->Exts, extensions[i].extenum);
         }
     }
+    if(HAS_EXTENSION(share, SOFT_SOURCE_RESAMPLER))
+    {
+        share->num_resamplers = alGetInteger(AL_NUM_RESAMPLERS_SOFT);
+        share->default_resampler = alGetInteger(AL_DEFAULT_RESAMPLER_SOFT);
+        share->point_resampler = share->default_resampler;
+        share->linear_resampler = share->default_resampler;
+        for(i = 0;alGetStringiSOFT && i < share->num_resamplers;i++)
+        {
+            const ALchar *name = alGetStringiSOFT(AL_RESAMPLER_NAME_SOFT, i);
+            if(!name) continue;
+            TRACE("Resampler %d: %s\n", i, name);
+            if(lstrcmpiA(name, "Nearest") == 0 || lstrcmpiA(name, "Point") == 0)
+                share->point_resampler = i;
+            else if(lstrcmpiA(name, "Linear") == 0)
+                share->linear_resampler = i;
+        }
+        checkALError();
+        TRACE("Default resampler %d of %d, point %d, linear %d\n", share->default_resampler,
+              share->num_resamplers, share->point_resampler, share->linear_resampler);
+    }
 
     share->sources.maxhw_alloc = 0;
     while(share->sources.maxhw_alloc < MAX_SOURCES)
@@ -527,6 +649,7 @@ static void DSDevice_Destroy(DSDevice *This)
     {
         ALsizei i;
 
+        EnterCriticalSection(&share->tick_crst);
         EnterCriticalSection(&share->crst);
 
         for(i = 0;i < share->nprimaries;++i)
@@ -540,6 +663,7 @@ static void DSDevice_Destroy(DSDevice *This)
         }
 
         LeaveCriticalSection(&share->crst);
+        LeaveCriticalSection(&share->tick_crst);
     }
 
     DSPrimary_Clear(&This->primary);
@@ -742,19 +866,8 @@ static HRESULT WINAPI DS8_GetCaps(IDirectSound8 *iface, LPDSCAPS caps)
     endgroup = bufgroup + This->primary.NumBufferGroups;
     for(;free_bufs && bufgroup != endgroup;++bufgroup)
     {
-        DWORD64 usemask = ~bufgroup->FreeBuffers;
-        while(usemask)
-        {
-            int idx = CTZ64(usemask);
-            DSBuffer *buf = bufgroup->Buffers + idx;
-            usemask &= ~(U64(1) << idx);
-
-            if(buf->loc_status == DSBSTATUS_LOCHARDWARE)
-            {
-                if(!--free_bufs)
-                    break;
-            }
-        }
+        DWORD count = POPCNT64(bufgroup->HwBuffers);
+        free_bufs = (count < free_bufs) ? free_bufs-count : 0;
     }
 
     caps->dwFlags = DSCAPS_CONTINUOUSRATE | DSCAPS_CERTIFIED |
@@ -1061,6 +1174,7 @@ static HRESULT WINAPI DS8_Initialize(IDirectSound8 *iface, const GUID *devguid)
         DeviceShare *share = This->share;
         DSPrimary **prims;
 
+        EnterCriticalSection(&share->tick_crst);
         EnterCriticalSection(&share->crst);
 
         prims = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
@@ -1080,6 +1194,7 @@ static HRESULT WINAPI DS8_Initialize(IDirectSound8 *iface, const GUID *devguid)
         }
 
         LeaveCriticalSection(&share->crst);
+        LeaveCriticalSection(&share->tick_crst);
     }
 
     if(FAILED(hr))
@@ -59,6 +59,16 @@ int LogLevel = 1;
 FILE *LogFile;
 
 float RolloffFudgeFactor = 1.0f / 3.0f;
+DWORD StreamMinLatency = 20;
+DWORD StreamMaxLatency = 250;
+float PositionTolerance = 0.0f;
+LONG GainTolerance = 0;
+DWORD EAXUpdateBudget = 0;
+BOOL BatchSourcePlay = FALSE;
+LONG CullThreshold = 0;
+DWORD MergeWindow = 0;
+DWORD MaxInstances = 0;
+DWORD ResamplerPolicy = RESAMPLER_POLICY_DEFAULT;
 
 typedef struct DeviceList {
     GUID *Guids;
@@ -205,6 +215,11 @@ LPALBUFFERSTORAGESOFT palBufferStorageSOFT = NULL;
 LPALMAPBUFFERSOFT palMapBufferSOFT = NULL;
 LPALUNMAPBUFFERSOFT palUnmapBufferSOFT = NULL;
 LPALFLUSHMAPPEDBUFFERSOFT palFlushMappedBufferSOFT = NULL;
+LPALBUFFERCALLBACKSOFT palBufferCallbackSOFT = NULL;
+LPALGETSTRINGISOFT palGetStringiSOFT = NULL;
+PFNALBUFFERSUBDATASOFTPROC palBufferSubDataSOFT = NULL;
+PFNALBUFFERDATASTATICPROC palBufferDataStatic = NULL;
+LPALCGETINTEGER64VSOFT palcGetInteger64vSOFT = NULL;
 
 LPALCMAKECONTEXTCURRENT set_context;
 LPALCGETCURRENTCONTEXT get_context;
@@ -366,6 +381,11 @@ static BOOL load_libopenal(void)
     LOAD_FUNCPTR(alMapBufferSOFT);
     LOAD_FUNCPTR(alUnmapBufferSOFT);
     LOAD_FUNCPTR(alFlushMappedBufferSOFT);
+    LOAD_FUNCPTR(alBufferCallbackSOFT);
+    LOAD_FUNCPTR(alGetStringiSOFT);
+    LOAD_FUNCPTR(alBufferSubDataSOFT);
+    LOAD_FUNCPTR(alBufferDataStatic);
+    LOAD_FUNCPTR(alcGetInteger64vSOFT);
 #undef LOAD_FUNCPTR
     if(!palDeferUpdatesSOFT || !palProcessUpdatesSOFT)
     {
@@ -1374,6 +1394,40 @@ DECLSPEC_EXPORT BOOL WINAPI DllMain(HINSTANCE hInstDLL, DWORD fdwReason, LPVOID
         if(str && *str){
             RolloffFudgeFactor = strtof(str, NULL);
         }
+        str = getenv("DSOAL_STREAM_MINLATENCY");
+        if(str && *str)
+            StreamMinLatency = strtoul(str, NULL, 10);
+        str = getenv("DSOAL_STREAM_MAXLATENCY");
+        if(str && *str)
+            StreamMaxLatency = strtoul(str, NULL, 10);
+        if(StreamMaxLatency < StreamMinLatency)
+            StreamMaxLatency = StreamMinLatency;
+        str = getenv("DSOAL_POSITION_TOLERANCE");
+        if(str && *str)
+            PositionTolerance = fabsf(strtof(str, NULL));
+        str = getenv("DSOAL_GAIN_TOLERANCE");
+        if(str && *str)
+            GainTolerance = labs(strtol(str, NULL, 10));
+        str = getenv("DSOAL_EAX_BUDGET");
+        if(str && *str)
+            EAXUpdateBudget = strtoul(str, NULL, 10);
+        str = getenv("DSOAL_BATCH_PLAY");
+        if(str && *str)
+            BatchSourcePlay = strtoul(str, NULL, 10) != 0;
+        str = getenv("DSOAL_CULL_THRESHOLD");
+        if(str && *str)
+            CullThreshold = -labs(strtol(str, NULL, 10));
+        str = getenv("DSOAL_MERGE_WINDOW");
+        if(str && *str)
+            MergeWindow = strtoul(str, NULL, 10);
+        str = getenv("DSOAL_MAX_INSTANCES");
+        if(str && *str)
+            MaxInstances = strtoul(str, NULL, 10);
+        str = getenv("DSOAL_RESAMPLER_POLICY");
+        if(str && *str)
+            ResamplerPolicy = strtoul(str, NULL, 10);
+        if(ResamplerPolicy > RESAMPLER_POLICY_PERFORMANCE)
+            ResamplerPolicy = RESAMPLER_POLICY_PERFORMANCE;
         
         if(!load_libopenal())
             return FALSE;
@@ -39,7 +39,9 @@
 #include "al.h"
 #include "alext.h"
 
-#include "eax.h"
+#include "envelope.h"
+#include "notify.h"
+#include "propinfo.h"
 
 #ifndef AL_SOFT_map_buffer
 #define AL_SOFT_map_buffer 1
@@ -54,6 +56,14 @@ typedef void (AL_APIENTRY*LPALUNMAPBUFFERSOFT)(ALuint buffer);
 typedef void (AL_APIENTRY*LPALFLUSHMAPPEDBUFFERSOFT)(ALuint buffer, ALsizei offset, ALsizei length);
 #endif
 
+#ifndef AL_SOFT_callback_buffer
+#define AL_SOFT_callback_buffer 1
+#define AL_BUFFER_CALLBACK_FUNCTION_SOFT         0x19A0
+#define AL_BUFFER_CALLBACK_USER_PARAM_SOFT       0x19A1
+typedef ALsizei (AL_APIENTRY*ALBUFFERCALLBACKTYPESOFT)(ALvoid *userptr, ALvoid *sampledata, ALsizei numbytes);
+typedef void (AL_APIENTRY*LPALBUFFERCALLBACKSOFT)(ALuint buffer, ALenum format, ALsizei freq, ALBUFFERCALLBACKTYPESOFT callback, ALvoid *userptr);
+#endif
+
 
 #ifdef __GNUC__
 #define LIKELY(x) __builtin_expect(!!(x), !0)
@@ -411,6 +421,11 @@ extern LPALBUFFERSTORAGESOFT palBufferStorageSOFT;
 extern LPALMAPBUFFERSOFT palMapBufferSOFT;
 extern LPALUNMAPBUFFERSOFT palUnmapBufferSOFT;
 extern LPALFLUSHMAPPEDBUFFERSOFT palFlushMappedBufferSOFT;
+extern LPALBUFFERCALLBACKSOFT palBufferCallbackSOFT;
+extern LPALGETSTRINGISOFT palGetStringiSOFT;
+extern PFNALBUFFERSUBDATASOFTPROC palBufferSubDataSOFT;
+extern PFNALBUFFERDATASTATICPROC palBufferDataStatic;
+extern LPALCGETINTEGER64VSOFT palcGetInteger64vSOFT;
 
 #define EAXSet pEAXSet
 #define EAXGet pEAXGet
@@ -420,6 +435,11 @@ extern LPALFLUSHMAPPEDBUFFERSOFT palFlushMappedBufferSOFT;
 #define alMapBufferSOFT palMapBufferSOFT
 #define alUnmapBufferSOFT palUnmapBufferSOFT
 #define alFlushMappedBufferSOFT palFlushMappedBufferSOFT
+#define alBufferCallbackSOFT palBufferCallbackSOFT
+#define alGetStringiSOFT palGetStringiSOFT
+#define alBufferSubDataSOFT palBufferSubDataSOFT
+#define alBufferDataStatic palBufferDataStatic
+#define alcGetInteger64vSOFT palcGetInteger64vSOFT
 
 
 #ifndef E_PROP_ID_UNSUPPORTED
@@ -475,6 +495,11 @@ enum {
     SOFT_DEFERRED_UPDATES,
     SOFT_SOURCE_SPATIALIZE,
     SOFTX_MAP_BUFFER,
+    SOFT_CALLBACK_BUFFER,
+    SOFT_BUFFER_SUB_DATA,
+    EXT_STATIC_BUFFER,
+    SOFT_DEVICE_CLOCK,
+    SOFT_SOURCE_RESAMPLER,
 
     MAX_EXTENSIONS
 };
@@ -490,6 +515,29 @@ enum {
 #define MAX_HWBUFFERS 128
 
 #define MAX_SOURCES 512
+
+/* Parameters a source was last given, kept while it's in the pool so binding
+ * it again only sends the ones that differ. Which are used depends on is3d.
+ */
+struct SourceParams {
+    /* FALSE if the source's parameters aren't known. */
+    BOOL valid;
+    BOOL is3d;
+    LONG vol;
+    ALfloat pitch;
+    LONG pan;
+    DS3DBUFFER ds3d;
+    /* Negative if not known. */
+    ALfloat rolloff;
+    ALfloat doppler;
+    /* Still has the EAX properties it was reset to. */
+    BOOL eax_default;
+    /* Negative if not known. */
+    ALint resampler;
+    /* The data last played, to prefer giving the source back to it. */
+    const struct DSData *data;
+};
+
 typedef struct SourceCollection {
     DWORD maxhw_alloc, availhw_num;
     DWORD maxsw_alloc, availsw_num;
@@ -497,6 +545,7 @@ typedef struct SourceCollection {
      * maxhw_alloc. Total sources is maxhw_alloc+maxsw_alloc.
      */
     ALuint ids[MAX_SOURCES];
+    struct SourceParams params[MAX_SOURCES];
 } SourceCollection;
 
 typedef struct DeviceShare {
@@ -505,10 +554,25 @@ typedef struct DeviceShare {
     ALCdevice *device;
     ALCcontext *ctx;
     ALCint refresh;
+    ALCint frequency;
+    /* The driver's default resampler and how many it has, from
+     * AL_SOFT_source_resampler, and its point and linear sampling ones, or
+     * the default if it doesn't name them.
+     */
+    ALint default_resampler;
+    ALint num_resamplers;
+    ALint point_resampler;
+    ALint linear_resampler;
 
     ALboolean Exts[BITFIELD_ARRAY_SIZE(MAX_EXTENSIONS)];
 
+    /* The device lock guards the source pool, the buffer lists and masks,
+     * and the primaries. The update thread holds tick_crst for each tick so
+     * it can drop crst between buffers; it's taken before crst when the
+     * primaries are added or removed.
+     */
     CRITICAL_SECTION crst;
+    CRITICAL_SECTION tick_crst;
 
     SourceCollection sources;
 
@@ -522,6 +586,66 @@ typedef struct DeviceShare {
     HANDLE queue_timer;
     HANDLE timer_evt;
     volatile LONG quit_now;
+    /* Timer period, and how late ticks have recently been, in milliseconds. */
+    DWORD tick_period;
+    DWORD tick_jitter;
+    /* With ALC_SOFT_device_clock, ticks are scheduled just ahead of each mix
+     * instead of using the timer queue. clock_offset is the estimated
+     * performance counter time of device clock 0, and device_latency the
+     * last reported output latency, in microseconds.
+     */
+    BOOL clock_aligned;
+    LONGLONG clock_offset;
+    DWORD64 device_latency;
+    DWORD64 tick_count;
+    DWORD64 tick_overruns;
+
+    /* Parameter updates sent to OpenAL, and ones skipped as unchanged. */
+    volatile LONGLONG al_updates;
+    volatile LONGLONG al_skipped;
+    /* Immediate EAX sets held for an update, ones replaced by a later set of
+     * the same property, and ones dropped for repeating the pending value.
+     */
+    DWORD64 eax_queued;
+    DWORD64 eax_merged;
+    DWORD64 eax_redundant;
+    /* EAX queries answered from the wrapper's copy, and sets skipped as
+     * repeating the current value.
+     */
+    DWORD64 eax_served;
+    DWORD64 eax_unchanged;
+    /* Sources started in batches, and the batches used. */
+    DWORD64 batched_plays;
+    DWORD64 play_batches;
+    /* Voices moved off their source to play virtually, voices given a source
+     * back, and sources taken from buffers that weren't playing.
+     */
+    DWORD64 voices_virtualized;
+    DWORD64 voices_restored;
+    DWORD64 sources_reclaimed;
+    /* Voices virtualized for being too quiet to hear, either from distance
+     * and volume or in a quiet stretch of their data, and the time voices
+     * spent without a source (microseconds).
+     */
+    DWORD64 voices_culled;
+    DWORD64 voices_silenced;
+    DWORD64 virtual_us;
+    /* Instances played on another instance's source, and instances kept
+     * virtual by the per-sample instance limit.
+     */
+    DWORD64 voices_merged;
+    DWORD64 voices_limited;
+    /* Buffers passed over when looking for a source to take, a carrier or
+     * finished instances, because another thread held their lock. Voices
+     * left virtual by it try again on the next update.
+     */
+    DWORD64 buffers_busy;
+
+    /* Bytes unlocked by the app, and bytes actually given to OpenAL. */
+    DWORD64 locked_bytes;
+    DWORD64 uploaded_bytes;
+    /* Sample memory held for buffers, counting copies made by OpenAL. */
+    DWORD64 resident_bytes;
 
     ALsizei nprimaries;
     DSPrimary **primaries;
@@ -550,10 +674,36 @@ typedef struct DSData {
     DWORD dsbflags;
     BYTE *data;
     ALuint bid;
+    /* Size of the copy of the start of the data kept past its end. */
+    ALsizei mirror_size;
+
+    /* Range written since the data was last given to OpenAL. */
+    DWORD dirty_start, dirty_end;
+
+    /* Set when OpenAL reads directly from data (AL_EXT_STATIC_BUFFER). */
+    BOOL data_static;
+
+    /* Peak levels of static data. */
+    struct Envelope envelope;
+
+    /* Instances of the data holding a source, for the instance limit, and
+     * whether those that finished were let go of since the last update.
+     * Guarded by the device lock.
+     */
+    DWORD nsources;
+    BOOL limit_checked;
 } DSData;
-/* Amount of buffers that have to be queued when
- * bufferdatastatic and buffersubdata are not available */
-#define QBUFFERS 4
+/* Maximum amount of buffers that can be queued when
+ * bufferdatastatic and buffersubdata are not available. The amount actually
+ * queued is calculated per buffer.
+ */
+#define QBUFFERS 16
+
+/* Streaming buffers keep a copy of their first bytes past the end of the data,
+ * so queued segments that wrap around can be uploaded in one piece. This
+ * limits the segment size.
+ */
+#define STREAM_MIRROR_SIZE 2048
 
 union BufferParamFlags {
     LONG flags;
@@ -584,6 +734,12 @@ struct DSBuffer {
     /* From the primary */
     ALCcontext *ctx;
 
+    /* Guards the buffer's playback and 3D state and its source. Taken after
+     * the device lock when both are needed, and alone by calls that only
+     * touch this buffer. The context is set after taking it, never before.
+     */
+    CRITICAL_SECTION crst;
+
     DSData *buffer;
     ALuint source;
 
@@ -591,13 +747,27 @@ struct DSBuffer {
     ALsizei data_offset;
     ALsizei queue_base;
     ALsizei curidx;
+    ALsizei queue_size;
+    /* Recent underruns, less one for each second of refills without one. */
+    DWORD underruns, clean_refills;
+    /* Queued streaming uses all of these, callback streaming only the first. */
     ALuint stream_bids[QBUFFERS];
+    /* Read offset for callback streaming, advanced from the mixer thread. */
+    volatile LONG cb_offset;
+    /* The data offset the source's stream offset counts from. */
+    LONGLONG cb_base;
 
     BOOL init_done : 1;
     BOOL isplaying : 1;
     BOOL islooping : 1;
     BOOL bufferlost : 1;
     BOOL isdeferredswbuffer : 1;
+    BOOL iscallback : 1;
+    BOOL isvirtlooping : 1;
+    BOOL islimited : 1;
+    BOOL isstolen : 1;
+    BOOL isculled : 1;
+    BOOL src_unsent : 1;
 
     /* Must be 0 (deferred, not yet placed), DSBSTATUS_LOCSOFTWARE, or
      * DSBSTATUS_LOCHARDWARE.
@@ -612,18 +782,104 @@ struct DSBuffer {
     struct {
         DS3DBUFFER ds3d;
     } deferred;
+    /* Position in the primary's dirty list plus one, or 0 if not listed. */
+    DWORD dirty_idx;
+    /* The primary's rolloff epoch when the source's rolloff was last set. */
+    DWORD rolloff_epoch;
+    /* The source's doppler factor (negative if not known), and whether its
+     * EAX properties are the defaults it was bound with.
+     */
+    ALfloat src_doppler;
+    BOOL src_eax_default;
+    /* The source's resampler, or negative if not known. */
+    ALint src_resampler;
+    /* What a duplicate's source was last given, while src_unsent says the
+     * buffer's parameters wait until it's played to be sent.
+     */
+    struct SourceParams src_have;
+    /* The source otherwise matches the current parameters, but these may
+     * have last been sent before a change within the tolerance was skipped.
+     * Set when the buffer gets a source.
+     */
+    struct {
+        LONG vol, pan;
+        DWORD frequency;
+        D3DVECTOR pos, vel;
+    } sent;
     union BufferParamFlags dirty;
 
-    DWORD nnotify, lastpos;
+    /* Source EAX properties, kept while the buffer has no source. */
+    struct EAXMirror eax;
+
+    /* Position notifications are sorted by offset, with the first
+     * nposnotify of nnotify being position notifications and the rest being
+     * stop notifications.
+     */
+    DWORD nnotify, nposnotify, lastpos;
     DSBPOSITIONNOTIFY *notify;
+    /* Position in the primary's list of buffers waiting to start plus one,
+     * or 0 if not waiting. Guarded by the device lock, and only set or
+     * cleared with the buffer lock held too.
+     */
+    DWORD play_idx;
+    /* Position in the primary's virtual voice list plus one, or 0 if not
+     * playing virtually. A virtual voice has no source, and its position
+     * advances from virt_base starting at virt_start (microseconds). Guarded
+     * by the device lock, and only set or cleared with the buffer lock held
+     * too. isstolen is set while it's virtual because another
+     * voice took its source, isculled while it's virtual for being too quiet.
+     */
+    DWORD virt_idx;
+    DWORD virt_loc;
+    DWORD virt_base;
+    DWORD64 virt_start;
+    /* When it last went virtual, for the time saved. */
+    DWORD64 virt_since;
+    /* When a one-shot voice may reach a stretch too quiet to hear, or 0. */
+    DWORD64 env_deadline;
+    /* The instance of the same data a virtual voice is merged into, and the
+     * gain it adds to that instance's source. Guarded by the device lock.
+     */
+    DSBuffer *carrier;
+    float ride_gain;
+    /* Gain added to the source by instances merged into this one, and how
+     * many there are. Guarded by the device lock.
+     */
+    float rider_gain;
+    DWORD nriders;
+    /* When a static buffer was last started on its source, and the offset it
+     * started from.
+     */
+    DWORD64 play_time;
+    DWORD play_ofs;
+
+    /* Place in the primary's notify list, and when it's predicted to cross a
+     * notification (microseconds).
+     */
+    struct NotifyItem notify_item;
+    DWORD64 notify_predict;
 
     DWORD vm_voicepriority;
-    //DWORD vm_voicestate;
+    DWORD vm_voicestate;
+    /* The priority given to Play, used to pick voices to virtualize. */
+    DWORD play_prio;
+
+    /* Which of the primary's buffer groups this is in, and its bit there. */
+    DWORD group_idx;
+    DWORD64 group_bit;
 };
 
 
 struct DSBufferGroup {
     DWORD64 FreeBuffers;
+    /* Subsets of the allocated buffers, so per-tick and per-commit work only
+     * touches the buffers that need it. Buffers are added to the playing and
+     * streaming sets when played, and removed once found stopped.
+     */
+    DWORD64 PlayingBuffers;
+    DWORD64 StreamBuffers;
+    DWORD64 SourceBuffers;
+    DWORD64 HwBuffers;
     DSBuffer *Buffers;
 };
 
@@ -635,6 +891,14 @@ enum {
     FXSLOT_EFFECT_NULL,
 };
 
+/* Maximum number of distinct events tracked for de-duplication when
+ * signaling notifications in one update.
+ */
+#define MAX_NOTIFY_EVENTS 16
+
+/* Number of buckets in the notification lateness histogram. */
+#define NOTIFY_LATENESS_BUCKETS 8
+
 union PrimaryParamFlags {
     LONG flags;
     struct {
@@ -647,6 +911,17 @@ union PrimaryParamFlags {
     } bit;
 };
 
+/* An immediate EAX set waiting for the next update. buf is NULL for listener,
+ * context and effect slot properties.
+ */
+struct EAXPending {
+    DSBuffer *buf;
+    GUID guid;
+    DWORD propid;
+    ULONG size;
+    BYTE data[EAX_VALUE_SIZE];
+};
+
 struct DSPrimary {
     IDirectSoundBuffer IDirectSoundBuffer_iface;
     IDirectSound3DListener IDirectSound3DListener_iface;
@@ -666,8 +941,8 @@ struct DSPrimary {
     DWORD flags;
     WAVEFORMATEXTENSIBLE format;
 
-    DSBuffer **notifies;
-    DWORD nnotifies, sizenotifies;
+    struct NotifyHeap notifies;
+    DWORD notify_lateness[NOTIFY_LATENESS_BUCKETS];
 
     ALint primary_idx;
 
@@ -678,6 +953,33 @@ struct DSPrimary {
         DS3DLISTENER ds3d;
     } deferred;
     union PrimaryParamFlags dirty;
+    /* Buffers with deferred 3D changes, so commits only touch those. Sized
+     * for every allocated buffer so adding never fails.
+     */
+    DSBuffer **dirtybufs;
+    DWORD ndirtybufs;
+    /* Increased when the rolloff factor changes. Only playing buffers get
+     * the new factor right away, others pick it up when played.
+     */
+    DWORD rolloff_epoch;
+    /* Listener position last sent, and whether OpenAL is known to have the
+     * current parameters so unchanged ones can be skipped.
+     */
+    D3DVECTOR sent_pos;
+    BOOL sent_valid;
+
+    /* Listener, context and effect slot EAX properties. */
+    struct EAXMirror eax;
+    /* Buffers played since the last batch was started. */
+    DSBuffer **plays;
+    DWORD nplays, sizeplays;
+    /* Buffers playing without a source, until one frees up. */
+    DSBuffer **virtvoices;
+    DWORD nvirtvoices, sizevirtvoices;
+
+    /* Immediate EAX sets for the next update, in the order they apply. */
+    struct EAXPending *eax_pending;
+    DWORD neax_pending, sizeeax_pending;
 
     DWORD NumBufferGroups;
     struct DSBufferGroup *BufferGroups;
@@ -719,12 +1021,41 @@ DEFINE_GUID(DSPROPSETID_ZOOMFX_BufferProperties, 0xcd5368e0, 0x3450, 0x11d3, 0x8
 DEFINE_GUID(DSPROPSETID_I3DL2_ListenerProperties, 0xda0f0520, 0x300a, 0x11d3, 0x8a, 0x2b, 0x00, 0x60, 0x97, 0x0d, 0xb0, 0x11);
 DEFINE_GUID(DSPROPSETID_I3DL2_BufferProperties,   0xda0f0521, 0x300a, 0x11d3, 0x8a, 0x2b, 0x00, 0x60, 0x97, 0x0d, 0xb0, 0x11);
 
-DEFINE_GUID(DSPROPSETID_VoiceManager, 0x62a69bae, 0xdf9d, 0x11d1, 0x99, 0xa6, 0x00, 0xc0, 0x4f, 0xc9, 0x9d, 0x46);
+
+static inline void DSShare_CountUpdates(DeviceShare *share, LONG sent, LONG skipped)
+{
+    if(sent) InterlockedExchangeAdd64(&share->al_updates, sent);
+    if(skipped) InterlockedExchangeAdd64(&share->al_skipped, skipped);
+}
+
+/* Counts a parameter update as sent or skipped, returning if it's sent. */
+static inline BOOL DSShare_CountUpdate(DeviceShare *share, BOOL send)
+{
+    InterlockedIncrement64(send ? &share->al_updates : &share->al_skipped);
+    return send;
+}
+
+static inline struct DSBufferGroup *DSBuffer_Group(const DSBuffer *buf)
+{
+    return &buf->primary->BufferGroups[buf->group_idx];
+}
 
 
 HRESULT DSPrimary_PreInit(DSPrimary *prim, DSDevice *parent);
 void DSPrimary_Clear(DSPrimary *prim);
+void DSPrimary_addnotify(DSPrimary *prim, DSBuffer *buf);
+void DSPrimary_removenotify(DSPrimary *prim, DSBuffer *buf);
 void DSPrimary_triggernots(DSPrimary *prim);
+BOOL DSPrimary_queueeax(DSPrimary *prim, DSBuffer *buf, REFGUID guid, DWORD propid,
+                        const void *data, ULONG size);
+void DSPrimary_flusheax(DSPrimary *prim, DWORD limit);
+void DSPrimary_dropeax(DSPrimary *prim, DSBuffer *buf);
+BOOL DSPrimary_queueplay(DSPrimary *prim, DSBuffer *buf);
+void DSPrimary_cancelplay(DSPrimary *prim, DSBuffer *buf);
+void DSPrimary_flushplays(DSPrimary *prim);
+BOOL DSPrimary_addvirtual(DSPrimary *prim, DSBuffer *buf);
+void DSPrimary_removevirtual(DSPrimary *prim, DSBuffer *buf);
+void DSPrimary_updatevirtual(DSPrimary *prim);
 void DSPrimary_streamfeeder(DSPrimary *prim, BYTE *scratch_mem/*2K non-permanent memory*/);
 HRESULT WINAPI DSPrimary_Initialize(IDirectSoundBuffer *iface, IDirectSound *ds, const DSBUFFERDESC *desc);
 HRESULT WINAPI DSPrimary3D_CommitDeferredSettings(IDirectSound3DListener *iface);
@@ -733,26 +1064,25 @@ HRESULT DSBuffer_Create(DSBuffer **ppv, DSPrimary *parent, IDirectSoundBuffer *o
 void DSBuffer_Destroy(DSBuffer *buf);
 HRESULT DSBuffer_GetInterface(DSBuffer *buf, REFIID riid, void **ppv);
 void DSBuffer_SetParams(DSBuffer *buffer, const DS3DBUFFER *params, LONG flags);
+void DSBuffer_UpdateStream(DSBuffer *buf, BOOL resize);
+DWORD DSBuffer_CallbackPos(const DSBuffer *buf);
+void DSBuffer_UpdateRolloff(DSBuffer *buf);
+void DSBuffer_UpdateResampler(DSBuffer *buf);
+float DSBuffer_EstimateGain(const DSBuffer *buf);
+BOOL DSBuffer_IsAudible(const DSBuffer *buf);
+BOOL DSBuffer_IsSilent(const DSBuffer *buf, DWORD pos);
+WORD DSBuffer_GetEnvelope(const DSBuffer *buf, DWORD pos);
+void DSBuffer_Cull(DSBuffer *buf);
+void DSBuffer_CheckEnvelope(DSBuffer *buf, DWORD64 now);
+BOOL DSBuffer_GetVirtualPos(const DSBuffer *buf, DWORD64 now, DWORD *pos);
+BOOL DSBuffer_RestoreVirtual(DSBuffer *buf, BOOL reclaim);
+void DSBuffer_CheckRider(DSBuffer *buf);
+void DSBuffer_Unride(DSBuffer *buf);
 HRESULT WINAPI DSBuffer_GetCurrentPosition(IDirectSoundBuffer8 *iface, DWORD *playpos, DWORD *curpos);
 HRESULT WINAPI DSBuffer_GetStatus(IDirectSoundBuffer8 *iface, DWORD *status);
 HRESULT WINAPI DSBuffer_Initialize(IDirectSoundBuffer8 *iface, IDirectSound *ds, const DSBUFFERDESC *desc);
 
-HRESULT EAX1_Query(DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
-HRESULT EAX1Buffer_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
-
-HRESULT EAX2_Query(DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
-HRESULT EAX2Buffer_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
-
-HRESULT EAX3_Query(DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
-HRESULT EAX3Buffer_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
-
-HRESULT EAX4Context_Query(DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
-HRESULT EAX4Slot_Query(DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
-HRESULT EAX4Source_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
-
-HRESULT VoiceMan_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
-HRESULT VoiceMan_Set(DSBuffer *buf, DWORD propid, void *pPropData, ULONG cbPropData);
-HRESULT VoiceMan_Get(DSBuffer *buf, DWORD propid, void *pPropData, ULONG cbPropData, ULONG *pcbReturned);
+void EAXMirror_Apply(const struct EAXMirror *mirror, ALuint source);
 
 static inline LONG gain_to_mB(float gain)
 {
@@ -782,11 +1112,32 @@ static inline FLOAT clampF(FLOAT val, FLOAT minval, FLOAT maxval)
     return val;
 }
 
+/* Returns the performance counter time in microseconds. */
+static inline DWORD64 get_time_us(void)
+{
+    LARGE_INTEGER count, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (DWORD64)(count.QuadPart/freq.QuadPart)*1000000 +
+           (DWORD64)(count.QuadPart%freq.QuadPart)*1000000/freq.QuadPart;
+}
+
+/* Returns if a vector moved more than the tolerance from the last value sent. */
+static inline BOOL vector_changed(const D3DVECTOR *sent, const D3DVECTOR *vec, float tolerance)
+{
+    float dx = vec->x - sent->x;
+    float dy = vec->y - sent->y;
+    float dz = vec->z - sent->z;
+    return dx*dx + dy*dy + dz*dz > tolerance*tolerance;
+}
+
 static inline LONG minI(LONG a, LONG b)
 { return (a < b) ? a : b; }
 static inline float minF(float a, float b)
 { return (a < b) ? a : b; }
 
+static inline LONG maxI(LONG a, LONG b)
+{ return (a > b) ? a : b; }
 static inline float maxF(float a, float b)
 { return (a > b) ? a : b; }
 
@@ -835,3 +1186,33 @@ extern const WCHAR aldriver_name[];
 HRESULT WINAPI DSOAL_GetDeviceID(LPCGUID pGuidSrc, LPGUID pGuidDest);
 
 extern float RolloffFudgeFactor;
+/* Bounds, in milliseconds, for the amount of audio queued on streaming buffers. */
+extern DWORD StreamMinLatency;
+extern DWORD StreamMaxLatency;
+/* Position changes within this distance, and volume changes within this many
+ * millibels, aren't sent to OpenAL.
+ */
+extern float PositionTolerance;
+extern LONG GainTolerance;
+/* Most held EAX sets applied per update, or 0 to apply them as they're made. */
+extern DWORD EAXUpdateBudget;
+/* Start played buffers together at the next update or commit. */
+extern BOOL BatchSourcePlay;
+/* Playing 3D buffers estimated to be quieter than this many millibels at the
+ * listener, and one-shot buffers in a stretch of data that quiet, don't hold a
+ * source, or 0 to always keep them.
+ */
+extern LONG CullThreshold;
+/* Instances of the same data started within this many milliseconds, from the
+ * same offset, share a source, or 0 to not merge them.
+ */
+extern DWORD MergeWindow;
+/* Most instances of the same data holding a source at once, or 0 for no limit. */
+extern DWORD MaxInstances;
+/* How sources' resamplers trade quality for mixing cost. */
+enum {
+    RESAMPLER_POLICY_DEFAULT,
+    RESAMPLER_POLICY_QUALITY,
+    RESAMPLER_POLICY_PERFORMANCE
+};
+extern DWORD ResamplerPolicy;
@@ -303,3 +303,27 @@ HRESULT EAX1Buffer_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport)
     FIXME("Unhandled propid: 0x%08lx\n", propid);
     return E_PROP_ID_UNSUPPORTED;
 }
+
+
+/*******************
+ * EAX state mirror
+ ******************/
+
+/* Gives a source a buffer's properties, on top of the defaults it was reset
+ * to. Should be called with the source's context set.
+ */
+void EAXMirror_Apply(const struct EAXMirror *mirror, ALuint source)
+{
+    DWORD i;
+
+    if(mirror->count == 0)
+        return;
+
+    for(i = 0;i < mirror->count;++i)
+    {
+        struct EAXValue *val = &mirror->vals[i];
+        EAXSet(&val->guid, val->propid|0x80000000ul, source, val->data, val->size);
+    }
+    EAXSet(&DSPROPSETID_EAX20_BufferProperties, DSPROPERTY_EAX20BUFFER_COMMITDEFERREDSETTINGS,
+           source, NULL, 0);
+}
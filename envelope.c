@@ -0,0 +1,152 @@
+/* DirectSound sample envelopes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* The peak levels of static sample data and the checks of them for quiet
+ * stretches, apart from the buffers and OpenAL, so they can be tested on
+ * their own.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "envelope.h"
+
+
+/* Sets up an envelope of data that starts out silent. The envelope is
+ * optional, so a failed allocation leaves it untracked.
+ */
+BOOL Envelope_Init(struct Envelope *env, DWORD size, WORD align)
+{
+    env->block_size = ENVELOPE_FRAMES * align;
+    env->size = size;
+    env->blocks = (size + env->block_size - 1) / env->block_size;
+    env->peaks = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, env->blocks * sizeof(WORD));
+    if(!env->peaks) env->blocks = 0;
+    return env->peaks != NULL;
+}
+
+void Envelope_Clear(struct Envelope *env)
+{
+    HeapFree(GetProcessHeap(), 0, env->peaks);
+    env->peaks = NULL;
+    env->blocks = 0;
+}
+
+/* Recomputes the blocks overlapping the given range of the data. */
+void Envelope_Update(struct Envelope *env, const BYTE *data, WORD bits, DWORD ofs, DWORD len)
+{
+    DWORD last, b;
+
+    if(!env->peaks || !len || ofs >= env->size)
+        return;
+
+    last = ofs+len-1;
+    if(last >= env->size) last = env->size-1;
+    last /= env->block_size;
+    for(b = ofs/env->block_size;b <= last;++b)
+    {
+        const BYTE *src = data + b*env->block_size;
+        DWORD count = env->size - b*env->block_size;
+        DWORD peak = 0, i;
+
+        if(count > env->block_size)
+            count = env->block_size;
+        if(bits == 8)
+        {
+            for(i = 0;i < count;++i)
+            {
+                DWORD level = (DWORD)abs(src[i] - 0x80) << 8;
+                if(level > peak) peak = level;
+            }
+        }
+        else if(bits == 16)
+        {
+            const short *samples = (const short*)src;
+            for(i = 0;i < count/2;++i)
+            {
+                DWORD level = (DWORD)abs(samples[i]);
+                if(level > peak) peak = level;
+            }
+        }
+        else
+        {
+            const float *samples = (const float*)src;
+            float fpeak = 0.0f;
+            for(i = 0;i < count/4;++i)
+            {
+                float level = fabsf(samples[i]);
+                if(level > fpeak) fpeak = level;
+            }
+            peak = (DWORD)(((fpeak < 1.0f) ? fpeak : 1.0f) * 32767.0f);
+        }
+        env->peaks[b] = (WORD)((peak < 32767) ? peak : 32767);
+    }
+}
+
+/* The peak level of the block holding the given offset, or 32767 if it isn't
+ * known.
+ */
+WORD Envelope_Peak(const struct Envelope *env, DWORD ofs)
+{
+    if(!env->peaks || ofs >= env->size)
+        return 32767;
+    return env->peaks[ofs / env->block_size];
+}
+
+/* The peak level a block needs to be heard at the given gain, with the
+ * threshold in millibels.
+ */
+float Envelope_Limit(LONG threshold, float gain)
+{
+    float limit = powf(10.0f, (float)threshold/2000.0f) * 32767.0f;
+    return limit / ((gain > 1.0f/65536.0f) ? gain : 1.0f/65536.0f);
+}
+
+/* Checks that every block overlapping the given range is below the limit. */
+BOOL Envelope_IsQuiet(const struct Envelope *env, DWORD ofs, DWORD len, float limit)
+{
+    DWORD last, b;
+
+    if(!env->peaks || ofs >= env->size)
+        return FALSE;
+
+    last = (ofs+len) / env->block_size;
+    if(last >= env->blocks) last = env->blocks-1;
+    for(b = ofs/env->block_size;b <= last;++b)
+    {
+        if(env->peaks[b] >= limit)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Finds the start of the first block below the limit at or after the one
+ * holding the given offset, or the data size if there is none.
+ */
+DWORD Envelope_NextQuiet(const struct Envelope *env, DWORD ofs, float limit)
+{
+    DWORD b;
+
+    if(!env->peaks || ofs >= env->size)
+        return env->size;
+    for(b = ofs/env->block_size;b < env->blocks;++b)
+    {
+        if(env->peaks[b] < limit)
+            return b*env->block_size;
+    }
+    return env->size;
+}
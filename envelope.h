@@ -0,0 +1,50 @@
+/* DirectSound sample envelopes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef DSOAL_ENVELOPE_H
+#define DSOAL_ENVELOPE_H
+
+#include <windows.h>
+
+/* Sample frames covered by each envelope block. */
+#define ENVELOPE_FRAMES 1024
+
+/* Updates ahead a quiet stretch needs to last for a voice to leave its source
+ * in it, so it gets the source back before the sound picks up again.
+ */
+#define ENVELOPE_LOOKAHEAD 2
+
+/* Peak level of each block of sample data, scaled to 16-bit, for telling
+ * when a voice is too quiet to hear.
+ */
+struct Envelope {
+    /* NULL if not tracked. */
+    WORD *peaks;
+    DWORD blocks;
+    /* Bytes of data covered by each block, and by all of them. */
+    DWORD block_size, size;
+};
+
+BOOL Envelope_Init(struct Envelope *env, DWORD size, WORD align);
+void Envelope_Clear(struct Envelope *env);
+void Envelope_Update(struct Envelope *env, const BYTE *data, WORD bits, DWORD ofs, DWORD len);
+WORD Envelope_Peak(const struct Envelope *env, DWORD ofs);
+float Envelope_Limit(LONG threshold, float gain);
+BOOL Envelope_IsQuiet(const struct Envelope *env, DWORD ofs, DWORD len, float limit);
+DWORD Envelope_NextQuiet(const struct Envelope *env, DWORD ofs, float limit);
+
+#endif /* DSOAL_ENVELOPE_H */
@@ -0,0 +1,194 @@
+/* DirectSound notification scheduling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Which notifications a buffer crossed and when it should next be checked,
+ * apart from reading its position and signaling the events, so it can be
+ * tested on its own.
+ */
+
+#include "notify.h"
+
+
+static void heap_sift_up(struct NotifyHeap *heap, DWORD i)
+{
+    struct NotifyItem *item = heap->items[i];
+    while(i > 0)
+    {
+        DWORD parent = (i-1) / 2;
+        if(heap->items[parent]->deadline <= item->deadline)
+            break;
+        heap->items[i] = heap->items[parent];
+        heap->items[i]->idx = i+1;
+        i = parent;
+    }
+    heap->items[i] = item;
+    item->idx = i+1;
+}
+
+static void heap_sift_down(struct NotifyHeap *heap, DWORD i)
+{
+    struct NotifyItem *item = heap->items[i];
+    for(;;)
+    {
+        DWORD child = i*2 + 1;
+        if(child >= heap->count)
+            break;
+        if(child+1 < heap->count && heap->items[child+1]->deadline < heap->items[child]->deadline)
+            child++;
+        if(item->deadline <= heap->items[child]->deadline)
+            break;
+        heap->items[i] = heap->items[child];
+        heap->items[i]->idx = i+1;
+        i = child;
+    }
+    heap->items[i] = item;
+    item->idx = i+1;
+}
+
+BOOL NotifyHeap_Init(struct NotifyHeap *heap, DWORD size)
+{
+    heap->items = HeapAlloc(GetProcessHeap(), 0, size*sizeof(*heap->items));
+    heap->count = 0;
+    heap->size = heap->items ? size : 0;
+    return heap->items != NULL;
+}
+
+void NotifyHeap_Clear(struct NotifyHeap *heap)
+{
+    HeapFree(GetProcessHeap(), 0, heap->items);
+    heap->items = NULL;
+    heap->count = heap->size = 0;
+}
+
+/* Sets when the item is next due, adding it to the heap if it isn't in it.
+ * Returns FALSE if it couldn't be added.
+ */
+BOOL NotifyHeap_Schedule(struct NotifyHeap *heap, struct NotifyItem *item, DWORD64 deadline)
+{
+    item->deadline = deadline;
+    if(item->idx)
+    {
+        heap_sift_up(heap, item->idx-1);
+        heap_sift_down(heap, item->idx-1);
+        return TRUE;
+    }
+
+    if(heap->count == heap->size)
+    {
+        DWORD newsize = heap->size ? heap->size*2 : 16;
+        struct NotifyItem **list;
+
+        if(heap->items)
+            list = HeapReAlloc(GetProcessHeap(), 0, heap->items, newsize * sizeof(*list));
+        else
+            list = HeapAlloc(GetProcessHeap(), 0, newsize * sizeof(*list));
+        if(!list) return FALSE;
+        heap->items = list;
+        heap->size = newsize;
+    }
+    heap->items[heap->count++] = item;
+    heap_sift_up(heap, heap->count-1);
+    return TRUE;
+}
+
+void NotifyHeap_Remove(struct NotifyHeap *heap, struct NotifyItem *item)
+{
+    DWORD i = item->idx;
+    struct NotifyItem *last;
+
+    if(!i) return;
+    item->idx = 0;
+
+    last = heap->items[--heap->count];
+    if(--i < heap->count)
+    {
+        heap->items[i] = last;
+        heap_sift_down(heap, i);
+        heap_sift_up(heap, last->idx-1);
+    }
+}
+
+
+/* Returns the index of the first of count position notifications at or past
+ * ofs. The notifications are sorted by offset.
+ */
+DWORD Notify_Find(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD ofs)
+{
+    DWORD low = 0, high = count;
+    while(low < high)
+    {
+        DWORD mid = low + (high-low)/2;
+        if(notify[mid].dwOffset < ofs)
+            low = mid+1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/* Gets the notifications crossed moving from lastpos to curpos, those with
+ * offsets in [lastpos, curpos), as the index ranges [ranges[0], ranges[1])
+ * and [ranges[2], ranges[3]). The second is only used when the position
+ * wrapped around.
+ */
+void Notify_Elapsed(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD lastpos, DWORD curpos,
+                    DWORD ranges[4])
+{
+    ranges[0] = Notify_Find(notify, count, lastpos);
+    if(curpos < lastpos)
+    {
+        ranges[1] = count;
+        ranges[2] = 0;
+        ranges[3] = Notify_Find(notify, count, curpos);
+    }
+    else
+    {
+        ranges[1] = Notify_Find(notify, count, curpos);
+        ranges[2] = ranges[3] = 0;
+    }
+}
+
+/* Predicts how long, in microseconds, until a buffer playing from curpos at
+ * rate bytes per second crosses its next notification offset, or reaches the
+ * end if it isn't looping. The position only moves when the device mixes, so
+ * it may be up to an update period old, and the wait is shortened by that
+ * much, and a little more to allow for rate changes from doppler. It's capped
+ * at a few periods so unexpected changes are still caught, and never 0, so
+ * each update checks a buffer once.
+ */
+DWORD64 Notify_PredictWait(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD curpos,
+                           DWORD size, BOOL looping, DWORD align, DWORD64 rate, DWORD64 period)
+{
+    DWORD64 wait, maxwait;
+    DWORD dist, next;
+
+    curpos %= size;
+    dist = looping ? size : size-curpos;
+
+    /* Notifications trigger once the position is past the offset. */
+    next = Notify_Find(notify, count, curpos);
+    if(next < count)
+        dist = notify[next].dwOffset - curpos + align;
+    else if(looping && count > 0)
+        dist = size - curpos + notify[0].dwOffset + align;
+
+    wait = (DWORD64)dist * 1000000 / rate;
+    wait -= wait / 16;
+    wait = (wait > period) ? wait-period : 1;
+    maxwait = (period*4 < 1000) ? 1000 : period*4;
+    return (wait > maxwait) ? maxwait : wait;
+}
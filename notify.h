@@ -0,0 +1,53 @@
+/* DirectSound notification scheduling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef DSOAL_NOTIFY_H
+#define DSOAL_NOTIFY_H
+
+#include <windows.h>
+#include <dsound.h>
+
+/* An entry in a NotifyHeap, kept in the object being scheduled. */
+struct NotifyItem {
+    /* When it next needs to be checked, in microseconds. */
+    DWORD64 deadline;
+    /* Position in the heap plus one, or 0 if it's not in it. */
+    DWORD idx;
+};
+
+/* A min-heap of items on their deadlines. */
+struct NotifyHeap {
+    struct NotifyItem **items;
+    DWORD count, size;
+};
+
+BOOL NotifyHeap_Init(struct NotifyHeap *heap, DWORD size);
+void NotifyHeap_Clear(struct NotifyHeap *heap);
+BOOL NotifyHeap_Schedule(struct NotifyHeap *heap, struct NotifyItem *item, DWORD64 deadline);
+void NotifyHeap_Remove(struct NotifyHeap *heap, struct NotifyItem *item);
+
+/* The item with the earliest deadline, or NULL if the heap is empty. */
+static inline struct NotifyItem *NotifyHeap_Top(const struct NotifyHeap *heap)
+{ return heap->count ? heap->items[0] : NULL; }
+
+DWORD Notify_Find(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD ofs);
+void Notify_Elapsed(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD lastpos, DWORD curpos,
+                    DWORD ranges[4]);
+DWORD64 Notify_PredictWait(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD curpos,
+                           DWORD size, BOOL looping, DWORD align, DWORD64 rate, DWORD64 period);
+
+#endif /* DSOAL_NOTIFY_H */
@@ -60,65 +60,533 @@ static inline DSPrimary *impl_from_IKsPropertySet(IKsPropertySet *iface)
 }
 
 
-static void trigger_elapsed_notifies(DSBuffer *buf, DWORD lastpos, DWORD curpos)
+/* Upper bounds, in microseconds, of the notification lateness histogram. */
+static const DWORD lateness_buckets[NOTIFY_LATENESS_BUCKETS-1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+
+/* Signals the notifications in [start, end), skipping events that were
+ * already signaled for this update.
+ */
+static DWORD signal_notifies(DSBuffer *buf, DWORD start, DWORD end, HANDLE *sent, DWORD *nsent)
 {
-    DSBPOSITIONNOTIFY *not = buf->notify;
-    DSBPOSITIONNOTIFY *not_end = not + buf->nnotify;
-    for(;not != not_end;++not)
+    DWORD count = 0;
+    for(;start < end;++start)
     {
-        HANDLE event = not->hEventNotify;
-        DWORD ofs = not->dwOffset;
+        HANDLE event = buf->notify[start].hEventNotify;
+        DWORD i;
+
+        for(i = 0;i < *nsent;++i)
+        {
+            if(sent[i] == event)
+                break;
+        }
+        if(i < *nsent)
+            continue;
+        if(*nsent < MAX_NOTIFY_EVENTS)
+            sent[(*nsent)++] = event;
+
+        TRACE("Triggering notification %lu from buffer %p\n", start, buf);
+        SetEvent(event);
+        count++;
+    }
+    return count;
+}
+
+static DWORD trigger_elapsed_notifies(DSBuffer *buf, DWORD lastpos, DWORD curpos)
+{
+    HANDLE sent[MAX_NOTIFY_EVENTS];
+    DWORD nsent = 0;
+    DWORD ranges[4];
+
+    Notify_Elapsed(buf->notify, buf->nposnotify, lastpos, curpos, ranges);
+    return signal_notifies(buf, ranges[0], ranges[1], sent, &nsent) +
+           signal_notifies(buf, ranges[2], ranges[3], sent, &nsent);
+}
+
+static void trigger_stop_notifies(DSBuffer *buf)
+{
+    HANDLE sent[MAX_NOTIFY_EVENTS];
+    DWORD nsent = 0;
+    signal_notifies(buf, buf->nposnotify, buf->nnotify, sent, &nsent);
+}
+
+/* Predicts when the buffer will next cross one of its notification offsets,
+ * or reach the end if it isn't looping.
+ */
+static DWORD64 predict_notify_time(const DSBuffer *buf, DWORD curpos, DWORD64 now)
+{
+    const DSData *data = buf->buffer;
+    const WAVEFORMATEX *format = &data->format.Format;
+    DWORD64 rate;
+
+    rate = (DWORD64)(buf->current.frequency ? buf->current.frequency : format->nSamplesPerSec) *
+           format->nBlockAlign;
+    return now + Notify_PredictWait(buf->notify, buf->nposnotify, curpos, data->buf_size,
+                                    buf->islooping, format->nBlockAlign, rate,
+                                    (DWORD64)buf->share->tick_period * 1000);
+}
+
+static void record_notify_lateness(DSPrimary *prim, DWORD64 predicted, DWORD64 now)
+{
+    DWORD64 late = (now > predicted) ? now-predicted : 0;
+    DWORD i;
+
+    for(i = 0;i < NOTIFY_LATENESS_BUCKETS-1;++i)
+    {
+        if(late < lateness_buckets[i])
+            break;
+    }
+    prim->notify_lateness[i]++;
+}
+
+/* Adds the buffer to the notify list, or moves it to the front if it's
+ * already there, so it gets checked on the next update. Should be called with
+ * the device lock held.
+ */
+void DSPrimary_addnotify(DSPrimary *prim, DSBuffer *buf)
+{
+    buf->notify_predict = 0;
+    NotifyHeap_Schedule(&prim->notifies, &buf->notify_item, 0);
+}
+
+void DSPrimary_removenotify(DSPrimary *prim, DSBuffer *buf)
+{
+    NotifyHeap_Remove(&prim->notifies, &buf->notify_item);
+}
+
+/* Holds an immediate EAX set for the next update, replacing a pending set of
+ * the same property. Returns FALSE if it has to be applied now instead. Should
+ * be called with the device lock held.
+ */
+BOOL DSPrimary_queueeax(DSPrimary *prim, DSBuffer *buf, REFGUID guid, DWORD propid,
+                        const void *data, ULONG size)
+{
+    DeviceShare *share = prim->share;
+    const struct PropSetInfo *set;
+    struct EAXPending *entry;
+    BOOL overlapped = FALSE;
+    DWORD i;
 
-        if(ofs == (DWORD)DSBPN_OFFSETSTOP)
+    if(!EAXUpdateBudget || size == 0 || size > EAX_VALUE_SIZE)
+        return FALSE;
+    /* Environment size changes rescale other reverb properties, so the
+     * result depends on what was set before.
+     */
+    set = PropSet_Find(guid);
+    if(!set) return FALSE;
+    switch(set->id)
+    {
+    case PROPSET_EAX20_LISTENER:
+        if(propid == DSPROPERTY_EAX20LISTENER_ENVIRONMENTSIZE) return FALSE;
+        break;
+    case PROPSET_EAX30_LISTENER:
+        if(propid == DSPROPERTY_EAX30LISTENER_ENVIRONMENTSIZE) return FALSE;
+        break;
+    case PROPSET_EAX40_FXSLOT:
+        if(propid == EAXREVERB_ENVIRONMENTSIZE) return FALSE;
+        break;
+    default:
+        break;
+    }
+
+    for(i = prim->neax_pending;i > 0;)
+    {
+        entry = &prim->eax_pending[--i];
+        if(entry->buf != buf)
+            continue;
+        /* Another property of the same object was set since, which may
+         * overlap this one (e.g. an all-parameters set, or the same value
+         * through another EAX version's property set).
+         */
+        if(entry->propid != propid || !IsEqualIID(&entry->guid, guid))
+        {
+            overlapped = TRUE;
             continue;
+        }
 
-        if(curpos < lastpos) /* Wraparound case */
+        if(!overlapped && entry->size == size && memcmp(entry->data, data, size) == 0)
         {
-            if(ofs < curpos || ofs >= lastpos)
-            {
-                TRACE("Triggering notification %d from buffer %p\n", (int)(not-buf->notify), buf);
-                SetEvent(event);
-            }
+            share->eax_redundant++;
+            return TRUE;
         }
-        else if(ofs >= lastpos && ofs < curpos) /* Normal case */
+        /* The new value goes after anything it could overlap. */
+        memmove(entry, entry+1, (prim->neax_pending-i-1) * sizeof(*entry));
+        prim->neax_pending--;
+        share->eax_merged++;
+        break;
+    }
+
+    if(prim->neax_pending == prim->sizeeax_pending)
+    {
+        DWORD newsize = prim->sizeeax_pending ? prim->sizeeax_pending*2 : 16;
+        struct EAXPending *list;
+
+        if(prim->eax_pending)
+            list = HeapReAlloc(GetProcessHeap(), 0, prim->eax_pending, newsize * sizeof(*list));
+        else
+            list = HeapAlloc(GetProcessHeap(), 0, newsize * sizeof(*list));
+        if(!list) return FALSE;
+        prim->eax_pending = list;
+        prim->sizeeax_pending = newsize;
+    }
+
+    entry = &prim->eax_pending[prim->neax_pending++];
+    entry->buf = buf;
+    entry->guid = *guid;
+    entry->propid = propid;
+    entry->size = size;
+    memcpy(entry->data, data, size);
+    share->eax_queued++;
+
+    return TRUE;
+}
+
+/* Applies up to limit pending EAX sets, or all of them if 0, oldest first in
+ * one batch. Should be called with the device lock held.
+ */
+void DSPrimary_flusheax(DSPrimary *prim, DWORD limit)
+{
+    DWORD count = prim->neax_pending;
+    DWORD i;
+
+    if(count == 0) return;
+    if(limit && count > limit)
+        count = limit;
+
+    setALContext(prim->ctx);
+    alDeferUpdatesSOFT();
+    for(i = 0;i < count;++i)
+    {
+        struct EAXPending *entry = &prim->eax_pending[i];
+        ALenum err;
+
+        if(entry->buf)
+        {
+            /* Apply just this source's EAX state, as with an immediate set. A
+             * buffer that lost its source gets it when it has one again.
+             */
+            ALuint source = entry->buf->source;
+            if(!source) continue;
+            err = EAXSet(&entry->guid, entry->propid|0x80000000ul, source, entry->data,
+                         entry->size);
+            if(err == AL_NO_ERROR)
+                err = EAXSet(&DSPROPSETID_EAX20_BufferProperties,
+                             DSPROPERTY_EAX20BUFFER_COMMITDEFERREDSETTINGS, source, NULL, 0);
+        }
+        else
+            err = EAXSet(&entry->guid, entry->propid, 0, entry->data, entry->size);
+        if(err != AL_NO_ERROR)
         {
-            TRACE("Triggering notification %d from buffer %p\n", (int)(not-buf->notify), buf);
-            SetEvent(event);
+            WARN("Failed to set EAX property %s 0x%lx: 0x%04x\n", debugstr_guid(&entry->guid),
+                 entry->propid, err);
+            EAXMirror_Forget(entry->buf ? &entry->buf->eax : &prim->eax, &entry->guid,
+                             entry->propid);
         }
     }
+    alProcessUpdatesSOFT();
+    checkALError();
+    popALContext();
+
+    prim->neax_pending -= count;
+    memmove(prim->eax_pending, prim->eax_pending+count,
+            prim->neax_pending * sizeof(*prim->eax_pending));
 }
 
-static void trigger_stop_notifies(DSBuffer *buf)
+/* Forgets the pending EAX sets of a buffer that's going away. */
+void DSPrimary_dropeax(DSPrimary *prim, DSBuffer *buf)
 {
-    DSBPOSITIONNOTIFY *not = buf->notify;
-    DSBPOSITIONNOTIFY *not_end = not + buf->nnotify;
-    for(;not != not_end;++not)
+    DWORD i, j;
+
+    for(i = j = 0;i < prim->neax_pending;++i)
     {
-        if(not->dwOffset != (DWORD)DSBPN_OFFSETSTOP)
+        if(prim->eax_pending[i].buf == buf)
             continue;
-        TRACE("Triggering notification %d from buffer %p\n", (int)(not-buf->notify), buf);
-        SetEvent(not->hEventNotify);
+        if(i != j)
+            prim->eax_pending[j] = prim->eax_pending[i];
+        ++j;
     }
+    prim->neax_pending = j;
 }
 
+/* Holds a buffer's source to be started with the next batch. Returns FALSE if
+ * it has to be started now instead. Should be called with the device lock held.
+ */
+BOOL DSPrimary_queueplay(DSPrimary *prim, DSBuffer *buf)
+{
+    if(buf->play_idx)
+        return TRUE;
+
+    if(prim->nplays == prim->sizeplays)
+    {
+        DWORD newsize = prim->sizeplays ? prim->sizeplays*2 : 16;
+        DSBuffer **list;
+
+        if(prim->plays)
+            list = HeapReAlloc(GetProcessHeap(), 0, prim->plays, newsize * sizeof(*list));
+        else
+            list = HeapAlloc(GetProcessHeap(), 0, newsize * sizeof(*list));
+        if(!list) return FALSE;
+        prim->plays = list;
+        prim->sizeplays = newsize;
+    }
+    prim->plays[prim->nplays++] = buf;
+    buf->play_idx = prim->nplays;
+    return TRUE;
+}
+
+void DSPrimary_cancelplay(DSPrimary *prim, DSBuffer *buf)
+{
+    DWORD i = buf->play_idx;
+    DSBuffer *last;
+
+    if(!i) return;
+    buf->play_idx = 0;
+
+    last = prim->plays[--prim->nplays];
+    if(--i < prim->nplays)
+    {
+        prim->plays[i] = last;
+        last->play_idx = i+1;
+    }
+}
+
+/* Starts the sources of the buffers played since the last batch with one call,
+ * so they start on the same sample. Each buffer is only taken off the batch
+ * once started, under its lock, so its status never shows it stopped. Should
+ * be called with the device lock held.
+ */
+void DSPrimary_flushplays(DSPrimary *prim)
+{
+    ALuint ids[MAX_SOURCES];
+    DWORD i;
+
+    if(prim->nplays == 0)
+        return;
+
+    for(i = 0;i < prim->nplays;++i)
+        ids[i] = prim->plays[i]->source;
+
+    setALContext(prim->ctx);
+    alSourcePlayv(prim->nplays, ids);
+    if(alGetError() != AL_NO_ERROR)
+        ERR("Couldn't start %lu sources\n", prim->nplays);
+    popALContext();
+
+    for(i = 0;i < prim->nplays;++i)
+    {
+        DSBuffer *buf = prim->plays[i];
+        EnterCriticalSection(&buf->crst);
+        buf->play_idx = 0;
+        LeaveCriticalSection(&buf->crst);
+    }
+
+    prim->share->batched_plays += prim->nplays;
+    prim->share->play_batches++;
+    prim->nplays = 0;
+}
+
+/* Adds the buffer to the list of voices playing without a source. Should be
+ * called with the device lock held.
+ */
+BOOL DSPrimary_addvirtual(DSPrimary *prim, DSBuffer *buf)
+{
+    if(buf->virt_idx)
+        return TRUE;
+
+    if(prim->nvirtvoices == prim->sizevirtvoices)
+    {
+        DWORD newsize = prim->sizevirtvoices ? prim->sizevirtvoices*2 : 16;
+        DSBuffer **list;
+
+        if(prim->virtvoices)
+            list = HeapReAlloc(GetProcessHeap(), 0, prim->virtvoices, newsize * sizeof(*list));
+        else
+            list = HeapAlloc(GetProcessHeap(), 0, newsize * sizeof(*list));
+        if(!list) return FALSE;
+        prim->virtvoices = list;
+        prim->sizevirtvoices = newsize;
+    }
+    prim->virtvoices[prim->nvirtvoices++] = buf;
+    buf->virt_idx = prim->nvirtvoices;
+    buf->virt_since = get_time_us();
+    return TRUE;
+}
+
+void DSPrimary_removevirtual(DSPrimary *prim, DSBuffer *buf)
+{
+    DWORD i = buf->virt_idx;
+    DSBuffer *last;
+
+    if(!i) return;
+    buf->virt_idx = 0;
+    buf->isstolen = FALSE;
+    buf->isculled = FALSE;
+    prim->share->virtual_us += get_time_us() - buf->virt_since;
+    DSBuffer_Unride(buf);
+
+    last = prim->virtvoices[--prim->nvirtvoices];
+    if(--i < prim->nvirtvoices)
+    {
+        prim->virtvoices[i] = last;
+        last->virt_idx = i+1;
+    }
+}
+
+/* Moves one-shot voices that reached a quiet stretch off their source, ends
+ * virtual voices that reached their end, then gives sources back to the most
+ * important of the rest for as long as sources can be had. Voices merged into
+ * another instance are heard through its source, so they're only checked to
+ * still play the same. Should be called with the device lock held.
+ */
+void DSPrimary_updatevirtual(DSPrimary *prim)
+{
+    DWORD64 now = get_time_us();
+    DWORD i, pos;
+
+    if(CullThreshold)
+    {
+        for(i = 0;i < prim->NumBufferGroups;++i)
+        {
+            struct DSBufferGroup *group = &prim->BufferGroups[i];
+            DWORD64 usemask = group->PlayingBuffers & group->SourceBuffers;
+            while(usemask)
+            {
+                int idx = CTZ64(usemask);
+                DSBuffer *buf = group->Buffers + idx;
+                usemask &= ~(U64(1) << idx);
+
+                if(buf->env_deadline && buf->env_deadline <= now)
+                    DSBuffer_CheckEnvelope(buf, now);
+            }
+        }
+    }
+
+    if(prim->nvirtvoices == 0)
+        return;
+
+    i = prim->nvirtvoices;
+    while(i > 0)
+    {
+        DSBuffer *buf = prim->virtvoices[--i];
+
+        buf->islimited = FALSE;
+        buf->buffer->limit_checked = FALSE;
+        if(buf->carrier)
+            DSBuffer_CheckRider(buf);
+        if(DSBuffer_GetVirtualPos(buf, now, &pos))
+            continue;
+        /* Let the notification check see it end first. */
+        if(buf->notify_item.idx)
+        {
+            DSPrimary_addnotify(prim, buf);
+            continue;
+        }
+
+        EnterCriticalSection(&buf->crst);
+        if(buf->isstolen)
+            buf->vm_voicestate = DSPROPERTY_VMANAGER_STATE_BUMPED;
+        DSPrimary_removevirtual(prim, buf);
+        buf->lastpos = pos;
+        buf->isplaying = FALSE;
+        DSBuffer_Group(buf)->PlayingBuffers &= ~buf->group_bit;
+        LeaveCriticalSection(&buf->crst);
+    }
+
+    /* Restoring takes each buffer's lock, which comes before the context. */
+    while(prim->nvirtvoices > 0)
+    {
+        DSBuffer *best = NULL;
+        float best_gain = 0.0f;
+
+        for(i = 0;i < prim->nvirtvoices;++i)
+        {
+            DSBuffer *buf = prim->virtvoices[i];
+            float gain;
+
+            if(buf->carrier || buf->islimited || (best && buf->play_prio < best->play_prio) ||
+               !DSBuffer_GetVirtualPos(buf, now, &pos) || !DSBuffer_IsAudible(buf) ||
+               (!buf->isvirtlooping && DSBuffer_IsSilent(buf, pos)))
+                continue;
+            gain = DSBuffer_EstimateGain(buf);
+            if(!best || buf->play_prio > best->play_prio || gain > best_gain)
+            {
+                best = buf;
+                best_gain = gain;
+            }
+        }
+        if(!best || (!DSBuffer_RestoreVirtual(best, TRUE) && !best->islimited))
+            break;
+    }
+}
+
+/* Takes the device lock for each buffer checked, so API calls can get in
+ * between buffers.
+ */
 void DSPrimary_triggernots(DSPrimary *prim)
 {
-    DSBuffer **curnot, **endnot;
+    DeviceShare *share = prim->share;
+    DWORD64 now = get_time_us();
 
-    curnot = prim->notifies;
-    endnot = curnot + prim->nnotifies;
-    while(curnot != endnot)
+    for(;;)
     {
-        DSBuffer *buf = *curnot;
-        DSData *data = buf->buffer;
-        DWORD curpos = buf->lastpos;
+        struct NotifyItem *item;
+        DSBuffer *buf;
+        DSData *data;
+        DWORD curpos;
         ALint state = 0;
         ALint ofs;
 
-        alGetSourcei(buf->source, AL_BYTE_OFFSET, &ofs);
-        alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
-        if(buf->segsize == 0)
+        EnterCriticalSection(&share->crst);
+        /* Only check buffers whose next notification may be due. */
+        item = NotifyHeap_Top(&prim->notifies);
+        if(!item || item->deadline > now)
+        {
+            LeaveCriticalSection(&share->crst);
+            break;
+        }
+        buf = CONTAINING_RECORD(item, DSBuffer, notify_item);
+        data = buf->buffer;
+        curpos = buf->lastpos;
+
+        EnterCriticalSection(&buf->crst);
+        setALContext(prim->ctx);
+        if(buf->source)
+        {
+            alGetSourcei(buf->source, AL_BYTE_OFFSET, &ofs);
+            alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
+        }
+        if(buf->virt_idx)
+        {
+            /* Virtual voices advance by the clock until they end. */
+            if(DSBuffer_GetVirtualPos(buf, now, &curpos))
+                state = AL_PLAYING;
+        }
+        else if(!buf->source)
+        {
+            /* Without a source, it isn't playing. */
+        }
+        else if(buf->play_idx)
+        {
+            /* Starts with the next batch. */
+            state = AL_PLAYING;
+        }
+        else if(buf->segsize == 0)
             curpos = (state == AL_STOPPED) ? data->buf_size : ofs;
+        else if(buf->iscallback)
+        {
+            /* The callback stops feeding once a non-looping buffer reaches
+             * its end, so the source stopping means playback finished.
+             */
+            curpos = DSBuffer_CallbackPos(buf);
+            if(state == AL_STOPPED && buf->isplaying)
+            {
+                alSourcei(buf->source, AL_BUFFER, 0);
+                buf->isplaying = FALSE;
+            }
+            if(state != AL_PLAYING)
+                state = buf->isplaying ? AL_PLAYING : AL_PAUSED;
+        }
         else
         {
             if(state != AL_STOPPED)
@@ -151,22 +619,25 @@ void DSPrimary_triggernots(DSPrimary *prim)
 
         if(buf->lastpos != curpos)
         {
-            trigger_elapsed_notifies(buf, buf->lastpos, curpos);
+            if(trigger_elapsed_notifies(buf, buf->lastpos, curpos) && buf->notify_predict)
+                record_notify_lateness(prim, buf->notify_predict, now);
             buf->lastpos = curpos;
         }
         if(state != AL_PLAYING)
         {
-            /* Remove this buffer from list and put another at the current
-             * position; don't increment i
-             */
             trigger_stop_notifies(buf);
-            *curnot = *(--endnot);
-            prim->nnotifies--;
-            continue;
+            DSPrimary_removenotify(prim, buf);
+        }
+        else
+        {
+            buf->notify_predict = predict_notify_time(buf, curpos, now);
+            NotifyHeap_Schedule(&prim->notifies, item, buf->notify_predict);
         }
-        curnot++;
+
+        popALContext();
+        LeaveCriticalSection(&buf->crst);
+        LeaveCriticalSection(&share->crst);
     }
-    checkALError();
 }
 
 static void do_buffer_stream(DSBuffer *buf, BYTE *scratch_mem)
@@ -175,6 +646,8 @@ static void do_buffer_stream(DSBuffer *buf, BYTE *scratch_mem)
     ALint ofs, done = 0, queued = QBUFFERS, state = AL_PLAYING;
     ALuint which;
 
+    DSBuffer_UpdateStream(buf, FALSE);
+
     alGetSourcei(buf->source, AL_BUFFERS_QUEUED, &queued);
     alGetSourcei(buf->source, AL_SOURCE_STATE, &state);
     alGetSourcei(buf->source, AL_BUFFERS_PROCESSED, &done);
@@ -187,7 +660,7 @@ static void do_buffer_stream(DSBuffer *buf, BYTE *scratch_mem)
         alSourceUnqueueBuffers(buf->source, done, bids);
         buf->queue_base = (buf->queue_base + buf->segsize*done) % data->buf_size;
     }
-    while(queued < QBUFFERS)
+    while(queued < buf->queue_size)
     {
         which = buf->stream_bids[buf->curidx];
         ofs = buf->data_offset;
@@ -200,19 +673,28 @@ static void do_buffer_stream(DSBuffer *buf, BYTE *scratch_mem)
         }
         else if(buf->islooping)
         {
-            ALsizei rem = data->buf_size - ofs;
-            if(rem > 2048) rem = 2048;
+            const BYTE *src = data->data + ofs;
 
-            memcpy(scratch_mem, data->data + ofs, rem);
-            while(rem < buf->segsize)
+            /* The mirrored start of the data makes the wrapped segment
+             * contiguous, unless the whole buffer is smaller than a segment.
+             */
+            if(buf->segsize > data->mirror_size || buf->segsize > data->buf_size)
             {
-                ALsizei todo = buf->segsize - rem;
-                if(todo > data->buf_size)
-                    todo = data->buf_size;
-                memcpy(scratch_mem + rem, data->data, todo);
-                rem += todo;
+                ALsizei rem = data->buf_size - ofs;
+                if(rem > 2048) rem = 2048;
+
+                memcpy(scratch_mem, data->data + ofs, rem);
+                while(rem < buf->segsize)
+                {
+                    ALsizei todo = buf->segsize - rem;
+                    if(todo > data->buf_size)
+                        todo = data->buf_size;
+                    memcpy(scratch_mem + rem, data->data, todo);
+                    rem += todo;
+                }
+                src = scratch_mem;
             }
-            alBufferData(which, data->buf_format, scratch_mem, buf->segsize,
+            alBufferData(which, data->buf_format, src, buf->segsize,
                          data->format.Format.nSamplesPerSec);
             buf->data_offset = (ofs+buf->segsize) % data->buf_size;
         }
@@ -243,39 +725,78 @@ static void do_buffer_stream(DSBuffer *buf, BYTE *scratch_mem)
         buf->isplaying = FALSE;
     }
     else if(state != AL_PLAYING)
+    {
+        /* A stopped source with more data to play ran out of queued data. */
+        if(state == AL_STOPPED)
+        {
+            buf->underruns++;
+            buf->clean_refills = 0;
+            WARN("Buffer %p underrun (%lu recent)\n", buf, buf->underruns);
+        }
         alSourcePlay(buf->source);
+    }
+    else if(buf->underruns && ++buf->clean_refills*buf->share->tick_period >= 1000)
+    {
+        /* Let the queue shrink back as underruns stop happening. */
+        buf->underruns--;
+        buf->clean_refills = 0;
+    }
+}
+
+static void feed_buffer(DSBuffer *buf, BYTE *scratch_mem)
+{
+    EnterCriticalSection(&buf->crst);
+    setALContext(buf->ctx);
+    if(buf->isplaying)
+        do_buffer_stream(buf, scratch_mem);
+    if(!buf->isplaying)
+        DSBuffer_Group(buf)->StreamBuffers &= ~buf->group_bit;
+    checkALError();
+    popALContext();
+    LeaveCriticalSection(&buf->crst);
 }
 
+/* Like DSPrimary_triggernots, the device lock is only held while feeding each
+ * buffer. The stream set is rechecked each time since buffers may have been
+ * stopped or released in between.
+ */
 void DSPrimary_streamfeeder(DSPrimary *prim, BYTE *scratch_mem)
 {
+    DeviceShare *share = prim->share;
+    DWORD i;
+
     /* OpenAL doesn't support our lovely buffer extensions so just make sure
      * enough buffers are queued for streaming
      */
+    EnterCriticalSection(&share->crst);
     if(prim->write_emu)
     {
         DSBuffer *buf = CONTAINING_RECORD(prim->write_emu, DSBuffer, IDirectSoundBuffer8_iface);
-        if(buf->segsize != 0 && buf->isplaying)
-            do_buffer_stream(buf, scratch_mem);
+        if(buf->segsize != 0 && !buf->iscallback && buf->isplaying)
+            feed_buffer(buf, scratch_mem);
+        LeaveCriticalSection(&share->crst);
+        return;
     }
-    else
+
+    for(i = 0;i < prim->NumBufferGroups;++i)
     {
-        struct DSBufferGroup *bufgroup = prim->BufferGroups;
-        struct DSBufferGroup *endgroup = bufgroup + prim->NumBufferGroups;
-        for(;bufgroup != endgroup;++bufgroup)
+        DWORD64 usemask = prim->BufferGroups[i].StreamBuffers;
+        LeaveCriticalSection(&share->crst);
+
+        while(usemask)
         {
-            DWORD64 usemask = ~bufgroup->FreeBuffers;
-            while(usemask)
-            {
-                int idx = CTZ64(usemask);
-                DSBuffer *buf = bufgroup->Buffers + idx;
-                usemask &= ~(U64(1) << idx);
+            int idx = CTZ64(usemask);
+            usemask &= ~(U64(1) << idx);
 
-                if(buf->segsize != 0 && buf->isplaying)
-                    do_buffer_stream(buf, scratch_mem);
-            }
+            EnterCriticalSection(&share->crst);
+            if((prim->BufferGroups[i].StreamBuffers & (U64(1) << idx)))
+                feed_buffer(prim->BufferGroups[i].Buffers + idx, scratch_mem);
+            LeaveCriticalSection(&share->crst);
         }
+
+        EnterCriticalSection(&share->crst);
     }
-    checkALError();
+    LeaveCriticalSection(&share->crst);
 }
 
 
@@ -316,11 +837,12 @@ HRESULT DSPrimary_PreInit(DSPrimary *This, DSDevice *parent)
     num_srcs = This->share->sources.maxhw_alloc + This->share->sources.maxsw_alloc;
 
     hr = DSERR_OUTOFMEMORY;
-    This->notifies = HeapAlloc(GetProcessHeap(), 0, num_srcs*sizeof(*This->notifies));
-    if(!This->notifies) goto fail;
-    This->sizenotifies = num_srcs;
+    if(!NotifyHeap_Init(&This->notifies, num_srcs)) goto fail;
 
     count = (MAX_HWBUFFERS+63) / 64;
+    This->dirtybufs = HeapAlloc(GetProcessHeap(), 0, count*64*sizeof(*This->dirtybufs));
+    if(!This->dirtybufs) goto fail;
+
     This->BufferGroups = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
                                    count*sizeof(*This->BufferGroups));
     if(!This->BufferGroups) goto fail;
@@ -371,8 +893,19 @@ void DSPrimary_Clear(DSPrimary *This)
         HeapFree(GetProcessHeap(), 0, This->BufferGroups[i].Buffers);
     }
 
+    TRACE("Notification lateness histogram (<1, <2, <5, <10, <20, <50, <100, >=100ms): "
+          "%lu %lu %lu %lu %lu %lu %lu %lu\n", This->notify_lateness[0],
+          This->notify_lateness[1], This->notify_lateness[2], This->notify_lateness[3],
+          This->notify_lateness[4], This->notify_lateness[5], This->notify_lateness[6],
+          This->notify_lateness[7]);
+
     HeapFree(GetProcessHeap(), 0, This->BufferGroups);
-    HeapFree(GetProcessHeap(), 0, This->notifies);
+    NotifyHeap_Clear(&This->notifies);
+    HeapFree(GetProcessHeap(), 0, This->dirtybufs);
+    HeapFree(GetProcessHeap(), 0, This->plays);
+    HeapFree(GetProcessHeap(), 0, This->virtvoices);
+    HeapFree(GetProcessHeap(), 0, This->eax_pending);
+    EAXMirror_Clear(&This->eax);
     memset(This, 0, sizeof(*This));
 }
 
@@ -582,9 +1115,9 @@ static HRESULT WINAPI DSPrimary_GetStatus(IDirectSoundBuffer *iface, DWORD *stat
         DWORD i, state = 0;
         HRESULT hr;
 
-        for(i = 0;i < This->NumBufferGroups;++i)
+        for(i = 0;i < This->NumBufferGroups && !(state&DSBSTATUS_PLAYING);++i)
         {
-            DWORD64 usemask = ~bufgroup[i].FreeBuffers;
+            DWORD64 usemask = bufgroup[i].PlayingBuffers;
             while(usemask)
             {
                 int idx = CTZ64(usemask);
@@ -593,6 +1126,7 @@ static HRESULT WINAPI DSPrimary_GetStatus(IDirectSoundBuffer *iface, DWORD *stat
 
                 hr = DSBuffer_GetStatus(&buf->IDirectSoundBuffer8_iface, &state);
                 if(SUCCEEDED(hr) && (state&DSBSTATUS_PLAYING)) break;
+                bufgroup[i].PlayingBuffers &= ~(U64(1) << idx);
             }
         }
         if(!(state&DSBSTATUS_PLAYING))
@@ -694,6 +1228,7 @@ HRESULT WINAPI DSPrimary_Initialize(IDirectSoundBuffer *iface, IDirectSound *ds,
             dirty.bit.rollofffactor = 1;
             dirty.bit.dopplerfactor = 1;
             DSPrimary_SetParams(This, &This->deferred.ds3d, dirty.flags);
+            This->sent_valid = TRUE;
         }
     }
     return hr;
@@ -1039,10 +1574,57 @@ static IDirectSoundBufferVtbl DSPrimary_Vtbl =
 };
 
 
+/* Starts a new rolloff epoch for the current rolloff factor, and applies it
+ * to the buffers that are playing. Should be called with the device lock
+ * held.
+ */
+static void DSPrimary_UpdateRolloff(DSPrimary *This)
+{
+    struct DSBufferGroup *bufgroup = This->BufferGroups;
+    DWORD i;
+
+    This->rolloff_epoch++;
+    for(i = 0;i < This->NumBufferGroups;++i)
+    {
+        DWORD64 usemask = bufgroup[i].PlayingBuffers & bufgroup[i].SourceBuffers;
+        while(usemask)
+        {
+            int idx = CTZ64(usemask);
+            usemask &= ~(U64(1) << idx);
+
+            DSBuffer_UpdateRolloff(bufgroup[i].Buffers + idx);
+        }
+    }
+}
+
 static void DSPrimary_SetParams(DSPrimary *This, const DS3DLISTENER *params, LONG flags)
 {
+    const DS3DLISTENER *cur = &This->current.ds3d;
     union PrimaryParamFlags dirty = { flags };
-    DWORD i;
+    union PrimaryParamFlags send = { flags };
+
+    /* Drop updates that won't change what OpenAL has, and position changes
+     * within the tolerance.
+     */
+    if(This->sent_valid)
+    {
+        if(send.bit.pos && !vector_changed(&This->sent_pos, &params->vPosition, PositionTolerance))
+            send.bit.pos = 0;
+        if(send.bit.vel && !vector_changed(&cur->vVelocity, &params->vVelocity, 0.0f))
+            send.bit.vel = 0;
+        if(send.bit.orientation &&
+           !vector_changed(&cur->vOrientFront, &params->vOrientFront, 0.0f) &&
+           !vector_changed(&cur->vOrientTop, &params->vOrientTop, 0.0f))
+            send.bit.orientation = 0;
+        if(send.bit.distancefactor && cur->flDistanceFactor == params->flDistanceFactor)
+            send.bit.distancefactor = 0;
+        if(send.bit.rollofffactor && cur->flRolloffFactor == params->flRolloffFactor)
+            send.bit.rollofffactor = 0;
+        if(send.bit.dopplerfactor && cur->flDopplerFactor == params->flDopplerFactor)
+            send.bit.dopplerfactor = 0;
+    }
+    DSShare_CountUpdates(This->share, POPCNT64((DWORD)send.flags),
+                         POPCNT64((DWORD)(dirty.flags & ~send.flags)));
 
     if(dirty.bit.pos)
         This->current.ds3d.vPosition = params->vPosition;
@@ -1060,13 +1642,16 @@ static void DSPrimary_SetParams(DSPrimary *This, const DS3DLISTENER *params, LON
     if(dirty.bit.dopplerfactor)
         This->current.ds3d.flDopplerFactor = params->flDopplerFactor;
 
-    if(dirty.bit.pos)
+    if(send.bit.pos)
+    {
         alListener3f(AL_POSITION, params->vPosition.x, params->vPosition.y,
                                  -params->vPosition.z);
-    if(dirty.bit.vel)
+        This->sent_pos = params->vPosition;
+    }
+    if(send.bit.vel)
         alListener3f(AL_VELOCITY, params->vVelocity.x, params->vVelocity.y,
                                  -params->vVelocity.z);
-    if(dirty.bit.orientation)
+    if(send.bit.orientation)
     {
         ALfloat orient[6] = {
             params->vOrientFront.x, params->vOrientFront.y, -params->vOrientFront.z,
@@ -1074,28 +1659,11 @@ static void DSPrimary_SetParams(DSPrimary *This, const DS3DLISTENER *params, LON
         };
         alListenerfv(AL_ORIENTATION, orient);
     }
-    if(dirty.bit.distancefactor)
+    if(send.bit.distancefactor)
         alSpeedOfSound(343.3f/params->flDistanceFactor);
-    if(dirty.bit.rollofffactor)
-    {
-        struct DSBufferGroup *bufgroup = This->BufferGroups;
-        ALfloat rolloff = params->flRolloffFactor;
-
-        for(i = 0;i < This->NumBufferGroups;++i)
-        {
-            DWORD64 usemask = ~bufgroup[i].FreeBuffers;
-            while(usemask)
-            {
-                int idx = CTZ64(usemask);
-                DSBuffer *buf = bufgroup[i].Buffers + idx;
-                usemask &= ~(U64(1) << idx);
-
-                if(buf->source)
-                    alSourcef(buf->source, AL_ROLLOFF_FACTOR, rolloff);
-            }
-        }
-    }
-    if(dirty.bit.dopplerfactor)
+    if(send.bit.rollofffactor)
+        DSPrimary_UpdateRolloff(This);
+    if(send.bit.dopplerfactor)
         alDopplerFactor(params->flDopplerFactor);
 }
 
@@ -1418,29 +1986,10 @@ static HRESULT WINAPI DSPrimary3D_SetRolloffFactor(IDirectSound3DListener *iface
         This->deferred.ds3d.flRolloffFactor = factor;
         This->dirty.bit.rollofffactor = 1;
     }
-    else
+    else if(This->current.ds3d.flRolloffFactor != factor)
     {
-        struct DSBufferGroup *bufgroup = This->BufferGroups;
-        DWORD i;
-
         This->current.ds3d.flRolloffFactor = factor;
-
-        setALContext(This->ctx);
-        for(i = 0;i < This->NumBufferGroups;++i)
-        {
-            DWORD64 usemask = ~bufgroup[i].FreeBuffers;
-            while(usemask)
-            {
-                int idx = CTZ64(usemask);
-                DSBuffer *buf = bufgroup[i].Buffers + idx;
-                usemask &= ~(U64(1) << idx);
-
-                if(buf->source)
-                    alSourcef(buf->source, AL_ROLLOFF_FACTOR, factor);
-            }
-        }
-        checkALError();
-        popALContext();
+        DSPrimary_UpdateRolloff(This);
     }
     LeaveCriticalSection(&This->share->crst);
 
@@ -1546,7 +2095,7 @@ static HRESULT WINAPI DSPrimary3D_SetAllParameters(IDirectSound3DListener *iface
 HRESULT WINAPI DSPrimary3D_CommitDeferredSettings(IDirectSound3DListener *iface)
 {
     DSPrimary *This = impl_from_IDirectSound3DListener(iface);
-    struct DSBufferGroup *bufgroup;
+    BOOL listener_moved, cull_all;
     LONG flags;
     DWORD i;
 
@@ -1561,25 +2110,86 @@ HRESULT WINAPI DSPrimary3D_CommitDeferredSettings(IDirectSound3DListener *iface)
         checkALError();
     }
     TRACE("Dirty flags was: 0x%02lx\n", flags);
+    /* A listener change can make any voice inaudible, otherwise only the
+     * buffers that changed need checking.
+     */
+    listener_moved = (flags != 0);
+    cull_all = CullThreshold && listener_moved;
+    popALContext();
 
-    bufgroup = This->BufferGroups;
-    for(i = 0;i < This->NumBufferGroups;++i)
+    /* Buffer locks come before the context, as with the setters, so the
+     * context is set again for each buffer. Updates stay deferred until
+     * they're processed below.
+     */
+    for(i = 0;i < This->ndirtybufs;++i)
     {
-        DWORD64 usemask = ~bufgroup[i].FreeBuffers;
-        while(usemask)
+        DSBuffer *buf = This->dirtybufs[i];
+        buf->dirty_idx = 0;
+
+        EnterCriticalSection(&buf->crst);
+        if((flags=InterlockedExchange(&buf->dirty.flags, 0)) != 0)
         {
-            int idx = CTZ64(usemask);
-            DSBuffer *buf = bufgroup[i].Buffers + idx;
-            usemask &= ~(U64(1) << idx);
+            setALContext(buf->ctx);
+            DSBuffer_SetParams(buf, &buf->deferred.ds3d, flags);
+            DSBuffer_UpdateResampler(buf);
+            popALContext();
+        }
+        LeaveCriticalSection(&buf->crst);
+    }
+
+    /* The listener's position and velocity also go into the resampler each
+     * playing voice should use.
+     */
+    if(listener_moved && ResamplerPolicy)
+    {
+        struct DSBufferGroup *bufgroup = This->BufferGroups;
+        for(i = 0;i < This->NumBufferGroups;++i)
+        {
+            DWORD64 usemask = bufgroup[i].PlayingBuffers & bufgroup[i].SourceBuffers;
+            while(usemask)
+            {
+                int idx = CTZ64(usemask);
+                DSBuffer *buf = bufgroup[i].Buffers + idx;
+                usemask &= ~(U64(1) << idx);
 
-            if((flags=InterlockedExchange(&buf->dirty.flags, 0)) != 0)
-                DSBuffer_SetParams(buf, &buf->deferred.ds3d, flags);
+                EnterCriticalSection(&buf->crst);
+                setALContext(buf->ctx);
+                DSBuffer_UpdateResampler(buf);
+                popALContext();
+                LeaveCriticalSection(&buf->crst);
+            }
         }
     }
+
+    setALContext(This->ctx);
     alProcessUpdatesSOFT();
     checkALError();
-
     popALContext();
+
+    /* Culling takes each buffer's lock, so it's done out of the context. */
+    if(cull_all)
+    {
+        struct DSBufferGroup *bufgroup = This->BufferGroups;
+        for(i = 0;i < This->NumBufferGroups;++i)
+        {
+            DWORD64 usemask = bufgroup[i].PlayingBuffers & bufgroup[i].SourceBuffers;
+            while(usemask)
+            {
+                int idx = CTZ64(usemask);
+                usemask &= ~(U64(1) << idx);
+                DSBuffer_Cull(bufgroup[i].Buffers + idx);
+            }
+        }
+    }
+    else if(CullThreshold)
+    {
+        for(i = 0;i < This->ndirtybufs;++i)
+            DSBuffer_Cull(This->dirtybufs[i]);
+    }
+    This->ndirtybufs = 0;
+
+    /* Start buffers played since the last commit with the new parameters. */
+    DSPrimary_flushplays(This);
     LeaveCriticalSection(&This->share->crst);
 
     return DS_OK;
@@ -0,0 +1,477 @@
+/* DirectSound buffer property sets
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* What the wrapper knows of each buffer property set, and the EAX values it
+ * keeps. Nothing here calls into Windows or OpenAL, so it can be tested on
+ * its own.
+ */
+
+#include <string.h>
+
+#include "propinfo.h"
+
+
+/*******************
+ * Property sets
+ ******************/
+
+/* Smallest data size of each property, by property id. */
+static const ULONG EAX4SourceSizes[] = {
+    0, sizeof(EAX30SOURCEPROPERTIES), sizeof(EAXOBSTRUCTIONPROPERTIES),
+    sizeof(EAXOCCLUSIONPROPERTIES), sizeof(EAXEXCLUSIONPROPERTIES),
+    sizeof(long), sizeof(long), sizeof(long), sizeof(long), /* Direct..RoomHF */
+    sizeof(long), sizeof(float), /* Obstruction */
+    sizeof(long), sizeof(float), sizeof(float), sizeof(float), /* Occlusion */
+    sizeof(long), sizeof(float), /* Exclusion */
+    sizeof(long), sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(DWORD),
+    /* Sends are given for one or more effect slots. */
+    sizeof(EAXSOURCESENDPROPERTIES), sizeof(EAXSOURCEALLSENDPROPERTIES),
+    sizeof(EAXSOURCEOCCLUSIONSENDPROPERTIES), sizeof(EAXSOURCEEXCLUSIONSENDPROPERTIES),
+    sizeof(GUID) /* ActiveFXSlotID, one or more slots */
+};
+static const ULONG EAX3BufferSizes[] = {
+    0, sizeof(EAX30BUFFERPROPERTIES), sizeof(EAXOBSTRUCTIONPROPERTIES),
+    sizeof(EAXOCCLUSIONPROPERTIES), sizeof(EAXEXCLUSIONPROPERTIES),
+    sizeof(long), sizeof(long), sizeof(long), sizeof(long), /* Direct..RoomHF */
+    sizeof(long), sizeof(float), /* Obstruction */
+    sizeof(long), sizeof(float), sizeof(float), sizeof(float), /* Occlusion */
+    sizeof(long), sizeof(float), /* Exclusion */
+    sizeof(long), sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(DWORD)
+};
+static const ULONG EAX2BufferSizes[] = {
+    0, sizeof(EAX20BUFFERPROPERTIES),
+    sizeof(long), sizeof(long), sizeof(long), sizeof(long), sizeof(float), /* Direct..Room */
+    sizeof(long), sizeof(float), /* Obstruction */
+    sizeof(long), sizeof(float), sizeof(float), /* Occlusion */
+    sizeof(long), sizeof(float), sizeof(DWORD)
+};
+static const ULONG EAX1BufferSizes[] = {
+    sizeof(EAX10BUFFERPROPERTIES), sizeof(float)
+};
+static const ULONG EAX4ContextSizes[] = {
+    0, sizeof(EAXCONTEXTPROPERTIES), sizeof(GUID), sizeof(float), sizeof(float), sizeof(float),
+    sizeof(long)
+};
+/* Slot properties past the effect's parameters, from EAXFXSLOT_NONE. */
+static const ULONG EAX4SlotSizes[] = {
+    0, sizeof(EAXFXSLOTPROPERTIES), sizeof(GUID), sizeof(long), sizeof(long), sizeof(DWORD)
+};
+static const ULONG EAX3ListenerSizes[] = {
+    0, sizeof(EAX30LISTENERPROPERTIES),
+    sizeof(DWORD), sizeof(float), sizeof(float), /* Environment */
+    sizeof(long), sizeof(long), sizeof(long), /* Room */
+    sizeof(float), sizeof(float), sizeof(float), /* Decay */
+    sizeof(long), sizeof(float), sizeof(EAXVECTOR), /* Reflections */
+    sizeof(long), sizeof(float), sizeof(EAXVECTOR), /* Reverb */
+    sizeof(float), sizeof(float), sizeof(float), sizeof(float), /* Echo, modulation */
+    sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(DWORD)
+};
+static const ULONG EAX2ListenerSizes[] = {
+    0, sizeof(EAX20LISTENERPROPERTIES),
+    sizeof(long), sizeof(long), sizeof(float), /* Room */
+    sizeof(float), sizeof(float), /* Decay */
+    sizeof(long), sizeof(float), sizeof(long), sizeof(float), /* Reflections, reverb */
+    sizeof(DWORD), sizeof(float), sizeof(float), /* Environment */
+    sizeof(float), sizeof(DWORD)
+};
+static const ULONG EAX1ListenerSizes[] = {
+    sizeof(EAX10LISTENERPROPERTIES), sizeof(DWORD), sizeof(float), sizeof(float), sizeof(float)
+};
+static const ULONG VoiceManSizes[] = {
+    sizeof(DWORD), sizeof(DWORD), sizeof(DWORD)
+};
+
+#define PROP_SIZES(first, sizes) (first), sizeof(sizes)/sizeof(sizes[0]), (sizes)
+#define EAX_HANDLERS DSBuffer_GetEAX, DSBuffer_SetEAX
+
+static const struct PropSetInfo PropSets[] = {
+    { &EAXPROPERTYID_EAX40_Source, PROPSET_EAX40_SOURCE, PROPSET_EAX|PROPSET_SOURCE,
+      PROP_SIZES(0, EAX4SourceSizes), EAX_HANDLERS, EAX4Source_Query, NULL },
+    { &DSPROPSETID_EAX30_BufferProperties, PROPSET_EAX30_BUFFER, PROPSET_EAX|PROPSET_SOURCE,
+      PROP_SIZES(0, EAX3BufferSizes), EAX_HANDLERS, EAX3Buffer_Query, NULL },
+    { &DSPROPSETID_EAX20_BufferProperties, PROPSET_EAX20_BUFFER, PROPSET_EAX|PROPSET_SOURCE,
+      PROP_SIZES(0, EAX2BufferSizes), EAX_HANDLERS, EAX2Buffer_Query, NULL },
+    { &DSPROPSETID_EAX10_BufferProperties, PROPSET_EAX10_BUFFER, PROPSET_EAX|PROPSET_SOURCE,
+      PROP_SIZES(0, EAX1BufferSizes), EAX_HANDLERS, EAX1Buffer_Query, NULL },
+    { &EAXPROPERTYID_EAX40_Context, PROPSET_EAX40_CONTEXT, PROPSET_EAX,
+      PROP_SIZES(0, EAX4ContextSizes), EAX_HANDLERS, NULL, EAX4Context_Query },
+    { &EAXPROPERTYID_EAX40_FXSlot0, PROPSET_EAX40_FXSLOT, PROPSET_EAX,
+      PROP_SIZES(EAXFXSLOT_NONE, EAX4SlotSizes), EAX_HANDLERS, NULL, EAX4Slot_Query },
+    { &EAXPROPERTYID_EAX40_FXSlot1, PROPSET_EAX40_FXSLOT, PROPSET_EAX,
+      PROP_SIZES(EAXFXSLOT_NONE, EAX4SlotSizes), EAX_HANDLERS, NULL, EAX4Slot_Query },
+    { &EAXPROPERTYID_EAX40_FXSlot2, PROPSET_EAX40_FXSLOT, PROPSET_EAX,
+      PROP_SIZES(EAXFXSLOT_NONE, EAX4SlotSizes), EAX_HANDLERS, NULL, EAX4Slot_Query },
+    { &EAXPROPERTYID_EAX40_FXSlot3, PROPSET_EAX40_FXSLOT, PROPSET_EAX,
+      PROP_SIZES(EAXFXSLOT_NONE, EAX4SlotSizes), EAX_HANDLERS, NULL, EAX4Slot_Query },
+    { &DSPROPSETID_EAX30_ListenerProperties, PROPSET_EAX30_LISTENER, PROPSET_EAX,
+      PROP_SIZES(0, EAX3ListenerSizes), EAX_HANDLERS, NULL, EAX3_Query },
+    { &DSPROPSETID_EAX20_ListenerProperties, PROPSET_EAX20_LISTENER, PROPSET_EAX,
+      PROP_SIZES(0, EAX2ListenerSizes), EAX_HANDLERS, NULL, EAX2_Query },
+    { &DSPROPSETID_EAX10_ListenerProperties, PROPSET_EAX10_LISTENER, PROPSET_EAX,
+      PROP_SIZES(0, EAX1ListenerSizes), EAX_HANDLERS, NULL, EAX1_Query },
+    { &DSPROPSETID_VoiceManager, PROPSET_VOICEMANAGER, 0,
+      PROP_SIZES(0, VoiceManSizes), VoiceMan_Get, VoiceMan_Set, VoiceMan_Query, NULL },
+};
+
+#undef EAX_HANDLERS
+#undef PROP_SIZES
+
+/* Finds how a property set is handled, or NULL if it isn't. The sets' first
+ * 32 bits all differ, so those are compared before the rest.
+ */
+const struct PropSetInfo *PropSet_Find(REFGUID guid)
+{
+    size_t i;
+
+    for(i = 0;i < sizeof(PropSets)/sizeof(PropSets[0]);++i)
+    {
+        if(PropSets[i].guid->Data1 == guid->Data1 && IsEqualGUID(PropSets[i].guid, guid))
+            return &PropSets[i];
+    }
+    return NULL;
+}
+
+/* Checks the data is big enough for the property. The deferred flag of EAX
+ * properties is ignored.
+ */
+BOOL PropSet_CheckSize(const struct PropSetInfo *set, DWORD propid, ULONG size)
+{
+    propid &= ~0x80000000ul;
+    if(propid < set->first_prop || propid-set->first_prop >= set->nprops)
+        return TRUE;
+    return size >= set->prop_sizes[propid-set->first_prop];
+}
+
+
+/*******************
+ * EAX state mirror
+ ******************/
+
+enum EAXPropKind {
+    /* Not kept, and may change any other property of the object. */
+    EAXPROP_UNTRACKED,
+    /* A single value, independent of the set's other single values. */
+    EAXPROP_FIELD,
+    /* Several values at once. */
+    EAXPROP_GROUP,
+    /* Applies the deferred values. */
+    EAXPROP_COMMIT,
+    /* Per effect slot values, kept for a new source but not answered from. */
+    EAXPROP_SEND
+};
+
+static enum EAXPropKind eax_prop_kind(REFGUID guid, DWORD propid)
+{
+    const struct PropSetInfo *set = PropSet_Find(guid);
+
+    if(!set) return EAXPROP_UNTRACKED;
+    switch(set->id)
+    {
+    case PROPSET_EAX40_SOURCE:
+        switch(propid)
+        {
+        case EAXSOURCE_NONE:
+            return EAXPROP_COMMIT;
+        case EAXSOURCE_ALLPARAMETERS:
+        case EAXSOURCE_OBSTRUCTIONPARAMETERS:
+        case EAXSOURCE_OCCLUSIONPARAMETERS:
+        case EAXSOURCE_EXCLUSIONPARAMETERS:
+            return EAXPROP_GROUP;
+        case EAXSOURCE_SENDPARAMETERS:
+        case EAXSOURCE_ALLSENDPARAMETERS:
+        case EAXSOURCE_OCCLUSIONSENDPARAMETERS:
+        case EAXSOURCE_EXCLUSIONSENDPARAMETERS:
+            return EAXPROP_SEND;
+        }
+        return (propid <= EAXSOURCE_ACTIVEFXSLOTID) ? EAXPROP_FIELD : EAXPROP_UNTRACKED;
+    case PROPSET_EAX30_BUFFER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX30BUFFER_NONE:
+            return EAXPROP_COMMIT;
+        case DSPROPERTY_EAX30BUFFER_ALLPARAMETERS:
+        case DSPROPERTY_EAX30BUFFER_OBSTRUCTIONPARAMETERS:
+        case DSPROPERTY_EAX30BUFFER_OCCLUSIONPARAMETERS:
+        case DSPROPERTY_EAX30BUFFER_EXCLUSIONPARAMETERS:
+            return EAXPROP_GROUP;
+        }
+        return (propid <= DSPROPERTY_EAX30BUFFER_FLAGS) ? EAXPROP_FIELD : EAXPROP_UNTRACKED;
+    case PROPSET_EAX20_BUFFER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX20BUFFER_NONE:
+            return EAXPROP_COMMIT;
+        case DSPROPERTY_EAX20BUFFER_ALLPARAMETERS:
+            return EAXPROP_GROUP;
+        }
+        return (propid <= DSPROPERTY_EAX20BUFFER_FLAGS) ? EAXPROP_FIELD : EAXPROP_UNTRACKED;
+    case PROPSET_EAX10_BUFFER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX10BUFFER_ALL:
+            return EAXPROP_GROUP;
+        case DSPROPERTY_EAX10BUFFER_REVERBMIX:
+            return EAXPROP_FIELD;
+        }
+        return EAXPROP_UNTRACKED;
+
+    /* Environment presets and sizes change the other reverb properties. */
+    case PROPSET_EAX30_LISTENER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX30LISTENER_NONE:
+            return EAXPROP_COMMIT;
+        case DSPROPERTY_EAX30LISTENER_ALLPARAMETERS:
+            return EAXPROP_GROUP;
+        case DSPROPERTY_EAX30LISTENER_ENVIRONMENT:
+        case DSPROPERTY_EAX30LISTENER_ENVIRONMENTSIZE:
+            return EAXPROP_UNTRACKED;
+        }
+        return (propid <= DSPROPERTY_EAX30LISTENER_FLAGS) ? EAXPROP_FIELD : EAXPROP_UNTRACKED;
+    case PROPSET_EAX20_LISTENER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX20LISTENER_NONE:
+            return EAXPROP_COMMIT;
+        case DSPROPERTY_EAX20LISTENER_ALLPARAMETERS:
+            return EAXPROP_GROUP;
+        case DSPROPERTY_EAX20LISTENER_ENVIRONMENT:
+        case DSPROPERTY_EAX20LISTENER_ENVIRONMENTSIZE:
+            return EAXPROP_UNTRACKED;
+        }
+        return (propid <= DSPROPERTY_EAX20LISTENER_FLAGS) ? EAXPROP_FIELD : EAXPROP_UNTRACKED;
+    case PROPSET_EAX10_LISTENER:
+        switch(propid)
+        {
+        case DSPROPERTY_EAX10LISTENER_VOLUME:
+        case DSPROPERTY_EAX10LISTENER_DECAYTIME:
+        case DSPROPERTY_EAX10LISTENER_DAMPING:
+            return EAXPROP_FIELD;
+        }
+        return EAXPROP_UNTRACKED;
+    case PROPSET_EAX40_CONTEXT:
+        switch(propid)
+        {
+        case EAXCONTEXT_NONE:
+            return EAXPROP_COMMIT;
+        case EAXCONTEXT_ALLPARAMETERS:
+            return EAXPROP_GROUP;
+        case EAXCONTEXT_PRIMARYFXSLOTID:
+        case EAXCONTEXT_DISTANCEFACTOR:
+        case EAXCONTEXT_AIRABSORPTIONHF:
+        case EAXCONTEXT_HFREFERENCE:
+            return EAXPROP_FIELD;
+        }
+        return EAXPROP_UNTRACKED;
+
+    /* Effect slot properties depend on the loaded effect. */
+    case PROPSET_EAX40_FXSLOT:
+    case PROPSET_VOICEMANAGER:
+        break;
+    }
+    return EAXPROP_UNTRACKED;
+}
+
+/* Size of each effect slot's entry in a send property's array. */
+static ULONG eax_send_size(DWORD propid)
+{
+    switch(propid)
+    {
+    case EAXSOURCE_SENDPARAMETERS: return sizeof(EAXSOURCESENDPROPERTIES);
+    case EAXSOURCE_ALLSENDPARAMETERS: return sizeof(EAXSOURCEALLSENDPROPERTIES);
+    case EAXSOURCE_OCCLUSIONSENDPARAMETERS: return sizeof(EAXSOURCEOCCLUSIONSENDPROPERTIES);
+    case EAXSOURCE_EXCLUSIONSENDPARAMETERS: return sizeof(EAXSOURCEEXCLUSIONSENDPROPERTIES);
+    }
+    return 0;
+}
+
+/* Returns the place for a new value, moving val there if it's being replaced.
+ * Keeps the values in the order they were set, so overlapping ones given to a
+ * new source end up the same.
+ */
+static struct EAXValue *eax_mirror_last(struct EAXMirror *mirror, struct EAXValue *val)
+{
+    if(val)
+    {
+        DWORD idx = (DWORD)(val - mirror->vals);
+        memmove(val, val+1, (mirror->count-idx-1) * sizeof(*val));
+        return &mirror->vals[mirror->count-1];
+    }
+
+    if(mirror->count == mirror->size)
+    {
+        DWORD newsize = mirror->size ? mirror->size*2 : 4;
+        struct EAXValue *list;
+
+        if(mirror->vals)
+            list = HeapReAlloc(GetProcessHeap(), 0, mirror->vals, newsize * sizeof(*list));
+        else
+            list = HeapAlloc(GetProcessHeap(), 0, newsize * sizeof(*list));
+        if(!list) return NULL;
+        mirror->vals = list;
+        mirror->size = newsize;
+    }
+    return &mirror->vals[mirror->count++];
+}
+
+/* Records each effect slot's entry of a send property set on its own, so the
+ * sends for every slot are given to a new source.
+ */
+static void eax_mirror_sends(struct EAXMirror *mirror, REFGUID guid, DWORD propid,
+                             const BYTE *data, ULONG size)
+{
+    ULONG elemsize = eax_send_size(propid);
+    ULONG ofs;
+    DWORD i;
+
+    if(size < elemsize || (size%elemsize) != 0)
+        return;
+    for(ofs = 0;ofs < size;ofs += elemsize)
+    {
+        struct EAXValue *val = NULL;
+
+        for(i = 0;i < mirror->count;++i)
+        {
+            if(mirror->vals[i].propid == propid && IsEqualIID(&mirror->vals[i].guid, guid)
+               && memcmp(mirror->vals[i].data, data+ofs, sizeof(GUID)) == 0)
+            {
+                val = &mirror->vals[i];
+                break;
+            }
+        }
+        if(!(val=eax_mirror_last(mirror, val)))
+            return;
+        val->guid = *guid;
+        val->propid = propid;
+        val->size = elemsize;
+        val->current = FALSE;
+        val->deferred = FALSE;
+        memcpy(val->data, data+ofs, elemsize);
+    }
+}
+
+/* Gets a property's value if it's known to be current. */
+BOOL EAXMirror_Get(const struct EAXMirror *mirror, REFGUID guid, DWORD propid, void *data,
+                   ULONG size)
+{
+    DWORD i;
+
+    propid &= ~0x80000000ul;
+    for(i = 0;i < mirror->count;++i)
+    {
+        const struct EAXValue *val = &mirror->vals[i];
+        if(val->current && val->propid == propid && val->size == size
+           && IsEqualIID(&val->guid, guid))
+        {
+            memcpy(data, val->data, size);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Records a property set. Returns FALSE if it repeats the current value and
+ * doesn't need to be passed on.
+ */
+BOOL EAXMirror_Set(struct EAXMirror *mirror, REFGUID guid, DWORD propid, const void *data,
+                   ULONG size)
+{
+    BOOL deferred = (propid&0x80000000ul) != 0;
+    struct EAXValue *val = NULL;
+    enum EAXPropKind kind;
+    DWORD i;
+
+    propid &= ~0x80000000ul;
+    kind = eax_prop_kind(guid, propid);
+    if(kind == EAXPROP_COMMIT)
+    {
+        for(i = 0;i < mirror->count;++i)
+        {
+            mirror->vals[i].current = mirror->vals[i].current || mirror->vals[i].deferred;
+            mirror->vals[i].deferred = FALSE;
+        }
+        return TRUE;
+    }
+    if(kind == EAXPROP_SEND)
+    {
+        eax_mirror_sends(mirror, guid, propid, data, size);
+        return TRUE;
+    }
+    if(size == 0 || size > EAX_VALUE_SIZE)
+        kind = EAXPROP_UNTRACKED;
+
+    for(i = 0;i < mirror->count && kind != EAXPROP_UNTRACKED;++i)
+    {
+        if(mirror->vals[i].propid == propid && IsEqualIID(&mirror->vals[i].guid, guid))
+        {
+            val = &mirror->vals[i];
+            if(!deferred && val->current && val->size == size
+               && memcmp(val->data, data, size) == 0)
+                return FALSE;
+            break;
+        }
+    }
+
+    /* Anything the set may overlap is no longer known. */
+    for(i = 0;i < mirror->count;++i)
+    {
+        struct EAXValue *other = &mirror->vals[i];
+        if(kind == EAXPROP_FIELD && other->propid != propid && IsEqualIID(&other->guid, guid)
+           && eax_prop_kind(&other->guid, other->propid) == EAXPROP_FIELD)
+            continue;
+        other->current = FALSE;
+        other->deferred = FALSE;
+    }
+    if(kind == EAXPROP_UNTRACKED)
+        return TRUE;
+
+    if(!(val=eax_mirror_last(mirror, val)))
+        return TRUE;
+    val->guid = *guid;
+    val->propid = propid;
+    val->size = size;
+    val->current = !deferred;
+    val->deferred = deferred;
+    memcpy(val->data, data, size);
+
+    return TRUE;
+}
+
+/* Drops a value OpenAL didn't accept, the last one recorded for the property. */
+void EAXMirror_Forget(struct EAXMirror *mirror, REFGUID guid, DWORD propid)
+{
+    DWORD i;
+
+    propid &= ~0x80000000ul;
+    for(i = mirror->count;i > 0;--i)
+    {
+        if(mirror->vals[i-1].propid == propid && IsEqualIID(&mirror->vals[i-1].guid, guid))
+        {
+            memmove(&mirror->vals[i-1], &mirror->vals[i],
+                    (mirror->count-i) * sizeof(*mirror->vals));
+            mirror->count--;
+            break;
+        }
+    }
+}
+
+void EAXMirror_Clear(struct EAXMirror *mirror)
+{
+    HeapFree(GetProcessHeap(), 0, mirror->vals);
+    mirror->vals = NULL;
+    mirror->count = mirror->size = 0;
+}
@@ -0,0 +1,124 @@
+/* DirectSound buffer property sets
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef DSOAL_PROPINFO_H
+#define DSOAL_PROPINFO_H
+
+#include <windows.h>
+
+#include "eax.h"
+
+DEFINE_GUID(DSPROPSETID_VoiceManager, 0x62a69bae, 0xdf9d, 0x11d1, 0x99, 0xa6, 0x00, 0xc0, 0x4f, 0xc9, 0x9d, 0x46);
+
+struct DSBuffer;
+struct DSPrimary;
+
+/* Property sets handled by buffers. */
+enum PropSetId {
+    PROPSET_EAX40_SOURCE,
+    PROPSET_EAX30_BUFFER,
+    PROPSET_EAX20_BUFFER,
+    PROPSET_EAX10_BUFFER,
+    PROPSET_EAX40_CONTEXT,
+    PROPSET_EAX40_FXSLOT,
+    PROPSET_EAX30_LISTENER,
+    PROPSET_EAX20_LISTENER,
+    PROPSET_EAX10_LISTENER,
+    PROPSET_VOICEMANAGER
+};
+/* Properties handled by OpenAL's EAX, and ones of the buffer's own source
+ * rather than shared by the device.
+ */
+#define PROPSET_EAX    (1<<0)
+#define PROPSET_SOURCE (1<<1)
+
+struct PropSetInfo {
+    const GUID *guid;
+    enum PropSetId id;
+    DWORD flags;
+    /* The smallest data size of each property from first_prop on, checked
+     * before the handlers are called. Other properties are left to them.
+     */
+    DWORD first_prop, nprops;
+    const ULONG *prop_sizes;
+    HRESULT (*get)(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                   void *pPropData, ULONG cbPropData, ULONG *pcbReturned);
+    HRESULT (*set)(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                   void *pPropData, ULONG cbPropData);
+    /* Support is queried from the buffer, or its primary for shared sets. */
+    HRESULT (*buffer_query)(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+    HRESULT (*primary_query)(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+};
+
+const struct PropSetInfo *PropSet_Find(REFGUID guid);
+BOOL PropSet_CheckSize(const struct PropSetInfo *set, DWORD propid, ULONG size);
+
+/* Handlers the table points to. */
+HRESULT DSBuffer_GetEAX(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                        void *pPropData, ULONG cbPropData, ULONG *pcbReturned);
+HRESULT DSBuffer_SetEAX(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                        void *pPropData, ULONG cbPropData);
+
+HRESULT EAX1_Query(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX1Buffer_Query(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX2_Query(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX2Buffer_Query(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX3_Query(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX3Buffer_Query(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX4Context_Query(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX4Slot_Query(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport);
+HRESULT EAX4Source_Query(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+
+HRESULT VoiceMan_Query(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport);
+HRESULT VoiceMan_Set(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                     void *pPropData, ULONG cbPropData);
+HRESULT VoiceMan_Get(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                     void *pPropData, ULONG cbPropData, ULONG *pcbReturned);
+
+
+/* Largest EAX property value the wrapper keeps a copy of. */
+#define EAX_VALUE_SIZE 128
+
+/* An EAX property value as set by the app. current is cleared once a later
+ * set may have changed it, and deferred marks values waiting for a commit.
+ * Source sends are kept as one value per effect slot, and are never current.
+ */
+struct EAXValue {
+    GUID guid;
+    DWORD propid;
+    ULONG size;
+    BOOL current;
+    BOOL deferred;
+    BYTE data[EAX_VALUE_SIZE];
+};
+
+/* The EAX properties set on a buffer or the listener, oldest first, so they
+ * can be answered without asking OpenAL and given again to a new source.
+ */
+struct EAXMirror {
+    struct EAXValue *vals;
+    DWORD count, size;
+};
+
+BOOL EAXMirror_Get(const struct EAXMirror *mirror, REFGUID guid, DWORD propid, void *data,
+                   ULONG size);
+BOOL EAXMirror_Set(struct EAXMirror *mirror, REFGUID guid, DWORD propid, const void *data,
+                   ULONG size);
+void EAXMirror_Forget(struct EAXMirror *mirror, REFGUID guid, DWORD propid);
+void EAXMirror_Clear(struct EAXMirror *mirror);
+
+#endif /* DSOAL_PROPINFO_H */
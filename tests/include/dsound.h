@@ -0,0 +1,17 @@
+/* The DirectSound types the tested sources use, for building the tests with
+ * a host compiler that doesn't have the Windows headers.
+ */
+
+#ifndef DSOAL_TEST_DSOUND_H
+#define DSOAL_TEST_DSOUND_H
+
+#include <windows.h>
+
+#define DSBPN_OFFSETSTOP ((DWORD)-1)
+
+typedef struct DSBPOSITIONNOTIFY {
+    DWORD dwOffset;
+    HANDLE hEventNotify;
+} DSBPOSITIONNOTIFY;
+
+#endif /* DSOAL_TEST_DSOUND_H */
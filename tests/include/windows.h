@@ -0,0 +1,59 @@
+/* The few Windows types and functions the tested sources use, for building
+ * the tests with a host compiler that doesn't have the Windows headers.
+ */
+
+#ifndef DSOAL_TEST_WINDOWS_H
+#define DSOAL_TEST_WINDOWS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t DWORD64;
+typedef void *HANDLE;
+typedef LONG HRESULT;
+
+typedef struct GUID {
+    DWORD Data1;
+    WORD Data2;
+    WORD Data3;
+    BYTE Data4[8];
+} GUID, IID;
+typedef const GUID *REFGUID;
+typedef const IID *REFIID;
+
+#define IsEqualGUID(a, b) (memcmp((a), (b), sizeof(GUID)) == 0)
+#define IsEqualIID IsEqualGUID
+
+/* GUIDs are defined in the file that defines INITGUID first. */
+#ifdef INITGUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+#else
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID name
+#endif
+
+/* The process heap is the C heap. */
+#define HEAP_ZERO_MEMORY 0x8
+
+static inline HANDLE GetProcessHeap(void)
+{ return NULL; }
+static inline void *HeapAlloc(HANDLE heap, DWORD flags, size_t size)
+{ (void)heap; return (flags&HEAP_ZERO_MEMORY) ? calloc(1, size) : malloc(size); }
+static inline void *HeapReAlloc(HANDLE heap, DWORD flags, void *ptr, size_t size)
+{ (void)heap; (void)flags; return realloc(ptr, size); }
+static inline BOOL HeapFree(HANDLE heap, DWORD flags, void *ptr)
+{ (void)heap; (void)flags; free(ptr); return TRUE; }
+
+#endif /* DSOAL_TEST_WINDOWS_H */
@@ -0,0 +1,22 @@
+/* Shared checks for the unit tests. Each test program counts the checks that
+ * failed and returns nonzero if there were any.
+ */
+
+#ifndef DSOAL_TEST_H
+#define DSOAL_TEST_H
+
+#include <stdio.h>
+
+static int TestFailures;
+
+#define CHECK(cond) do {                                                      \
+    if(!(cond))                                                               \
+    {                                                                         \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        TestFailures++;                                                       \
+    }                                                                         \
+} while(0)
+
+#define TEST_RESULT() (TestFailures ? (fprintf(stderr, "%d checks failed\n", TestFailures), 1) : 0)
+
+#endif /* DSOAL_TEST_H */
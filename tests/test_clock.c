@@ -0,0 +1,280 @@
+/* Update clock tests
+ *
+ * Drives the update thread's clock alignment with a fake device that mixes a
+ * period at a time, and checks where the ticks land relative to the mixes.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "test.h"
+
+#define PERIOD_US 20000
+/* Most a tick wakes after its target, and how long the tick runs for. */
+#define WAKE_LATENCY_US 200
+#define TICK_WORK_US 600
+#define NUM_TICKS 3000
+/* A tick with less than this left until the next mix was meant for the one
+ * that just passed.
+ */
+#define MISSED_US (PERIOD_US - 1000)
+
+/* A device clock advanced by one period at each mix. The mixes run at
+ * mix_base, mix_base+mix_period, ..., in performance counter time, and the
+ * clock reads clock_base plus the periods mixed so far. A nonzero drift makes
+ * mix_period differ from the clock's period.
+ */
+struct FakeDevice {
+    DWORD64 mix_base;
+    double mix_period;
+    DWORD64 clock_base;
+};
+
+static unsigned int Seed = 1;
+
+static unsigned int rand_below(unsigned int n)
+{
+    Seed = Seed*1103515245 + 12345;
+    return (Seed>>16) % n;
+}
+
+static DWORD64 device_clock(const struct FakeDevice *dev, DWORD64 now)
+{
+    if(now < dev->mix_base)
+        return dev->clock_base;
+    return dev->clock_base + ((DWORD64)((now-dev->mix_base) / dev->mix_period) + 1)*PERIOD_US;
+}
+
+/* Time until the first mix after now. */
+static double time_to_mix(const struct FakeDevice *dev, DWORD64 now)
+{
+    DWORD64 mixes = (DWORD64)((now-dev->mix_base) / dev->mix_period) + 1;
+    return (double)dev->mix_base + (double)mixes*dev->mix_period - (double)now;
+}
+
+struct TickStats {
+    int ontime;
+    int early;
+    int missed;
+    int worst_miss;
+    int longest_gap;
+};
+
+/* Runs the update thread's loop against the device, as DSShare_thread does,
+ * and returns the last offset estimate. Ticks after skip are checked.
+ */
+static LONGLONG run_ticks(const struct FakeDevice *dev, DWORD64 *now, LONGLONG offset,
+                          BOOL *synced, int count, int skip, struct TickStats *stats)
+{
+    DWORD64 last = 0;
+    int i;
+
+    for(i = 0;i < count;++i)
+    {
+        DWORD64 target;
+        double lead;
+
+        offset = Clock_UpdateOffset(offset, *synced, device_clock(dev, *now), *now);
+        *synced = TRUE;
+
+        *now += TICK_WORK_US/2 + rand_below(TICK_WORK_US/2);
+        target = Clock_AlignedTick(*now, device_clock(dev, *now), offset, PERIOD_US);
+        CHECK(target > *now);
+        CHECK(target - *now <= PERIOD_US);
+        *now = target + rand_below(WAKE_LATENCY_US);
+
+        if(i < skip)
+        {
+            last = *now;
+            continue;
+        }
+        /* A tick ahead of its mix has up to the lead time left. One that came
+         * just after the mix has most of a period left.
+         */
+        lead = time_to_mix(dev, *now);
+        if(lead <= TICK_LEAD_US)
+            stats->ontime++;
+        else if(lead < MISSED_US)
+            stats->early++;
+        else
+        {
+            int miss = (int)(dev->mix_period - lead);
+            stats->missed++;
+            if(miss > stats->worst_miss)
+                stats->worst_miss = miss;
+        }
+        if(last && (int)(*now-last) > stats->longest_gap)
+            stats->longest_gap = (int)(*now-last);
+        last = *now;
+    }
+    return offset;
+}
+
+/* The first reading replaces whatever the offset was, later ones only lower
+ * it or let it creep up.
+ */
+static void test_offset_update(void)
+{
+    LONGLONG offset;
+
+    CHECK(Clock_UpdateOffset(123456789, FALSE, 5000, 9000) == 4000);
+    CHECK(Clock_UpdateOffset(-123456789, FALSE, 5000, 9000) == 4000);
+    CHECK(Clock_UpdateOffset(0, FALSE, 9000, 5000) == -4000);
+
+    offset = Clock_UpdateOffset(0, FALSE, 100000, 104000);
+    CHECK(offset == 4000);
+    /* Smaller differences are taken as they are. */
+    CHECK(Clock_UpdateOffset(offset, TRUE, 100000, 103000) == 3000);
+    CHECK(Clock_UpdateOffset(offset, TRUE, 100000, 104000+CLOCK_DRIFT_US-1) ==
+          4000+CLOCK_DRIFT_US-1);
+    /* Larger ones move it by the drift allowance. */
+    CHECK(Clock_UpdateOffset(offset, TRUE, 100000, 150000) == 4000+CLOCK_DRIFT_US);
+    CHECK(Clock_UpdateOffset(offset, TRUE, 100000, 104000+CLOCK_DRIFT_US) ==
+          4000+CLOCK_DRIFT_US);
+}
+
+static void test_aligned_tick(void)
+{
+    /* Clock 1000000 was reached at 1005000, so the next mix is at 1025000. */
+    CHECK(Clock_AlignedTick(1006000, 1000000, 5000, PERIOD_US) == 1025000-TICK_LEAD_US);
+    CHECK(Clock_AlignedTick(1024000, 1000000, 5000, PERIOD_US) == 1025000-TICK_LEAD_US+PERIOD_US);
+    /* A stale reading skips to the first mix that hasn't started. */
+    CHECK(Clock_AlignedTick(1090000, 1000000, 5000, PERIOD_US) == 1105000-TICK_LEAD_US);
+    CHECK(Clock_AlignedTick(1103000, 1000000, 5000, PERIOD_US) == 1125000-TICK_LEAD_US);
+    CHECK(Clock_AlignedTick(1103001, 1000000, 5000, PERIOD_US) == 1125000-TICK_LEAD_US);
+}
+
+static void test_jitter(void)
+{
+    DWORD jitter = 0;
+    int steps = 0;
+
+    jitter = Clock_UpdateJitter(jitter, 7);
+    CHECK(jitter == 7);
+    jitter = Clock_UpdateJitter(jitter, 40);
+    CHECK(jitter == 40);
+    /* Decays towards the latest lateness, a little at a time. */
+    jitter = Clock_UpdateJitter(jitter, 0);
+    CHECK(jitter < 40 && jitter > 30);
+    while(jitter > 2 && steps < 1000)
+    {
+        DWORD next = Clock_UpdateJitter(jitter, 2);
+        CHECK(next < jitter && next >= 2);
+        jitter = next;
+        steps++;
+    }
+    CHECK(jitter == 2);
+    CHECK(steps < 100);
+}
+
+/* Steady clocks, including ones running slower or faster than the performance
+ * counter by less than the drift allowance.
+ */
+static void test_drift(void)
+{
+    static const int ppm[] = { 0, 300, -300, 900, -900 };
+    size_t i;
+
+    for(i = 0;i < sizeof(ppm)/sizeof(ppm[0]);++i)
+    {
+        struct FakeDevice dev = { 1000000000, PERIOD_US*(1.0 + ppm[i]/1000000.0), 5000000 };
+        struct TickStats stats = { 0, 0, 0, 0, 0 };
+        DWORD64 now = dev.mix_base + 12345;
+        BOOL synced = FALSE;
+
+        run_ticks(&dev, &now, 0, &synced, NUM_TICKS, 10, &stats);
+        /* Creeping the offset up eventually lands a tick just past a mix,
+         * which measures the offset again. That has to stay rare and short.
+         */
+        CHECK(stats.ontime + stats.missed == NUM_TICKS-10);
+        CHECK(stats.missed*25 < NUM_TICKS);
+        CHECK(stats.worst_miss <= CLOCK_DRIFT_US + WAKE_LATENCY_US + PERIOD_US*900/1000000);
+        CHECK(stats.longest_gap < PERIOD_US + TICK_LEAD_US + WAKE_LATENCY_US);
+        if(TestFailures)
+            fprintf(stderr, "  at %d ppm: %d missed, worst by %d us, longest gap %d us\n",
+                    ppm[i], stats.missed, stats.worst_miss, stats.longest_gap);
+    }
+}
+
+/* The device clock jumping ahead is taken at once. Jumping back, as when a
+ * device stalls and its clock is held, is followed at the drift allowance,
+ * with ticks coming early rather than late until then.
+ */
+static void test_jumps(void)
+{
+    struct FakeDevice dev = { 1000000000, PERIOD_US, 5000000 };
+    struct TickStats stats = { 0, 0, 0, 0, 0 };
+    DWORD64 now = dev.mix_base + 12345;
+    BOOL synced = FALSE;
+    LONGLONG offset;
+
+    offset = run_ticks(&dev, &now, 0, &synced, 200, 10, &stats);
+    CHECK(stats.missed*25 < 190);
+
+    /* Ahead by a bit over three periods. */
+    dev.clock_base += 3*PERIOD_US + 7300;
+    memset(&stats, 0, sizeof(stats));
+    offset = run_ticks(&dev, &now, offset, &synced, 200, 2, &stats);
+    CHECK(stats.missed*25 < 198);
+    CHECK(stats.worst_miss <= CLOCK_DRIFT_US + WAKE_LATENCY_US);
+
+    /* Back by 6 ms. The ticks come up to that much early, and catch up. */
+    dev.clock_base -= 6000;
+    memset(&stats, 0, sizeof(stats));
+    offset = run_ticks(&dev, &now, offset, &synced, 6000/CLOCK_DRIFT_US, 0, &stats);
+    CHECK(stats.missed == 0);
+    CHECK(stats.early > 6000/CLOCK_DRIFT_US/2);
+    memset(&stats, 0, sizeof(stats));
+    run_ticks(&dev, &now, offset, &synced, 500, 0, &stats);
+    CHECK(stats.missed*25 < 500);
+    CHECK(stats.worst_miss <= CLOCK_DRIFT_US + WAKE_LATENCY_US);
+}
+
+/* Starting from an unsynced, wrong offset, the first reading replaces it. It
+ * can be late by however long after a mix it was taken, which puts the next
+ * ticks after their mixes until they find it again.
+ */
+static void test_first_sync(void)
+{
+    static const LONGLONG stale[] = { 0, -50000000, 50000000, 7777 };
+    size_t i;
+
+    for(i = 0;i < sizeof(stale)/sizeof(stale[0]);++i)
+    {
+        struct FakeDevice dev = { 2000000000, PERIOD_US, 123456 };
+        struct TickStats stats = { 0, 0, 0, 0, 0 };
+        /* Mix 3 set the clock to clock_base + 4 periods. */
+        LONGLONG actual = (LONGLONG)(dev.mix_base + 3*PERIOD_US) -
+                          (LONGLONG)(dev.clock_base + 4*PERIOD_US);
+        DWORD64 now = dev.mix_base + 3*PERIOD_US + 4321;
+        BOOL synced = FALSE;
+        LONGLONG offset;
+
+        offset = run_ticks(&dev, &now, stale[i], &synced, 1, 1, &stats);
+        CHECK(synced);
+        CHECK(offset == actual + 4321);
+
+        offset = run_ticks(&dev, &now, offset, &synced, 4, 4, &stats);
+        CHECK(offset >= actual && offset < actual + TICK_LEAD_US);
+        run_ticks(&dev, &now, offset, &synced, 100, 0, &stats);
+        CHECK(stats.missed*25 < 100);
+        CHECK(stats.worst_miss <= CLOCK_DRIFT_US + WAKE_LATENCY_US);
+    }
+}
+
+int main(void)
+{
+    test_offset_update();
+    test_aligned_tick();
+    test_jitter();
+    test_drift();
+    test_jumps();
+    test_first_sync();
+    return TEST_RESULT();
+}
@@ -0,0 +1,170 @@
+/* Sample envelope tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "envelope.h"
+#include "test.h"
+
+/* 16-bit stereo, two and a half blocks. */
+#define ALIGN 4
+#define BLOCK (ENVELOPE_FRAMES*ALIGN)
+#define SIZE (BLOCK*5/2)
+
+static void test_init(void)
+{
+    struct Envelope env;
+
+    CHECK(Envelope_Init(&env, SIZE, ALIGN));
+    CHECK(env.blocks == 3);
+    CHECK(env.block_size == BLOCK);
+    CHECK(env.size == SIZE);
+    /* New data is silent. */
+    CHECK(Envelope_Peak(&env, 0) == 0 && Envelope_Peak(&env, SIZE-1) == 0);
+    CHECK(Envelope_IsQuiet(&env, 0, SIZE, 1.0f));
+    Envelope_Clear(&env);
+    CHECK(env.peaks == NULL && env.blocks == 0);
+
+    CHECK(Envelope_Init(&env, BLOCK*2, ALIGN));
+    CHECK(env.blocks == 2);
+    Envelope_Clear(&env);
+}
+
+static void test_update_16bit(void)
+{
+    short *samples = calloc(SIZE, 1);
+    struct Envelope env;
+
+    Envelope_Init(&env, SIZE, ALIGN);
+
+    /* Only the blocks in the range are looked at. */
+    samples[3] = -1000;
+    samples[BLOCK/2 + 5] = 2000;
+    Envelope_Update(&env, (BYTE*)samples, 16, BLOCK+6, 2);
+    CHECK(Envelope_Peak(&env, 0) == 0);
+    CHECK(Envelope_Peak(&env, BLOCK) == 2000);
+    CHECK(Envelope_Peak(&env, BLOCK*2-1) == 2000);
+    CHECK(Envelope_Peak(&env, BLOCK*2) == 0);
+
+    /* A range ending in the first byte of a block takes that block too. */
+    samples[BLOCK/2 + 5] = 1500;
+    Envelope_Update(&env, (BYTE*)samples, 16, 10, BLOCK-9);
+    CHECK(Envelope_Peak(&env, 0) == 1000);
+    CHECK(Envelope_Peak(&env, BLOCK) == 1500);
+
+    /* The last block is partial, and the most negative sample is clamped. */
+    samples[SIZE/2 - 1] = -32768;
+    Envelope_Update(&env, (BYTE*)samples, 16, SIZE-2, 2);
+    CHECK(Envelope_Peak(&env, SIZE-1) == 32767);
+
+    /* Lowering a block's samples lowers its peak. */
+    samples[BLOCK/2 + 5] = 0;
+    samples[BLOCK/2 + 7] = -3;
+    Envelope_Update(&env, (BYTE*)samples, 16, BLOCK, BLOCK);
+    CHECK(Envelope_Peak(&env, BLOCK) == 3);
+    CHECK(Envelope_Peak(&env, 0) == 1000);
+
+    /* Ranges past the end are cut short, or ignored. */
+    samples[SIZE/2 - 1] = 0;
+    Envelope_Update(&env, (BYTE*)samples, 16, SIZE, 1000);
+    CHECK(Envelope_Peak(&env, SIZE-1) == 32767);
+    Envelope_Update(&env, (BYTE*)samples, 16, SIZE-2, 1000);
+    CHECK(Envelope_Peak(&env, SIZE-1) == 0);
+    /* Past the end isn't known. */
+    CHECK(Envelope_Peak(&env, SIZE) == 32767);
+
+    Envelope_Clear(&env);
+    free(samples);
+}
+
+static void test_update_formats(void)
+{
+    struct Envelope env;
+    BYTE *bytes = malloc(ENVELOPE_FRAMES*2);
+    float *floats = calloc(ENVELOPE_FRAMES*2, sizeof(float));
+
+    /* 8-bit mono, with 0x80 as silence. */
+    memset(bytes, 0x80, ENVELOPE_FRAMES*2);
+    Envelope_Init(&env, ENVELOPE_FRAMES*2, 1);
+    bytes[7] = 0xc0;
+    bytes[ENVELOPE_FRAMES+7] = 0x00;
+    Envelope_Update(&env, bytes, 8, 0, ENVELOPE_FRAMES*2);
+    CHECK(Envelope_Peak(&env, 0) == 0x40<<8);
+    CHECK(Envelope_Peak(&env, ENVELOPE_FRAMES) == 32767);
+    Envelope_Clear(&env);
+
+    /* Float stereo, clamped at full scale. */
+    Envelope_Init(&env, ENVELOPE_FRAMES*2*sizeof(float), 2*sizeof(float));
+    floats[3] = -0.5f;
+    Envelope_Update(&env, (BYTE*)floats, 32, 0, ENVELOPE_FRAMES*2*sizeof(float));
+    CHECK(Envelope_Peak(&env, 0) == 16383);
+    floats[ENVELOPE_FRAMES*2-1] = 2.0f;
+    Envelope_Update(&env, (BYTE*)floats, 32, 0, ENVELOPE_FRAMES*2*sizeof(float));
+    CHECK(Envelope_Peak(&env, 0) == 32767);
+    Envelope_Clear(&env);
+
+    free(floats);
+    free(bytes);
+}
+
+static void test_limit(void)
+{
+    /* -60dB of full scale at unity gain. */
+    CHECK(fabsf(Envelope_Limit(-6000, 1.0f) - 32.767f) < 0.01f);
+    /* Half the gain needs twice the level. */
+    CHECK(fabsf(Envelope_Limit(-6000, 0.5f) - 65.534f) < 0.01f);
+    CHECK(fabsf(Envelope_Limit(-2000, 2.0f) - 1638.35f) < 0.1f);
+    /* Silent voices are never loud enough, without dividing by zero. */
+    CHECK(Envelope_Limit(-6000, 0.0f) > 32767.0f);
+    CHECK(isfinite(Envelope_Limit(-10000, 0.0f)));
+}
+
+static void test_quiet(void)
+{
+    struct Envelope env;
+
+    Envelope_Init(&env, SIZE, ALIGN);
+    env.peaks[0] = 10;
+    env.peaks[1] = 500;
+    env.peaks[2] = 20;
+
+    CHECK(Envelope_IsQuiet(&env, 0, BLOCK-1, 100.0f));
+    CHECK(!Envelope_IsQuiet(&env, 0, BLOCK, 100.0f));
+    CHECK(!Envelope_IsQuiet(&env, BLOCK*2-1, 0, 100.0f));
+    CHECK(Envelope_IsQuiet(&env, BLOCK*2, 1000000, 100.0f));
+    CHECK(Envelope_IsQuiet(&env, 0, SIZE, 501.0f));
+    /* Reaching the limit is loud enough. */
+    CHECK(!Envelope_IsQuiet(&env, 0, 0, 10.0f));
+    /* Past the end isn't known to be quiet. */
+    CHECK(!Envelope_IsQuiet(&env, SIZE, 0, 100.0f));
+
+    CHECK(Envelope_NextQuiet(&env, 0, 100.0f) == 0);
+    CHECK(Envelope_NextQuiet(&env, 5, 100.0f) == 0);
+    CHECK(Envelope_NextQuiet(&env, BLOCK, 100.0f) == BLOCK*2);
+    CHECK(Envelope_NextQuiet(&env, BLOCK+5, 5.0f) == SIZE);
+    CHECK(Envelope_NextQuiet(&env, SIZE, 100.0f) == SIZE);
+
+    Envelope_Clear(&env);
+
+    /* Without an envelope, nothing is quiet or known. */
+    CHECK(!Envelope_IsQuiet(&env, 0, SIZE, 1000000.0f));
+    CHECK(Envelope_NextQuiet(&env, 0, 1000000.0f) == SIZE);
+    CHECK(Envelope_Peak(&env, 0) == 32767);
+}
+
+int main(void)
+{
+    test_init();
+    test_update_16bit();
+    test_update_formats();
+    test_limit();
+    test_quiet();
+    return TEST_RESULT();
+}
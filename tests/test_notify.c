@@ -0,0 +1,457 @@
+/* Notification scheduling tests
+ *
+ * Checks the notify heap and the crossed-notification search, and that
+ * checking buffers by their predicted deadlines signals the same
+ * notifications in the same updates as checking every buffer every update,
+ * the way the notify list was handled before.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "notify.h"
+#include "test.h"
+
+#define MAX_NOTIFIES 24
+#define NUM_BUFFERS 48
+#define NUM_TICKS 3000
+#define TICK_US 20000
+/* The device mixes on its own period, and positions only move when it does. */
+#define MIX_US 7000
+
+static unsigned int Seed = 1;
+
+static unsigned int rand_below(unsigned int n)
+{
+    Seed = Seed*1103515245 + 12345;
+    return ((Seed>>16) | ((Seed&0xffff)<<16)) % n;
+}
+
+static int cmp_notify(const void *a, const void *b)
+{
+    DWORD x = ((const DSBPOSITIONNOTIFY*)a)->dwOffset, y = ((const DSBPOSITIONNOTIFY*)b)->dwOffset;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/* Random sorted offsets below size, with some repeats. */
+static DWORD make_notifies(DSBPOSITIONNOTIFY *notify, DWORD size)
+{
+    DWORD count = rand_below(MAX_NOTIFIES+1);
+    DWORD i;
+
+    for(i = 0;i < count;++i)
+    {
+        if(i > 0 && rand_below(8) == 0)
+            notify[i].dwOffset = notify[i-1].dwOffset;
+        else
+            notify[i].dwOffset = rand_below(size);
+        notify[i].hEventNotify = NULL;
+    }
+    qsort(notify, count, sizeof(*notify), cmp_notify);
+    return count;
+}
+
+
+struct TestItem {
+    struct NotifyItem item;
+    BOOL queued;
+};
+
+static void check_heap(const struct NotifyHeap *heap, const struct TestItem *items, DWORD count)
+{
+    DWORD i, queued = 0;
+
+    for(i = 0;i < heap->count;++i)
+    {
+        CHECK(heap->items[i]->idx == i+1);
+        if(i > 0)
+            CHECK(heap->items[(i-1)/2]->deadline <= heap->items[i]->deadline);
+    }
+    for(i = 0;i < count;++i)
+    {
+        CHECK(items[i].queued == (items[i].item.idx != 0));
+        if(items[i].queued)
+        {
+            CHECK(heap->items[items[i].item.idx-1] == &items[i].item);
+            CHECK(NotifyHeap_Top(heap)->deadline <= items[i].item.deadline);
+            queued++;
+        }
+    }
+    CHECK(heap->count == queued);
+}
+
+static void test_heap(void)
+{
+    struct TestItem items[100];
+    struct NotifyHeap heap;
+    int round;
+
+    memset(items, 0, sizeof(items));
+    CHECK(NotifyHeap_Init(&heap, 4));
+    CHECK(NotifyHeap_Top(&heap) == NULL);
+
+    for(round = 0;round < 20000;++round)
+    {
+        struct TestItem *test = &items[rand_below(100)];
+        switch(rand_below(4))
+        {
+        case 0: case 1:
+            CHECK(NotifyHeap_Schedule(&heap, &test->item, rand_below(1000)));
+            test->queued = TRUE;
+            break;
+        case 2:
+            /* Moved to the front, as DSPrimary_addnotify does. */
+            CHECK(NotifyHeap_Schedule(&heap, &test->item, 0));
+            test->queued = TRUE;
+            break;
+        case 3:
+            NotifyHeap_Remove(&heap, &test->item);
+            test->queued = FALSE;
+            break;
+        }
+        if(round%97 == 0)
+            check_heap(&heap, items, 100);
+    }
+    check_heap(&heap, items, 100);
+
+    /* Popping in order gives nondecreasing deadlines. */
+    {
+        DWORD64 last = 0;
+        struct NotifyItem *top;
+        while((top=NotifyHeap_Top(&heap)) != NULL)
+        {
+            CHECK(top->deadline >= last);
+            last = top->deadline;
+            NotifyHeap_Remove(&heap, top);
+        }
+    }
+    NotifyHeap_Clear(&heap);
+    CHECK(heap.items == NULL && heap.count == 0);
+}
+
+
+/* Signals the notifications crossed from lastpos to curpos the way the notify
+ * list did before the offsets were sorted, returning a mask of their indices.
+ */
+static DWORD linear_elapsed(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD lastpos,
+                            DWORD curpos)
+{
+    DWORD mask = 0;
+    DWORD i;
+
+    for(i = 0;i < count;++i)
+    {
+        DWORD ofs = notify[i].dwOffset;
+        if(curpos < lastpos) /* Wraparound case */
+        {
+            if(ofs < curpos || ofs >= lastpos)
+                mask |= 1u<<i;
+        }
+        else if(ofs >= lastpos && ofs < curpos) /* Normal case */
+            mask |= 1u<<i;
+    }
+    return mask;
+}
+
+static DWORD elapsed_mask(const DSBPOSITIONNOTIFY *notify, DWORD count, DWORD lastpos,
+                          DWORD curpos)
+{
+    DWORD ranges[4];
+    DWORD mask = 0;
+    DWORD i;
+
+    Notify_Elapsed(notify, count, lastpos, curpos, ranges);
+    CHECK(ranges[0] <= ranges[1] && ranges[1] <= count);
+    CHECK(ranges[2] <= ranges[3] && ranges[3] <= count);
+    for(i = ranges[0];i < ranges[1];++i)
+        mask |= 1u<<i;
+    for(i = ranges[2];i < ranges[3];++i)
+        mask |= 1u<<i;
+    return mask;
+}
+
+static void test_elapsed(void)
+{
+    DSBPOSITIONNOTIFY notify[MAX_NOTIFIES];
+    int round;
+
+    for(round = 0;round < 20000;++round)
+    {
+        DWORD size = 64 + rand_below(4000);
+        DWORD count = make_notifies(notify, size);
+        DWORD lastpos = rand_below(size+1);
+        DWORD curpos = rand_below(size+1);
+        DWORD i, first;
+
+        /* Positions next to the offsets are the interesting ones. */
+        if(count > 0 && rand_below(2))
+            lastpos = notify[rand_below(count)].dwOffset + rand_below(3) - 1;
+        if(count > 0 && rand_below(2))
+            curpos = notify[rand_below(count)].dwOffset + rand_below(3) - 1;
+        lastpos %= size+1;
+        curpos %= size+1;
+
+        CHECK(elapsed_mask(notify, count, lastpos, curpos) ==
+              linear_elapsed(notify, count, lastpos, curpos));
+
+        first = Notify_Find(notify, count, curpos);
+        for(i = 0;i < count;++i)
+            CHECK((notify[i].dwOffset < curpos) == (i < first));
+    }
+}
+
+
+static void test_predict(void)
+{
+    DSBPOSITIONNOTIFY notify[3] = { { 1000, NULL }, { 2000, NULL }, { 2000, NULL } };
+    /* 1000 bytes a second makes the waits a millisecond per byte. The
+     * period's taken off, and four of them is the longest wait.
+     */
+    const DWORD64 rate = 1000, period = 250000;
+
+    /* Up to just past the next offset, less a sixteenth. */
+    CHECK(Notify_PredictWait(notify, 3, 200, 4000, FALSE, 4, rate, period) ==
+          804000 - 50250 - period);
+    CHECK(Notify_PredictWait(notify, 3, 1001, 4000, FALSE, 4, rate, period) ==
+          1003000 - 62687 - period);
+    /* Past the last offset, to the end, or around to the first. */
+    CHECK(Notify_PredictWait(notify, 3, 3000, 4000, FALSE, 4, rate, period) ==
+          1000000 - 62500 - period);
+    CHECK(Notify_PredictWait(notify, 3, 3000, 3200, TRUE, 4, rate, period) ==
+          1204000 - 75250 - period);
+    CHECK(Notify_PredictWait(notify, 0, 1000, 1200, TRUE, 4, rate, period) ==
+          1200000 - 75000 - period);
+    /* Positions at the end count from the start. */
+    CHECK(Notify_PredictWait(notify, 3, 4000, 4000, TRUE, 4, rate, period) ==
+          1004000 - 62750 - period);
+    /* Capped, and never 0. */
+    CHECK(Notify_PredictWait(notify, 3, 3000, 4000, TRUE, 4, rate, period) == period*4);
+    CHECK(Notify_PredictWait(notify, 3, 200, 4000, FALSE, 4, rate, 0) == 1000);
+    CHECK(Notify_PredictWait(notify, 3, 1000, 4000, FALSE, 4, rate, period) == 1);
+    CHECK(Notify_PredictWait(notify, 3, 999, 4000, FALSE, 1, 100000000, 0) == 1);
+}
+
+
+/* A playing buffer, as seen by both ways of checking it. Its position is
+ * rate*(t - base_time)/1000000 + base_pos bytes as of the last mix, with rate
+ * changes taking effect at the next mix.
+ */
+struct FakeBuffer {
+    DSBPOSITIONNOTIFY notify[MAX_NOTIFIES];
+    DWORD nposnotify;
+    DWORD size, align;
+    BOOL looping;
+
+    DWORD64 rate, old_rate;
+    DWORD64 base_time;
+    double base_pos, old_pos;
+    DWORD64 old_time;
+
+    DWORD64 start;
+    BOOL linear_active, linear_done;
+    DWORD linear_lastpos;
+    BOOL heap_done;
+    DWORD heap_lastpos;
+    struct NotifyItem item;
+};
+
+static DWORD64 last_mix(DWORD64 t)
+{
+    return t - t%MIX_US;
+}
+
+static double exact_pos(const struct FakeBuffer *buf, DWORD64 t)
+{
+    if(t <= buf->old_time)
+        return buf->old_pos;
+    if(t < buf->base_time)
+        return buf->old_pos + (double)buf->old_rate*(double)(t - buf->old_time)/1000000.0;
+    return buf->base_pos + (double)buf->rate*(double)(t - buf->base_time)/1000000.0;
+}
+
+/* Gets the position reported at t, and whether it's still playing. */
+static BOOL get_pos(const struct FakeBuffer *buf, DWORD64 t, DWORD *pos)
+{
+    double p = exact_pos(buf, last_mix(t));
+    DWORD64 bytes = (DWORD64)p;
+
+    bytes -= bytes % buf->align;
+    if(!buf->looping && bytes >= buf->size)
+    {
+        *pos = buf->size;
+        return FALSE;
+    }
+    *pos = (DWORD)(bytes % buf->size);
+    return TRUE;
+}
+
+static void set_rate(struct FakeBuffer *buf, DWORD64 t, DWORD64 rate)
+{
+    DWORD64 mix = last_mix(t) + MIX_US;
+    buf->old_pos = exact_pos(buf, t);
+    buf->old_time = t;
+    buf->old_rate = buf->rate;
+    buf->base_pos = exact_pos(buf, mix);
+    buf->base_time = mix;
+    buf->rate = rate;
+}
+
+/* Notification masks per update and buffer, with the top bit for the stop
+ * notifications.
+ */
+#define STOP_BIT 0x80000000u
+static DWORD LinearEvents[NUM_TICKS][NUM_BUFFERS];
+static DWORD HeapEvents[NUM_TICKS][NUM_BUFFERS];
+
+static void check_linear(struct FakeBuffer *buf, DWORD tick, DWORD idx, DWORD64 now)
+{
+    DWORD curpos;
+    BOOL playing = get_pos(buf, now, &curpos);
+
+    if(buf->linear_lastpos != curpos)
+    {
+        LinearEvents[tick][idx] |= linear_elapsed(buf->notify, buf->nposnotify,
+                                                  buf->linear_lastpos, curpos);
+        buf->linear_lastpos = curpos;
+    }
+    if(!playing)
+    {
+        LinearEvents[tick][idx] |= STOP_BIT;
+        buf->linear_active = FALSE;
+        buf->linear_done = TRUE;
+    }
+}
+
+/* What DSPrimary_triggernots does with a buffer at the front of the list. */
+static void check_heap_buffer(struct NotifyHeap *heap, struct FakeBuffer *buf, DWORD tick,
+                              DWORD idx, DWORD64 now)
+{
+    DWORD curpos;
+    BOOL playing = get_pos(buf, now, &curpos);
+
+    if(buf->heap_lastpos != curpos)
+    {
+        HeapEvents[tick][idx] |= elapsed_mask(buf->notify, buf->nposnotify,
+                                              buf->heap_lastpos, curpos);
+        buf->heap_lastpos = curpos;
+    }
+    if(!playing)
+    {
+        HeapEvents[tick][idx] |= STOP_BIT;
+        NotifyHeap_Remove(heap, &buf->item);
+        buf->heap_done = TRUE;
+    }
+    else
+        NotifyHeap_Schedule(heap, &buf->item, now +
+            Notify_PredictWait(buf->notify, buf->nposnotify, curpos, buf->size, buf->looping,
+                               buf->align, buf->rate, TICK_US));
+}
+
+static void test_equivalence(void)
+{
+    static struct FakeBuffer buffers[NUM_BUFFERS];
+    static const DWORD rates[] = { 11025, 22050, 44100, 48000 };
+    struct NotifyHeap heap;
+    DWORD64 phase = 1000 + rand_below(TICK_US);
+    DWORD tick, i, scanned = 0, checked = 0, events = 0, mismatches = 0;
+
+    memset(buffers, 0, sizeof(buffers));
+    memset(LinearEvents, 0, sizeof(LinearEvents));
+    memset(HeapEvents, 0, sizeof(HeapEvents));
+    CHECK(NotifyHeap_Init(&heap, NUM_BUFFERS));
+
+    for(i = 0;i < NUM_BUFFERS;++i)
+    {
+        struct FakeBuffer *buf = &buffers[i];
+        buf->align = (rand_below(2) ? 2 : 4) << rand_below(2);
+        buf->rate = (DWORD64)rates[rand_below(4)] * buf->align;
+        /* A quarter second to a few seconds long. */
+        buf->size = (DWORD)(buf->rate/4 + rand_below((DWORD)buf->rate*3));
+        buf->size -= buf->size % buf->align;
+        buf->looping = (i%3 != 0);
+        buf->nposnotify = make_notifies(buf->notify, buf->size);
+        buf->start = phase + (DWORD64)rand_below(NUM_TICKS/2)*TICK_US + rand_below(TICK_US);
+        buf->base_time = buf->old_time = buf->start;
+        buf->old_rate = buf->rate;
+    }
+
+    for(tick = 0;tick < NUM_TICKS;++tick)
+    {
+        DWORD64 now = phase + (DWORD64)tick*TICK_US + rand_below(3000);
+        struct NotifyItem *item;
+
+        for(i = 0;i < NUM_BUFFERS;++i)
+        {
+            struct FakeBuffer *buf = &buffers[i];
+            if(buf->start <= now && !buf->linear_active && !buf->linear_done)
+            {
+                /* Started by Play, which adds it to the front of the list. */
+                buf->linear_active = TRUE;
+                CHECK(NotifyHeap_Schedule(&heap, &buf->item, 0));
+            }
+            else if(buf->linear_active && rand_below(400) == 0)
+            {
+                /* SetFrequency, which also moves it to the front. */
+                set_rate(buf, now-rand_below(TICK_US/2),
+                         (DWORD64)rates[rand_below(4)] * buf->align * (50+rand_below(100))/100);
+                CHECK(NotifyHeap_Schedule(&heap, &buf->item, 0));
+            }
+        }
+
+        for(i = 0;i < NUM_BUFFERS;++i)
+        {
+            if(buffers[i].linear_active)
+            {
+                check_linear(&buffers[i], tick, i, now);
+                scanned++;
+            }
+        }
+        while((item=NotifyHeap_Top(&heap)) != NULL && item->deadline <= now)
+        {
+            struct FakeBuffer *buf = (struct FakeBuffer*)((char*)item -
+                                                          offsetof(struct FakeBuffer, item));
+            check_heap_buffer(&heap, buf, tick, (DWORD)(buf-buffers), now);
+            checked++;
+        }
+    }
+
+    for(tick = 0;tick < NUM_TICKS;++tick)
+    {
+        for(i = 0;i < NUM_BUFFERS;++i)
+        {
+            if(LinearEvents[tick][i] != HeapEvents[tick][i])
+            {
+                if(mismatches++ < 10)
+                    fprintf(stderr, "  update %lu, buffer %lu: expected 0x%08lx, got 0x%08lx\n",
+                            (unsigned long)tick, (unsigned long)i,
+                            (unsigned long)LinearEvents[tick][i],
+                            (unsigned long)HeapEvents[tick][i]);
+            }
+            if(LinearEvents[tick][i])
+                events++;
+        }
+    }
+    CHECK(mismatches == 0);
+    /* There was something to compare, with fewer checks than a full scan. */
+    CHECK(events > NUM_TICKS);
+    CHECK(checked*4 < scanned*3);
+    printf("%lu updates with notifications, %lu buffer checks instead of %lu\n",
+           (unsigned long)events, (unsigned long)checked, (unsigned long)scanned);
+
+    NotifyHeap_Clear(&heap);
+}
+
+int main(void)
+{
+    test_heap();
+    test_elapsed();
+    test_predict();
+    test_equivalence();
+    return TEST_RESULT();
+}
@@ -0,0 +1,296 @@
+/* Property set table and EAX mirror tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#define INITGUID
+#include <string.h>
+
+#include "propinfo.h"
+#include "test.h"
+
+#define DEFERRED 0x80000000ul
+
+/* The table's handlers aren't called here. */
+#define GET_HANDLER(name) \
+    HRESULT name(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid, \
+                 void *pPropData, ULONG cbPropData, ULONG *pcbReturned) \
+    { (void)buf; (void)set; (void)propid; (void)pPropData; (void)cbPropData; \
+      (void)pcbReturned; return 0; }
+#define SET_HANDLER(name) \
+    HRESULT name(struct DSBuffer *buf, const struct PropSetInfo *set, DWORD propid, \
+                 void *pPropData, ULONG cbPropData) \
+    { (void)buf; (void)set; (void)propid; (void)pPropData; (void)cbPropData; return 0; }
+#define BUFFER_QUERY(name) \
+    HRESULT name(struct DSBuffer *buf, DWORD propid, ULONG *pTypeSupport) \
+    { (void)buf; (void)propid; (void)pTypeSupport; return 0; }
+#define PRIMARY_QUERY(name) \
+    HRESULT name(struct DSPrimary *prim, DWORD propid, ULONG *pTypeSupport) \
+    { (void)prim; (void)propid; (void)pTypeSupport; return 0; }
+GET_HANDLER(DSBuffer_GetEAX)
+SET_HANDLER(DSBuffer_SetEAX)
+GET_HANDLER(VoiceMan_Get)
+SET_HANDLER(VoiceMan_Set)
+BUFFER_QUERY(EAX1Buffer_Query)
+BUFFER_QUERY(EAX2Buffer_Query)
+BUFFER_QUERY(EAX3Buffer_Query)
+BUFFER_QUERY(EAX4Source_Query)
+BUFFER_QUERY(VoiceMan_Query)
+PRIMARY_QUERY(EAX1_Query)
+PRIMARY_QUERY(EAX2_Query)
+PRIMARY_QUERY(EAX3_Query)
+PRIMARY_QUERY(EAX4Context_Query)
+PRIMARY_QUERY(EAX4Slot_Query)
+
+
+static void test_find(void)
+{
+    static const struct {
+        const GUID *guid;
+        enum PropSetId id;
+        DWORD flags;
+    } sets[] = {
+        { &EAXPROPERTYID_EAX40_Source, PROPSET_EAX40_SOURCE, PROPSET_EAX|PROPSET_SOURCE },
+        { &DSPROPSETID_EAX30_BufferProperties, PROPSET_EAX30_BUFFER, PROPSET_EAX|PROPSET_SOURCE },
+        { &DSPROPSETID_EAX20_BufferProperties, PROPSET_EAX20_BUFFER, PROPSET_EAX|PROPSET_SOURCE },
+        { &DSPROPSETID_EAX10_BufferProperties, PROPSET_EAX10_BUFFER, PROPSET_EAX|PROPSET_SOURCE },
+        { &EAXPROPERTYID_EAX40_Context, PROPSET_EAX40_CONTEXT, PROPSET_EAX },
+        { &EAXPROPERTYID_EAX40_FXSlot0, PROPSET_EAX40_FXSLOT, PROPSET_EAX },
+        { &EAXPROPERTYID_EAX40_FXSlot1, PROPSET_EAX40_FXSLOT, PROPSET_EAX },
+        { &EAXPROPERTYID_EAX40_FXSlot2, PROPSET_EAX40_FXSLOT, PROPSET_EAX },
+        { &EAXPROPERTYID_EAX40_FXSlot3, PROPSET_EAX40_FXSLOT, PROPSET_EAX },
+        { &DSPROPSETID_EAX30_ListenerProperties, PROPSET_EAX30_LISTENER, PROPSET_EAX },
+        { &DSPROPSETID_EAX20_ListenerProperties, PROPSET_EAX20_LISTENER, PROPSET_EAX },
+        { &DSPROPSETID_EAX10_ListenerProperties, PROPSET_EAX10_LISTENER, PROPSET_EAX },
+        { &DSPROPSETID_VoiceManager, PROPSET_VOICEMANAGER, 0 },
+    };
+    size_t i, j;
+
+    for(i = 0;i < sizeof(sets)/sizeof(sets[0]);++i)
+    {
+        const struct PropSetInfo *set = PropSet_Find(sets[i].guid);
+        GUID other = *sets[i].guid;
+
+        CHECK(set != NULL);
+        if(!set) continue;
+        CHECK(IsEqualGUID(set->guid, sets[i].guid));
+        CHECK(set->id == sets[i].id);
+        CHECK(set->flags == sets[i].flags);
+        CHECK(set->nprops > 0 && set->prop_sizes != NULL);
+        CHECK(set->get != NULL && set->set != NULL);
+        CHECK((set->buffer_query != NULL) != (set->primary_query != NULL));
+        CHECK((set->buffer_query != NULL) == (set->id == PROPSET_VOICEMANAGER ||
+                                              (set->flags&PROPSET_SOURCE) != 0));
+
+        /* Only the first 32 bits are compared first, so they have to differ
+         * between sets, and a match there isn't enough.
+         */
+        for(j = 0;j < i;++j)
+            CHECK(sets[j].guid->Data1 != sets[i].guid->Data1);
+        other.Data4[7] ^= 0x01;
+        CHECK(PropSet_Find(&other) == NULL);
+        other = *sets[i].guid;
+        other.Data2 ^= 0x8000;
+        CHECK(PropSet_Find(&other) == NULL);
+    }
+    CHECK(PropSet_Find(&EAX_NULL_GUID) == NULL);
+    CHECK(PropSet_Find(&EAX_REVERB_EFFECT) == NULL);
+}
+
+static void test_check_size(void)
+{
+    const struct PropSetInfo *buf3 = PropSet_Find(&DSPROPSETID_EAX30_BufferProperties);
+    const struct PropSetInfo *slot = PropSet_Find(&EAXPROPERTYID_EAX40_FXSlot0);
+    const struct PropSetInfo *src4 = PropSet_Find(&EAXPROPERTYID_EAX40_Source);
+
+    CHECK(PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS,
+                            sizeof(EAX30BUFFERPROPERTIES)));
+    CHECK(!PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS,
+                             sizeof(EAX30BUFFERPROPERTIES)-1));
+    CHECK(!PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS|DEFERRED,
+                             sizeof(EAX30BUFFERPROPERTIES)-1));
+    CHECK(PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_NONE, 0));
+    CHECK(!PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_FLAGS, 0));
+    CHECK(PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_FLAGS, sizeof(DWORD)));
+    /* Unknown properties are left to the handlers. */
+    CHECK(PropSet_CheckSize(buf3, DSPROPERTY_EAX30BUFFER_FLAGS+1, 0));
+
+    /* Sends are given for one slot or more. */
+    CHECK(PropSet_CheckSize(src4, EAXSOURCE_ALLSENDPARAMETERS,
+                            sizeof(EAXSOURCEALLSENDPROPERTIES)*2));
+    CHECK(!PropSet_CheckSize(src4, EAXSOURCE_ALLSENDPARAMETERS,
+                             sizeof(EAXSOURCEALLSENDPROPERTIES)-1));
+
+    /* Slot properties below EAXFXSLOT_NONE belong to the loaded effect. */
+    CHECK(PropSet_CheckSize(slot, 0, 0));
+    CHECK(PropSet_CheckSize(slot, EAXFXSLOT_NONE, 0));
+    CHECK(!PropSet_CheckSize(slot, EAXFXSLOT_LOCK, 0));
+    CHECK(PropSet_CheckSize(slot, EAXFXSLOT_LOCK, sizeof(long)));
+}
+
+
+static BOOL get_long(const struct EAXMirror *mirror, const GUID *guid, DWORD propid, long *val)
+{
+    return EAXMirror_Get(mirror, guid, propid, val, sizeof(*val));
+}
+
+static BOOL set_long(struct EAXMirror *mirror, const GUID *guid, DWORD propid, long val)
+{
+    return EAXMirror_Set(mirror, guid, propid, &val, sizeof(val));
+}
+
+static void test_mirror_fields(void)
+{
+    const GUID *buf3 = &DSPROPSETID_EAX30_BufferProperties;
+    const GUID *buf2 = &DSPROPSETID_EAX20_BufferProperties;
+    struct EAXMirror mirror = { NULL, 0, 0 };
+    EAX30BUFFERPROPERTIES all;
+    long val = 0;
+
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val));
+
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, -100));
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val) && val == -100);
+    /* The deferred flag doesn't matter for gets. */
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT|DEFERRED, &val) && val == -100);
+    /* Nor does a different size. */
+    CHECK(!EAXMirror_Get(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &all, sizeof(all)));
+
+    /* Setting the same value again doesn't need to go to OpenAL. */
+    CHECK(!set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, -100));
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, -200));
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val) && val == -200);
+
+    /* Single values of a set are independent of each other. */
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, -300));
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val) && val == -200);
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, &val) && val == -300);
+
+    /* Setting a group changes the single values. */
+    memset(&all, 0, sizeof(all));
+    CHECK(EAXMirror_Set(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS, &all, sizeof(all)));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, &val));
+    CHECK(EAXMirror_Get(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS, &all, sizeof(all)));
+    /* And the other way around. */
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, -400));
+    CHECK(!EAXMirror_Get(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ALLPARAMETERS, &all,
+                         sizeof(all)));
+
+    /* Another EAX version's set changes the same source. */
+    CHECK(set_long(&mirror, buf2, DSPROPERTY_EAX20BUFFER_ROOM, -500));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, &val));
+    CHECK(get_long(&mirror, buf2, DSPROPERTY_EAX20BUFFER_ROOM, &val) && val == -500);
+
+    /* A value OpenAL didn't take is dropped. */
+    EAXMirror_Forget(&mirror, buf2, DSPROPERTY_EAX20BUFFER_ROOM|DEFERRED);
+    CHECK(!get_long(&mirror, buf2, DSPROPERTY_EAX20BUFFER_ROOM, &val));
+    CHECK(set_long(&mirror, buf2, DSPROPERTY_EAX20BUFFER_ROOM, -500));
+
+    EAXMirror_Clear(&mirror);
+    CHECK(mirror.vals == NULL && mirror.count == 0 && mirror.size == 0);
+}
+
+static void test_mirror_deferred(void)
+{
+    const GUID *buf3 = &DSPROPSETID_EAX30_BufferProperties;
+    struct EAXMirror mirror = { NULL, 0, 0 };
+    long val = 0;
+
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT|DEFERRED, -100));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val));
+    /* A deferred set always goes through, even if it repeats the value. */
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT|DEFERRED, -100));
+
+    CHECK(EAXMirror_Set(&mirror, buf3, DSPROPERTY_EAX30BUFFER_NONE, NULL, 0));
+    CHECK(get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val) && val == -100);
+    CHECK(!set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, -100));
+
+    /* A pending value is lost to an untracked set before the commit. */
+    CHECK(set_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM|DEFERRED, -200));
+    CHECK(set_long(&mirror, &DSPROPSETID_EAX30_ListenerProperties,
+                   DSPROPERTY_EAX30LISTENER_ENVIRONMENT, 3));
+    CHECK(EAXMirror_Set(&mirror, buf3, DSPROPERTY_EAX30BUFFER_NONE, NULL, 0));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_ROOM, &val));
+    CHECK(!get_long(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, &val));
+    /* And untracked values aren't kept. */
+    CHECK(!get_long(&mirror, &DSPROPSETID_EAX30_ListenerProperties,
+                    DSPROPERTY_EAX30LISTENER_ENVIRONMENT, &val));
+
+    EAXMirror_Clear(&mirror);
+}
+
+static void test_mirror_sends(void)
+{
+    const GUID *src4 = &EAXPROPERTYID_EAX40_Source;
+    struct EAXMirror mirror = { NULL, 0, 0 };
+    EAXSOURCEALLSENDPROPERTIES sends[2], got;
+
+    memset(sends, 0, sizeof(sends));
+    sends[0].guidReceivingFXSlotID = EAXPROPERTYID_EAX40_FXSlot0;
+    sends[0].lSend = -100;
+    sends[1].guidReceivingFXSlotID = EAXPROPERTYID_EAX40_FXSlot1;
+    sends[1].lSend = -200;
+
+    /* Kept per slot, to give a new source, but never answered from. */
+    CHECK(EAXMirror_Set(&mirror, src4, EAXSOURCE_ALLSENDPARAMETERS, sends, sizeof(sends)));
+    CHECK(mirror.count == 2);
+    CHECK(!EAXMirror_Get(&mirror, src4, EAXSOURCE_ALLSENDPARAMETERS, &got, sizeof(got)));
+    CHECK(!EAXMirror_Get(&mirror, src4, EAXSOURCE_ALLSENDPARAMETERS, sends, sizeof(sends)));
+
+    /* Setting a slot again replaces its entry, and moves it to the end so
+     * it's given after anything set before it.
+     */
+    sends[0].lSend = -300;
+    CHECK(EAXMirror_Set(&mirror, src4, EAXSOURCE_ALLSENDPARAMETERS, &sends[0],
+                        sizeof(sends[0])));
+    CHECK(mirror.count == 2);
+    CHECK(mirror.vals[0].size == sizeof(sends[1]) &&
+          memcmp(mirror.vals[0].data, &sends[1], sizeof(sends[1])) == 0);
+    CHECK(mirror.vals[1].size == sizeof(sends[0]) &&
+          memcmp(mirror.vals[1].data, &sends[0], sizeof(sends[0])) == 0);
+
+    /* Data that isn't whole entries is ignored. */
+    CHECK(EAXMirror_Set(&mirror, src4, EAXSOURCE_ALLSENDPARAMETERS, sends,
+                        sizeof(sends[0])+4));
+    CHECK(mirror.count == 2);
+
+    EAXMirror_Clear(&mirror);
+}
+
+/* Values too big to keep, and growing past the first allocation. */
+static void test_mirror_sizes(void)
+{
+    const GUID *buf3 = &DSPROPSETID_EAX30_BufferProperties;
+    struct EAXMirror mirror = { NULL, 0, 0 };
+    BYTE big[EAX_VALUE_SIZE+1];
+    long val = 0;
+    DWORD prop;
+
+    memset(big, 0, sizeof(big));
+    CHECK(EAXMirror_Set(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, big, sizeof(big)));
+    CHECK(mirror.count == 0);
+    CHECK(EAXMirror_Set(&mirror, buf3, DSPROPERTY_EAX30BUFFER_DIRECT, big, sizeof(big)));
+
+    for(prop = DSPROPERTY_EAX30BUFFER_DIRECT;prop <= DSPROPERTY_EAX30BUFFER_FLAGS;++prop)
+        CHECK(set_long(&mirror, buf3, prop, (long)prop));
+    CHECK(mirror.count == DSPROPERTY_EAX30BUFFER_FLAGS - DSPROPERTY_EAX30BUFFER_DIRECT + 1);
+    for(prop = DSPROPERTY_EAX30BUFFER_DIRECT;prop <= DSPROPERTY_EAX30BUFFER_FLAGS;++prop)
+        CHECK(get_long(&mirror, buf3, prop, &val) && val == (long)prop);
+
+    EAXMirror_Clear(&mirror);
+}
+
+int main(void)
+{
+    test_find();
+    test_check_size();
+    test_mirror_fields();
+    test_mirror_deferred();
+    test_mirror_sends();
+    test_mirror_sizes();
+    return TEST_RESULT();
+}
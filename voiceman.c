@@ -27,10 +27,14 @@ HRESULT VoiceMan_Query(DSBuffer *buf, DWORD propid, ULONG *pTypeSupport) {
     return E_PROP_ID_UNSUPPORTED;
 }
 
-HRESULT VoiceMan_Set(DSBuffer *buf, DWORD propid, void *pPropData, ULONG cbPropData) {
+HRESULT VoiceMan_Set(DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                     void *pPropData, ULONG cbPropData) {
+    (void)set;
+    (void)cbPropData;
+    
     switch (propid) {
         case DSPROPERTY_VMANAGER_MODE:
-            if (cbPropData >= sizeof(DWORD) && *(DWORD*)pPropData < VMANAGER_MODE_MAX) {
+            if (*(DWORD*)pPropData < VMANAGER_MODE_MAX) {
                 TRACE("DSPROPERTY_VMANAGER_MODE set: %ld\n", *(DWORD*)pPropData);
                 buf->share->vm_managermode = *(DWORD*)pPropData;
                 
@@ -39,60 +43,55 @@ HRESULT VoiceMan_Set(DSBuffer *buf, DWORD propid, void *pPropData, ULONG cbPropD
             return DSERR_INVALIDPARAM;
             
         case DSPROPERTY_VMANAGER_PRIORITY:
-            if (cbPropData >= sizeof(DWORD)) {
-                TRACE("DSPROPERTY_VMANAGER_PRIORITY set: %ld\n", *(DWORD*)pPropData);
-                buf->vm_voicepriority = *(DWORD*)pPropData;
-                
-                return DS_OK;
-            }
-            return DSERR_INVALIDPARAM;
+            TRACE("DSPROPERTY_VMANAGER_PRIORITY set: %ld\n", *(DWORD*)pPropData);
+            buf->vm_voicepriority = *(DWORD*)pPropData;
+            
+            return DS_OK;
     }
     
     FIXME("Unhandled propid: 0x%08lx\n", propid);
     return E_PROP_ID_UNSUPPORTED;
 }
 
-HRESULT VoiceMan_Get(DSBuffer *buf, DWORD propid, void *pPropData, ULONG cbPropData, ULONG *pcbReturned) {
+HRESULT VoiceMan_Get(DSBuffer *buf, const struct PropSetInfo *set, DWORD propid,
+                     void *pPropData, ULONG cbPropData, ULONG *pcbReturned) {
+    (void)set;
+    (void)cbPropData;
     *pcbReturned = 0;
     
     switch (propid) {
         case DSPROPERTY_VMANAGER_MODE:
-            if (cbPropData >= sizeof(DWORD)) {
-                *pcbReturned = sizeof(DWORD);
-                
-                *(DWORD*)pPropData = buf->share->vm_managermode;
-                TRACE("DSPROPERTY_VMANAGER_MODE get %ld\n", *(DWORD*)pPropData);
-                
-                return DS_OK;
-            }
-            return DSERR_INVALIDPARAM;
+            *pcbReturned = sizeof(DWORD);
+            
+            *(DWORD*)pPropData = buf->share->vm_managermode;
+            TRACE("DSPROPERTY_VMANAGER_MODE get %ld\n", *(DWORD*)pPropData);
+            
+            return DS_OK;
             
         case DSPROPERTY_VMANAGER_PRIORITY:
-            if (cbPropData >= sizeof(DWORD)) {
-                *pcbReturned = sizeof(DWORD);
-                
-                *(DWORD*)pPropData = buf->vm_voicepriority;
-                TRACE("DSPROPERTY_VMANAGER_PRIORITY get %ld\n", *(DWORD*)pPropData);
-                
-                return DS_OK;
-            }
-            return DSERR_INVALIDPARAM;
+            *pcbReturned = sizeof(DWORD);
+            
+            *(DWORD*)pPropData = buf->vm_voicepriority;
+            TRACE("DSPROPERTY_VMANAGER_PRIORITY get %ld\n", *(DWORD*)pPropData);
+            
+            return DS_OK;
             
         case DSPROPERTY_VMANAGER_STATE:
-            if (cbPropData >= sizeof(DWORD)) {
-                *pcbReturned = sizeof(DWORD);
-                
-                /* FIXME: dubious handling */
-                if (buf->isplaying) {
-                    *(DWORD*)pPropData = DSPROPERTY_VMANAGER_STATE_PLAYING3DHW;
-                } else {
-                    *(DWORD*)pPropData = DSPROPERTY_VMANAGER_STATE_SILENT;
-                }
-                TRACE("DSPROPERTY_VMANAGER_STATE get %ld\n", *(DWORD*)pPropData);
-                
-                return DS_OK;
+            *pcbReturned = sizeof(DWORD);
+            
+            /* Voices that lost their source to another were bumped, and
+             * keep reporting it if they ended before getting one back.
+             */
+            if (buf->virt_idx && buf->isstolen) {
+                *(DWORD*)pPropData = DSPROPERTY_VMANAGER_STATE_BUMPED;
+            } else if (buf->isplaying) {
+                *(DWORD*)pPropData = DSPROPERTY_VMANAGER_STATE_PLAYING3DHW;
+            } else {
+                *(DWORD*)pPropData = buf->vm_voicestate;
             }
-            return DSERR_INVALIDPARAM;
+            TRACE("DSPROPERTY_VMANAGER_STATE get %ld\n", *(DWORD*)pPropData);
+            
+            return DS_OK;
     }
     
     FIXME("Unhandled propid: 0x%08lx\n", propid);